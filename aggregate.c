@@ -0,0 +1,538 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aggregate.h"
+#include "hashindex.h"
+#include "parallel.h"
+#include "sort.h"
+#include "output.h"
+#include "stats.h"
+
+// Rows are aggregated in chunks on the worker threads. Each chunk keeps its
+// own groups, split into partitions by the top bits of the key hash, and the
+// partitions are then merged in parallel, one per task, so no two threads
+// ever touch the same group.
+#define AGGREGATE_PARTITIONS 16
+#define AGGREGATE_PARTITION_SHIFT 28
+#define AGGREGATE_CHUNK_ROWS 65536
+#define AGGREGATE_BATCH_ROWS 1024
+
+// Running state of one aggregate in one group. min and max are kept as the
+// row holding the value, which works for every column type.
+typedef struct {
+    long long count;
+    long long intSum;
+    double floatSum;
+    int minRow;
+    int maxRow;
+} AggregateState;
+
+// Slot of the open-addressing table of a GroupTable. group is the group
+// index + 1, 0 marking an empty slot; the hash is kept alongside so probing
+// rarely has to look at the group itself.
+typedef struct {
+    unsigned hash;
+    int group;
+} GroupSlot;
+
+// The groups of one partition. A group is known by the first row seen with
+// its key, and has one state per output.
+typedef struct {
+    GroupSlot *slots;
+    int capacity;
+    int count;
+    int maxGroups;
+    int *groupRows;
+    unsigned *groupHashes;
+    AggregateState *states;
+} GroupTable;
+
+typedef struct {
+    const Table *table;
+    const Condition *condition;
+    Column **groupColumns;
+    int groupCount;
+    const AggregateOutput *outputs;
+    int outputCount;
+    const AggregateOrder *order;
+    int orderCount;
+    int limit;
+    int chunkRows;
+    int chunkCount;
+    GroupTable *partials;
+    GroupTable merged[AGGREGATE_PARTITIONS];
+    bool failed;
+} AggregationJob;
+
+static const char *aggregateNames[] = {"", "count", "sum", "min", "max", "avg"};
+
+bool parseAggregateName(const char *text, AggregateKind *kind) {
+    for (int i = AGG_COUNT; i <= AGG_AVG; i++) {
+        if (strcmp(text, aggregateNames[i]) == 0) {
+            *kind = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *aggregateName(AggregateKind kind) {
+    return aggregateNames[kind];
+}
+
+static unsigned groupHash(const AggregationJob *job, int row) {
+    unsigned h = 0x9e3779b9u;
+    for (int i = 0; i < job->groupCount; i++) {
+        h ^= hashColumnValue(job->groupColumns[i], row) + 0x9e3779b9u + (h << 6) + (h >> 2);
+    }
+    return h;
+}
+
+static bool sameGroup(const AggregationJob *job, int a, int b) {
+    for (int i = 0; i < job->groupCount; i++) {
+        if (compareRowValues(job->groupColumns[i], a, b) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool growSlots(GroupTable *groups) {
+    int capacity = groups->capacity > 0 ? groups->capacity * 2 : 64;
+    GroupSlot *slots = calloc(capacity, sizeof(GroupSlot));
+    if (!slots) {
+        return false;
+    }
+    for (int group = 0; group < groups->count; group++) {
+        unsigned slot = groups->groupHashes[group] & (capacity - 1);
+        while (slots[slot].group) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        slots[slot] = (GroupSlot){groups->groupHashes[group], group + 1};
+    }
+    free(groups->slots);
+    groups->slots = slots;
+    groups->capacity = capacity;
+    return true;
+}
+
+static bool growGroups(GroupTable *groups, int outputCount) {
+    int maxGroups = groups->maxGroups > 0 ? groups->maxGroups * 2 : 16;
+    int *groupRows = realloc(groups->groupRows, maxGroups * sizeof(int));
+    if (groupRows) {
+        groups->groupRows = groupRows;
+    }
+    unsigned *groupHashes = realloc(groups->groupHashes, maxGroups * sizeof(unsigned));
+    if (groupHashes) {
+        groups->groupHashes = groupHashes;
+    }
+    AggregateState *states = realloc(groups->states, (size_t)maxGroups * outputCount * sizeof(AggregateState));
+    if (states) {
+        groups->states = states;
+    }
+    if (!groupRows || !groupHashes || !states) {
+        return false;
+    }
+    groups->maxGroups = maxGroups;
+    return true;
+}
+
+// Returns the states of the group of row, adding the group if it is new.
+// Returns NULL when out of memory.
+static AggregateState *findGroup(GroupTable *groups, const AggregationJob *job, unsigned hash, int row) {
+    if (groups->capacity > 0) {
+        unsigned slot = hash & (groups->capacity - 1);
+        while (groups->slots[slot].group) {
+            int group = groups->slots[slot].group - 1;
+            if (groups->slots[slot].hash == hash && sameGroup(job, groups->groupRows[group], row)) {
+                return &groups->states[(size_t)group * job->outputCount];
+            }
+            slot = (slot + 1) & (groups->capacity - 1);
+        }
+    }
+
+    if ((groups->count + 1) * 2 > groups->capacity && !growSlots(groups)) {
+        return NULL;
+    }
+    if (groups->count == groups->maxGroups && !growGroups(groups, job->outputCount)) {
+        return NULL;
+    }
+    int group = groups->count++;
+    groups->groupRows[group] = row;
+    groups->groupHashes[group] = hash;
+    unsigned slot = hash & (groups->capacity - 1);
+    while (groups->slots[slot].group) {
+        slot = (slot + 1) & (groups->capacity - 1);
+    }
+    groups->slots[slot] = (GroupSlot){hash, group + 1};
+
+    AggregateState *states = &groups->states[(size_t)group * job->outputCount];
+    for (int i = 0; i < job->outputCount; i++) {
+        states[i] = (AggregateState){0, 0, 0.0, row, row};
+    }
+    return states;
+}
+
+static void freeGroupTable(GroupTable *groups) {
+    free(groups->slots);
+    free(groups->groupRows);
+    free(groups->groupHashes);
+    free(groups->states);
+}
+
+static void accumulateRow(const AggregationJob *job, AggregateState *states, int row) {
+    for (int i = 0; i < job->outputCount; i++) {
+        const Column *column = job->outputs[i].column;
+        AggregateState *state = &states[i];
+        state->count++;
+        switch (job->outputs[i].kind) {
+            case AGG_SUM:
+            case AGG_AVG:
+                if (column->type == INT) {
+                    state->intSum += column->intValues[row];
+                } else {
+                    state->floatSum += column->floatValues[row];
+                }
+                break;
+            case AGG_MIN:
+                if (compareRowValues(column, row, state->minRow) < 0) {
+                    state->minRow = row;
+                }
+                break;
+            case AGG_MAX:
+                if (compareRowValues(column, row, state->maxRow) > 0) {
+                    state->maxRow = row;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void combineStates(const AggregationJob *job, AggregateState *into, const AggregateState *from) {
+    for (int i = 0; i < job->outputCount; i++) {
+        const Column *column = job->outputs[i].column;
+        into[i].count += from[i].count;
+        into[i].intSum += from[i].intSum;
+        into[i].floatSum += from[i].floatSum;
+        if (job->outputs[i].kind == AGG_MIN && compareRowValues(column, from[i].minRow, into[i].minRow) < 0) {
+            into[i].minRow = from[i].minRow;
+        }
+        if (job->outputs[i].kind == AGG_MAX && compareRowValues(column, from[i].maxRow, into[i].maxRow) > 0) {
+            into[i].maxRow = from[i].maxRow;
+        }
+    }
+}
+
+static void aggregateChunk(void *context, int index) {
+    AggregationJob *job = context;
+    GroupTable *partitions = &job->partials[index * AGGREGATE_PARTITIONS];
+    int firstRow = index * job->chunkRows;
+    int endRow = firstRow + job->chunkRows < job->table->rowCount ? firstRow + job->chunkRows : job->table->rowCount;
+    int rows[AGGREGATE_BATCH_ROWS];
+
+    for (int start = firstRow; start < endRow; start += AGGREGATE_BATCH_ROWS) {
+        int blockRows = endRow - start < AGGREGATE_BATCH_ROWS ? endRow - start : AGGREGATE_BATCH_ROWS;
+        int count = blockRows;
+        if (job->condition) {
+            count = filterBlock(job->condition, start, blockRows, rows);
+        } else {
+            for (int i = 0; i < blockRows; i++) {
+                rows[i] = start + i;
+            }
+            countStat(STAT_ROWS_SCANNED, blockRows);
+        }
+
+        for (int i = 0; i < count; i++) {
+            unsigned hash = groupHash(job, rows[i]);
+            AggregateState *states = findGroup(&partitions[hash >> AGGREGATE_PARTITION_SHIFT], job, hash, rows[i]);
+            if (!states) {
+                __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+                return;
+            }
+            accumulateRow(job, states, rows[i]);
+        }
+    }
+}
+
+static void mergePartition(void *context, int partition) {
+    AggregationJob *job = context;
+    GroupTable *merged = &job->merged[partition];
+    if (job->chunkCount == 1) {
+        *merged = job->partials[partition];
+        memset(&job->partials[partition], 0, sizeof(GroupTable));
+        return;
+    }
+    for (int chunk = 0; chunk < job->chunkCount; chunk++) {
+        const GroupTable *partial = &job->partials[chunk * AGGREGATE_PARTITIONS + partition];
+        for (int group = 0; group < partial->count; group++) {
+            AggregateState *states = findGroup(merged, job, partial->groupHashes[group], partial->groupRows[group]);
+            if (!states) {
+                __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+                return;
+            }
+            combineStates(job, states, &partial->states[(size_t)group * job->outputCount]);
+        }
+    }
+}
+
+static double averageOf(const AggregateOutput *output, const AggregateState *state) {
+    double sum = output->column->type == INT ? (double)state->intSum : state->floatSum;
+    return state->count > 0 ? sum / state->count : 0.0;
+}
+
+// Writes output i of a group, whose states are given, to row of result.
+static void storeOutput(const AggregationJob *job, Table *result, int i, int row, int groupRow, const AggregateState *state) {
+    const AggregateOutput *output = &job->outputs[i];
+    Column *column = &result->columns[i];
+    char text[64] = "";
+
+    switch (output->kind) {
+        case AGG_NONE:
+            if (column->type == STRING) {
+                setValueFromString(column, row, getStringValue(output->column, groupRow));
+            } else {
+                memcpy((char *)column->values + (size_t)row * columnValueWidth(column),
+                       (char *)output->column->values + (size_t)groupRow * columnValueWidth(column), columnValueWidth(column));
+            }
+            return;
+        case AGG_COUNT:
+            column->intValues[row] = (int)state->count;
+            return;
+        case AGG_SUM:
+            if (output->column->type == INT) {
+                snprintf(text, sizeof(text), "%lld", state->intSum);
+            } else {
+                snprintf(text, sizeof(text), "%.2f", state->floatSum);
+            }
+            break;
+        case AGG_AVG:
+            if (state->count > 0) {
+                snprintf(text, sizeof(text), "%.2f", averageOf(output, state));
+            }
+            break;
+        case AGG_MIN:
+        case AGG_MAX:
+            if (state->count == 0) {
+                break;
+            }
+            int valueRow = output->kind == AGG_MIN ? state->minRow : state->maxRow;
+            if (output->column->type == INT) {
+                snprintf(text, sizeof(text), "%d", output->column->intValues[valueRow]);
+            } else if (output->column->type == FLOAT) {
+                snprintf(text, sizeof(text), "%.2f", output->column->floatValues[valueRow]);
+            } else {
+                setValueFromString(column, row, getStringValue(output->column, valueRow));
+                return;
+            }
+            break;
+    }
+    setValueFromString(column, row, text);
+}
+
+// The groups of all partitions in one list, for sorting them by their outputs.
+typedef struct {
+    const AggregationJob *job;
+    int *groupRows;
+    const AggregateState **states;
+} GroupList;
+
+// Compares the value of output i in two groups as it will be printed.
+static int compareOutputs(const GroupList *list, int i, int a, int b) {
+    const AggregateOutput *output = &list->job->outputs[i];
+    const AggregateState *x = &list->states[a][i];
+    const AggregateState *y = &list->states[b][i];
+    switch (output->kind) {
+        case AGG_NONE:
+            return compareRowValues(output->column, list->groupRows[a], list->groupRows[b]);
+        case AGG_COUNT:
+            return (x->count > y->count) - (x->count < y->count);
+        case AGG_SUM:
+            if (output->column->type == INT) {
+                return (x->intSum > y->intSum) - (x->intSum < y->intSum);
+            }
+            return (x->floatSum > y->floatSum) - (x->floatSum < y->floatSum);
+        case AGG_AVG: {
+            double ax = averageOf(output, x), ay = averageOf(output, y);
+            return (ax > ay) - (ax < ay);
+        }
+        case AGG_MIN:
+            return compareRowValues(output->column, x->minRow, y->minRow);
+        case AGG_MAX:
+            return compareRowValues(output->column, x->maxRow, y->maxRow);
+    }
+    return 0;
+}
+
+static int compareGroups(void *context, int a, int b) {
+    const GroupList *list = context;
+    for (int k = 0; k < list->job->orderCount; k++) {
+        int cmp = compareOutputs(list, list->job->order[k].output, a, b);
+        if (cmp) {
+            return list->job->order[k].descending ? -cmp : cmp;
+        }
+    }
+    return 0;
+}
+
+static void storeGroup(const AggregationJob *job, Table *result, int groupRow, const AggregateState *states) {
+    for (int i = 0; i < job->outputCount; i++) {
+        storeOutput(job, result, i, result->rowCount, groupRow, &states[i]);
+    }
+    result->rowCount++;
+}
+
+// Stores the groups sorted on the order outputs, keeping only the first
+// limit when there is one.
+static bool storeSortedGroups(const AggregationJob *job, Table *result, int groupCount) {
+    GroupList list = {job, malloc((size_t)groupCount * sizeof(int) + 1), malloc((size_t)groupCount * sizeof(AggregateState *) + 1)};
+    int *items = malloc((size_t)groupCount * sizeof(int) + 1);
+    Sorter sorter;
+    bool stored = list.groupRows && list.states && items && openSorter(&sorter, compareGroups, &list, job->limit);
+    if (stored) {
+        int count = 0;
+        for (int p = 0; p < AGGREGATE_PARTITIONS; p++) {
+            const GroupTable *groups = &job->merged[p];
+            for (int group = 0; group < groups->count; group++, count++) {
+                list.groupRows[count] = groups->groupRows[group];
+                list.states[count] = &groups->states[(size_t)group * job->outputCount];
+                items[count] = count;
+            }
+        }
+        stored = addToSorter(&sorter, items, groupCount) && finishSorter(&sorter);
+        int item;
+        while (stored && nextSortedItem(&sorter, &item)) {
+            storeGroup(job, result, list.groupRows[item], list.states[item]);
+        }
+        closeSorter(&sorter);
+    } else if (!list.groupRows || !list.states || !items) {
+        reportError("Error: Memory allocation failed while aggregating table '%s'.\n", job->table->tableName);
+    }
+    free(list.groupRows);
+    free(list.states);
+    free(items);
+    return stored;
+}
+
+// Lays out result with one column per output: grouping columns keep their
+// type, count is an int and the other aggregates are formatted as text.
+static bool buildResult(AggregationJob *job, Table *result) {
+    memset(result, 0, sizeof(Table));
+    snprintf(result->tableName, sizeof(result->tableName), "%s", job->table->tableName);
+    result->columns = calloc(job->outputCount, sizeof(Column));
+    if (!result->columns) {
+        reportError("Error: Memory allocation failed while aggregating table '%s'.\n", job->table->tableName);
+        return false;
+    }
+    result->columnCount = job->outputCount;
+    for (int i = 0; i < job->outputCount; i++) {
+        const AggregateOutput *output = &job->outputs[i];
+        Column *column = &result->columns[i];
+        if (output->kind == AGG_NONE) {
+            snprintf(column->name, sizeof(column->name), "%s", output->column->name);
+            column->type = output->column->type;
+            column->stringSize = output->column->stringSize;
+        } else {
+            int length = snprintf(column->name, sizeof(column->name), "%s(%s)", aggregateName(output->kind),
+                                  output->column ? output->column->name : "*");
+            if (length >= (int)sizeof(column->name)) {
+                // A long column name is cut short in the header, keeping the parenthesis.
+                column->name[sizeof(column->name) - 2] = ')';
+            }
+            column->type = output->kind == AGG_COUNT ? INT : STRING;
+            bool keepsString = (output->kind == AGG_MIN || output->kind == AGG_MAX) && output->column->type == STRING;
+            column->stringSize = keepsString ? output->column->stringSize : 40;
+        }
+    }
+
+    int groupCount = 0;
+    for (int p = 0; p < AGGREGATE_PARTITIONS; p++) {
+        groupCount += job->merged[p].count;
+    }
+    // Without grouping columns there is always exactly one result row.
+    bool emptyTotal = job->groupCount == 0 && groupCount == 0;
+    int rowCount = emptyTotal ? 1 : groupCount;
+    if (job->limit >= 0 && job->limit < rowCount) {
+        rowCount = job->limit;
+    }
+    if (!reserveRows(result, rowCount > 0 ? rowCount : 1)) {
+        return false;
+    }
+
+    if (emptyTotal) {
+        AggregateState empty[job->outputCount];
+        memset(empty, 0, sizeof(empty));
+        if (rowCount > 0) {
+            storeGroup(job, result, 0, empty);
+        }
+        return true;
+    }
+    if (job->orderCount > 0) {
+        return storeSortedGroups(job, result, groupCount);
+    }
+
+    for (int p = 0; p < AGGREGATE_PARTITIONS && result->rowCount < rowCount; p++) {
+        const GroupTable *groups = &job->merged[p];
+        for (int group = 0; group < groups->count && result->rowCount < rowCount; group++) {
+            storeGroup(job, result, groups->groupRows[group], &groups->states[(size_t)group * job->outputCount]);
+        }
+    }
+    return true;
+}
+
+// Aggregates the rows of table satisfying condition, which may be NULL, into
+// one row of result per distinct value of groupColumns, or a single row when
+// groupCount is 0. The rows are sorted on order and cut to limit rows unless
+// limit is negative. result must be released with freeTableStorage.
+bool aggregateTable(const Table *table, const Condition *condition, Column **groupColumns, int groupCount,
+                    const AggregateOutput *outputs, int outputCount, const AggregateOrder *order, int orderCount,
+                    int limit, Table *result) {
+    AggregationJob job;
+    memset(&job, 0, sizeof(job));
+    job.table = table;
+    job.condition = condition;
+    job.groupColumns = groupColumns;
+    job.groupCount = groupCount;
+    job.outputs = outputs;
+    job.outputCount = outputCount;
+    job.order = order;
+    job.orderCount = orderCount;
+    job.limit = limit;
+
+    // A few chunks per thread keep the threads evenly loaded. A single thread
+    // takes the table in one chunk, which leaves nothing to merge.
+    int chunksWanted = workerThreadCount() > 1 ? 4 * workerThreadCount() : 1;
+    int perChunk = (table->rowCount + chunksWanted - 1) / chunksWanted;
+    job.chunkRows = perChunk > AGGREGATE_CHUNK_ROWS ? perChunk : AGGREGATE_CHUNK_ROWS;
+    job.chunkCount = (table->rowCount + job.chunkRows - 1) / job.chunkRows;
+    job.partials = calloc((size_t)(job.chunkCount > 0 ? job.chunkCount : 1) * AGGREGATE_PARTITIONS, sizeof(GroupTable));
+    if (!job.partials) {
+        reportError("Error: Memory allocation failed while aggregating table '%s'.\n", table->tableName);
+        return false;
+    }
+
+    runParallel(job.chunkCount, aggregateChunk, &job);
+    if (!job.failed) {
+        runParallel(AGGREGATE_PARTITIONS, mergePartition, &job);
+    }
+
+    bool built = false;
+    if (job.failed) {
+        reportError("Error: Memory allocation failed while aggregating table '%s'.\n", table->tableName);
+    } else {
+        built = buildResult(&job, result);
+        if (!built) {
+            freeTableStorage(result);
+        }
+    }
+
+    for (int i = 0; i < job.chunkCount * AGGREGATE_PARTITIONS; i++) {
+        freeGroupTable(&job.partials[i]);
+    }
+    free(job.partials);
+    for (int p = 0; p < AGGREGATE_PARTITIONS; p++) {
+        freeGroupTable(&job.merged[p]);
+    }
+    return built;
+}
@@ -0,0 +1,28 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "filter.h"
+
+typedef enum { AGG_NONE, AGG_COUNT, AGG_SUM, AGG_MIN, AGG_MAX, AGG_AVG } AggregateKind;
+
+// One output column of an aggregate query: a grouping column when kind is
+// AGG_NONE, otherwise an aggregate over column, which is NULL for count(*).
+typedef struct {
+    AggregateKind kind;
+    Column *column;
+} AggregateOutput;
+
+// One sort key of an aggregate result: an index into the outputs.
+typedef struct {
+    int output;
+    bool descending;
+} AggregateOrder;
+
+bool parseAggregateName(const char *text, AggregateKind *kind);
+const char *aggregateName(AggregateKind kind);
+
+bool aggregateTable(const Table *table, const Condition *condition, Column **groupColumns, int groupCount,
+                    const AggregateOutput *outputs, int outputCount, const AggregateOrder *order, int orderCount,
+                    int limit, Table *result);
+
+#endif
@@ -0,0 +1,572 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// Benchmark driver. It starts the engine in server mode in a scratch
+// directory, fills a generated table and times each workload's commands
+// over the socket, one request at a time. Every workload prints one JSON
+// line with its throughput, latency percentiles and the server's peak RSS.
+// The generated data depends only on the options and the seed, so two runs
+// with the same arguments do the same work.
+
+#define BENCH_DATABASE "bench"
+#define BENCH_TABLE "T"
+#define MAX_MIX_COLUMNS 32
+
+// mkdtemp fills in the X's; paths inside it stay well within sun_path.
+#define SCRATCH_TEMPLATE "/tmp/axonbench.XXXXXX"
+
+typedef struct {
+    const char *engine;
+    int rows;
+    char mix[MAX_MIX_COLUMNS + 1];
+    int stringSize;
+    int batchRows;
+    int ops;
+    int repeat;
+    int threads;
+    uint64_t seed;
+    char workloads[256];
+    bool keep;
+} BenchOptions;
+
+typedef struct {
+    pid_t pid;
+    int fd;
+    char directory[sizeof(SCRATCH_TEMPLATE)];
+    char socketPath[sizeof(SCRATCH_TEMPLATE) + 16];
+} Server;
+
+// Latencies of one workload, in seconds, and the totals around them.
+typedef struct {
+    double *latencies;
+    int count;
+    int capacity;
+    int errors;
+    long long rows;
+    long long bytes;
+    double seconds;
+} Samples;
+
+static uint64_t randomState;
+
+static uint64_t nextRandom(void) {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool writeAll(int fd, const void *data, size_t length) {
+    const char *bytes = data;
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += written;
+        length -= written;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void *data, size_t length) {
+    char *bytes = data;
+    while (length > 0) {
+        ssize_t got = read(fd, bytes, length);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        bytes += got;
+        length -= got;
+    }
+    return true;
+}
+
+// Sends one command and reads its response, which is thrown away. Returns
+// false when the connection failed; *failed is set when the command
+// reported an error and *bytes to the size of its output.
+static bool request(Server *server, const char *command, bool *failed, long long *bytes) {
+    size_t length = strlen(command);
+    unsigned char header[5] = {(unsigned char)(length >> 24), (unsigned char)(length >> 16),
+                               (unsigned char)(length >> 8), (unsigned char)length, 0};
+    if (!writeAll(server->fd, header, 4) || !writeAll(server->fd, command, length) ||
+        !readAll(server->fd, header, 5)) {
+        return false;
+    }
+    size_t remaining = ((size_t)header[0] << 24) | ((size_t)header[1] << 16) | ((size_t)header[2] << 8) | header[3];
+    *failed = header[4] != 0;
+    *bytes = remaining;
+    char discard[64 * 1024];
+    while (remaining > 0) {
+        size_t chunk = remaining < sizeof(discard) ? remaining : sizeof(discard);
+        if (!readAll(server->fd, discard, chunk)) {
+            return false;
+        }
+        remaining -= chunk;
+    }
+    return true;
+}
+
+static void addSample(Samples *samples, double seconds) {
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 1024;
+        samples->latencies = realloc(samples->latencies, samples->capacity * sizeof(double));
+        if (!samples->latencies) {
+            fprintf(stderr, "Error: Out of memory for latency samples.\n");
+            exit(1);
+        }
+    }
+    samples->latencies[samples->count++] = seconds;
+}
+
+// Runs command as one timed operation of samples.
+static bool timed(Server *server, Samples *samples, const char *command) {
+    bool failed;
+    long long bytes;
+    double start = now();
+    if (!request(server, command, &failed, &bytes)) {
+        fprintf(stderr, "Error: Lost the connection to the engine.\n");
+        return false;
+    }
+    double elapsed = now() - start;
+    addSample(samples, elapsed);
+    samples->seconds += elapsed;
+    samples->bytes += bytes;
+    if (failed) {
+        samples->errors++;
+    }
+    return true;
+}
+
+// Runs a setup command that is not measured. Errors are fatal.
+static bool untimed(Server *server, const char *command) {
+    bool failed;
+    long long bytes;
+    if (!request(server, command, &failed, &bytes)) {
+        fprintf(stderr, "Error: Lost the connection to the engine.\n");
+        return false;
+    }
+    if (failed) {
+        fprintf(stderr, "Error: Setup command failed: %.80s\n", command);
+        return false;
+    }
+    return true;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of the sorted latencies, in milliseconds.
+static double percentile(const Samples *samples, double fraction) {
+    if (samples->count == 0) {
+        return 0;
+    }
+    int rank = (int)(fraction * samples->count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > samples->count) rank = samples->count;
+    return samples->latencies[rank - 1] * 1000.0;
+}
+
+// Peak resident set of the engine so far, from /proc, in kilobytes.
+static long peakRss(pid_t pid) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *file = fopen(path, "r");
+    long kb = -1;
+    if (!file) {
+        return kb;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, "VmHWM:", 6) == 0) {
+            kb = atol(line + 6);
+            break;
+        }
+    }
+    fclose(file);
+    return kb;
+}
+
+static void report(const BenchOptions *options, Server *server, const char *workload, Samples *samples) {
+    qsort(samples->latencies, samples->count, sizeof(double), compareDoubles);
+    double seconds = samples->seconds > 0 ? samples->seconds : 1e-9;
+    printf("{\"workload\": \"%s\", \"rows\": %d, \"columns\": \"%s\", \"string_size\": %d, \"seed\": %llu, "
+           "\"ops\": %d, \"errors\": %d, \"seconds\": %.6f, \"ops_per_sec\": %.2f, \"rows_per_sec\": %.2f, "
+           "\"bytes\": %lld, \"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, \"peak_rss_kb\": %ld}\n",
+           workload, options->rows, options->mix, options->stringSize, (unsigned long long)options->seed,
+           samples->count, samples->errors, samples->seconds, samples->count / seconds, samples->rows / seconds,
+           samples->bytes, percentile(samples, 0.50), percentile(samples, 0.99), percentile(samples, 1.0),
+           peakRss(server->pid));
+    fflush(stdout);
+}
+
+// Appends a generated value of column type kind to text.
+static int formatValue(char *text, char kind, int stringSize) {
+    uint64_t r = nextRandom();
+    if (kind == 'i') {
+        return sprintf(text, "%d", (int)(r % 1000000));
+    }
+    if (kind == 'f') {
+        return sprintf(text, "%d.%02d", (int)(r % 100000), (int)(r / 100000 % 100));
+    }
+    int length = stringSize > 0 ? 1 + (int)(r % stringSize) : 0;
+    text[0] = '"';
+    for (int i = 0; i < length; i++) {
+        text[1 + i] = 'a' + (char)(nextRandom() % 26);
+    }
+    text[1 + length] = '"';
+    return length + 2;
+}
+
+static size_t rowTextSize(const BenchOptions *options) {
+    return 16 + strlen(options->mix) * (options->stringSize + 24);
+}
+
+// Appends '(id, value, ...)' for a generated row.
+static int formatRow(char *text, const BenchOptions *options, int id) {
+    int length = sprintf(text, "(%d", id);
+    for (const char *kind = options->mix; *kind; kind++) {
+        length += sprintf(text + length, ", ");
+        length += formatValue(text + length, *kind, options->stringSize);
+    }
+    text[length++] = ')';
+    text[length] = '\0';
+    return length;
+}
+
+static bool runInsert(const BenchOptions *options, Server *server, Samples *samples) {
+    char *command = malloc(64 + (size_t)options->batchRows * (rowTextSize(options) + 2));
+    if (!command) {
+        fprintf(stderr, "Error: Out of memory for insert commands.\n");
+        return false;
+    }
+    bool ok = true;
+    for (int start = 0; ok && start < options->rows; start += options->batchRows) {
+        int count = options->rows - start < options->batchRows ? options->rows - start : options->batchRows;
+        int length = sprintf(command, "insertValues " BENCH_TABLE);
+        for (int i = 0; i < count; i++) {
+            if (i > 0) {
+                length += sprintf(command + length, ", ");
+            }
+            length += formatRow(command + length, options, start + i);
+        }
+        ok = timed(server, samples, command);
+        samples->rows += count;
+    }
+    free(command);
+    return ok;
+}
+
+// Text of a new value for the first generated column, the one updates set.
+static void updateValue(char *text, const BenchOptions *options) {
+    text[formatValue(text, options->mix[0], options->stringSize)] = '\0';
+}
+
+static bool runUpdate(const BenchOptions *options, Server *server, Samples *samples) {
+    char value[64 + options->stringSize], command[128 + options->stringSize];
+    for (int i = 0; i < options->ops; i++) {
+        updateValue(value, options);
+        snprintf(command, sizeof(command), "editValue " BENCH_TABLE " set c0 = %s if id == %d", value,
+                 (int)(nextRandom() % options->rows));
+        if (!timed(server, samples, command)) return false;
+        samples->rows++;
+    }
+    return true;
+}
+
+// Deletes ten consecutive ids per operation from random places.
+static bool runDelete(const BenchOptions *options, Server *server, Samples *samples) {
+    char command[128];
+    for (int i = 0; i < options->ops; i++) {
+        int low = (int)(nextRandom() % options->rows);
+        snprintf(command, sizeof(command), "deleteValue " BENCH_TABLE " if id between %d and %d", low, low + 9);
+        if (!timed(server, samples, command)) return false;
+        samples->rows += 10;
+    }
+    return true;
+}
+
+static bool runDisplay(const BenchOptions *options, Server *server, Samples *samples) {
+    for (int i = 0; i < options->repeat; i++) {
+        if (!timed(server, samples, "displayTable " BENCH_TABLE)) return false;
+        samples->rows += options->rows;
+    }
+    return true;
+}
+
+// Each save follows one untimed edit, so there is something to write.
+static bool runSave(const BenchOptions *options, Server *server, Samples *samples) {
+    char value[64 + options->stringSize], command[128 + options->stringSize];
+    for (int i = 0; i < options->repeat; i++) {
+        updateValue(value, options);
+        snprintf(command, sizeof(command), "editValue " BENCH_TABLE " set c0 = %s if id == %d", value, i);
+        if (!untimed(server, command) || !timed(server, samples, "commitAll")) return false;
+        samples->rows += options->rows;
+    }
+    return true;
+}
+
+// Times loadDatabase together with the first query, which copies the table
+// in from the mapped file, after an untimed save and unload.
+static bool runLoad(const BenchOptions *options, Server *server, Samples *samples) {
+    if (!untimed(server, "commitAll")) {
+        return false;
+    }
+    for (int i = 0; i < options->repeat; i++) {
+        if (!untimed(server, "unloadDatabase " BENCH_DATABASE)) return false;
+        Samples both = {0};
+        bool ok = timed(server, &both, "loadDatabase " BENCH_DATABASE) &&
+                  timed(server, &both, "displayTable " BENCH_TABLE " limit 1");
+        if (ok) {
+            addSample(samples, both.seconds);
+            samples->seconds += both.seconds;
+            samples->errors += both.errors;
+            samples->bytes += both.bytes;
+            samples->rows += options->rows;
+        }
+        free(both.latencies);
+        if (!ok) return false;
+    }
+    return true;
+}
+
+static bool writeConfig(const BenchOptions *options, const char *directory) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/config.txt", directory);
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Error: Could not write %s.\n", path);
+        return false;
+    }
+    fprintf(file, "AutomaticallyLoadDatabases = False\nWorkerThreads = %d\n", options->threads);
+    fclose(file);
+    snprintf(path, sizeof(path), "%s/data", directory);
+    return mkdir(path, 0755) == 0;
+}
+
+static bool startServer(const BenchOptions *options, Server *server) {
+    char engine[PATH_MAX];
+    if (!realpath(options->engine, engine)) {
+        fprintf(stderr, "Error: Engine '%s' not found.\n", options->engine);
+        return false;
+    }
+    memcpy(server->directory, SCRATCH_TEMPLATE, sizeof(SCRATCH_TEMPLATE));
+    if (!mkdtemp(server->directory) || !writeConfig(options, server->directory)) {
+        fprintf(stderr, "Error: Could not set up a scratch directory.\n");
+        return false;
+    }
+    snprintf(server->socketPath, sizeof(server->socketPath), "%s/engine.sock", server->directory);
+
+    server->pid = fork();
+    if (server->pid < 0) {
+        perror("Error starting the engine");
+        return false;
+    }
+    if (server->pid == 0) {
+        char logPath[PATH_MAX];
+        snprintf(logPath, sizeof(logPath), "%s/engine.log", server->directory);
+        int log = open(logPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log >= 0) {
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+            close(log);
+        }
+        if (chdir(server->directory) == 0) {
+            execl(engine, engine, "--socket", server->socketPath, (char *)NULL);
+        }
+        _exit(127);
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", server->socketPath);
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        server->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (server->fd >= 0 && connect(server->fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+            return true;
+        }
+        if (server->fd >= 0) close(server->fd);
+        if (waitpid(server->pid, NULL, WNOHANG) == server->pid) break;
+        usleep(10000);
+    }
+    fprintf(stderr, "Error: The engine did not start; see %s/engine.log.\n", server->directory);
+    server->fd = -1;
+    return false;
+}
+
+static int removeEntry(const char *path, const struct stat *info, int flag, struct FTW *ftw) {
+    (void)info;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static void stopServer(const BenchOptions *options, Server *server) {
+    if (server->fd >= 0) {
+        close(server->fd);
+    }
+    if (server->pid > 0) {
+        kill(server->pid, SIGTERM);
+        waitpid(server->pid, NULL, 0);
+    }
+    if (options->keep) {
+        fprintf(stderr, "Kept %s.\n", server->directory);
+    } else if (server->directory[0]) {
+        nftw(server->directory, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+}
+
+static void printUsage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s ENGINE [options]\n"
+            "  --rows N          rows in the generated table (100000)\n"
+            "  --columns MIX     column types after the int id, i/f/s each (ifs)\n"
+            "  --string-size N   width of string columns (16)\n"
+            "  --batch N         rows per insertValues (1000)\n"
+            "  --ops N           operations of the update and delete workloads (1000)\n"
+            "  --repeat N        runs of the display, save and load workloads (5)\n"
+            "  --threads N       WorkerThreads of the engine, 0 for one per CPU (0)\n"
+            "  --seed N          seed of the generator (1)\n"
+            "  --workloads LIST  comma-separated, from insert,update,delete,display,save,load\n"
+            "  --keep            keep the scratch directory\n",
+            program);
+}
+
+static bool parseOptions(int argc, char **argv, BenchOptions *options) {
+    if (argc < 2 || argv[1][0] == '-') {
+        return false;
+    }
+    options->engine = argv[1];
+    for (int i = 2; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--keep") == 0) {
+            options->keep = true;
+            continue;
+        }
+        if (!value) {
+            return false;
+        }
+        if (strcmp(argv[i], "--rows") == 0) {
+            options->rows = atoi(value);
+        } else if (strcmp(argv[i], "--columns") == 0) {
+            if (strlen(value) == 0 || strlen(value) > MAX_MIX_COLUMNS || strspn(value, "ifs") != strlen(value)) {
+                return false;
+            }
+            strcpy(options->mix, value);
+        } else if (strcmp(argv[i], "--string-size") == 0) {
+            options->stringSize = atoi(value);
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            options->batchRows = atoi(value);
+        } else if (strcmp(argv[i], "--ops") == 0) {
+            options->ops = atoi(value);
+        } else if (strcmp(argv[i], "--repeat") == 0) {
+            options->repeat = atoi(value);
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            options->threads = atoi(value);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            options->seed = strtoull(value, NULL, 10);
+        } else if (strcmp(argv[i], "--workloads") == 0) {
+            snprintf(options->workloads, sizeof(options->workloads), "%s", value);
+        } else {
+            return false;
+        }
+        i++;
+    }
+    return options->rows > 0 && options->batchRows > 0 && options->ops >= 0 && options->repeat >= 0 &&
+           options->stringSize > 0 && options->stringSize < 1000;
+}
+
+typedef struct {
+    const char *name;
+    bool (*run)(const BenchOptions *options, Server *server, Samples *samples);
+} Workload;
+
+static const Workload workloads[] = {
+    {"insert", runInsert}, {"update", runUpdate}, {"delete", runDelete},
+    {"display", runDisplay}, {"save", runSave}, {"load", runLoad},
+};
+
+static bool selected(const BenchOptions *options, const char *name) {
+    size_t length = strlen(name);
+    for (const char *item = options->workloads; *item;) {
+        const char *end = strchr(item, ',');
+        size_t itemLength = end ? (size_t)(end - item) : strlen(item);
+        if (itemLength == length && strncmp(item, name, length) == 0) {
+            return true;
+        }
+        item += itemLength + (end ? 1 : 0);
+    }
+    return false;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options = {NULL, 100000, "ifs", 16, 1000, 1000, 5, 0, 1, "insert,update,delete,display,save,load", false};
+    if (!parseOptions(argc, argv, &options)) {
+        printUsage(argv[0]);
+        return 2;
+    }
+    randomState = options.seed ? options.seed : 1;
+
+    Server server = {0};
+    server.fd = -1;
+    signal(SIGPIPE, SIG_IGN);
+    if (!startServer(&options, &server)) {
+        stopServer(&options, &server);
+        return 1;
+    }
+
+    // The table: id int PRIMARY, then c0, c1, ... as the mix gives them.
+    char schema[64 + MAX_MIX_COLUMNS * 32];
+    int length = sprintf(schema, "createTable " BENCH_TABLE "[id int PRIMARY");
+    for (int i = 0; options.mix[i]; i++) {
+        char kind = options.mix[i];
+        if (kind == 's') {
+            length += sprintf(schema + length, ", c%d string{%d}", i, options.stringSize);
+        } else {
+            length += sprintf(schema + length, ", c%d %s", i, kind == 'i' ? "int" : "float");
+        }
+    }
+    strcpy(schema + length, "]");
+
+    bool ok = untimed(&server, "createDatabase " BENCH_DATABASE) && untimed(&server, schema);
+    for (size_t w = 0; ok && w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        const Workload *workload = &workloads[w];
+        bool wanted = selected(&options, workload->name);
+        // The insert workload always runs, since the others need the rows.
+        if (!wanted && w > 0) {
+            continue;
+        }
+        Samples samples = {0};
+        ok = workload->run(&options, &server, &samples);
+        if (ok && wanted) {
+            report(&options, &server, workload->name, &samples);
+        }
+        free(samples.latencies);
+    }
+
+    stopServer(&options, &server);
+    return ok ? 0 : 1;
+}
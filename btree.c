@@ -0,0 +1,452 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "btree.h"
+#include "pool.h"
+#include "output.h"
+
+static const char *entryString(const Column *column, const IndexEntry *entry) {
+    return entry->key.strKey ? entry->key.strKey : getStringValue(column, entry->row);
+}
+
+static int compareKeys(const Column *column, const IndexEntry *a, const IndexEntry *b) {
+    if (column->type == INT) {
+        return (a->key.intKey > b->key.intKey) - (a->key.intKey < b->key.intKey);
+    } else if (column->type == FLOAT) {
+        return (a->key.floatKey > b->key.floatKey) - (a->key.floatKey < b->key.floatKey);
+    }
+    return strcmp(entryString(column, a), entryString(column, b));
+}
+
+static int compareEntries(const Column *column, const IndexEntry *a, const IndexEntry *b) {
+    int result = compareKeys(column, a, b);
+    if (result != 0) {
+        return result;
+    }
+    return (a->row > b->row) - (a->row < b->row);
+}
+
+static int compareValueToEntry(const Column *column, const Value *value, const IndexEntry *entry) {
+    if (column->type == INT) {
+        return (value->intValue > entry->key.intKey) - (value->intValue < entry->key.intKey);
+    } else if (column->type == FLOAT) {
+        return (value->floatValue > entry->key.floatKey) - (value->floatValue < entry->key.floatKey);
+    }
+    return strcmp(value->strValue, entryString(column, entry));
+}
+
+static IndexEntry entryForRow(const Column *column, int row) {
+    IndexEntry entry;
+    entry.key.strKey = NULL;
+    if (column->type == INT) {
+        entry.key.intKey = column->intValues[row];
+    } else if (column->type == FLOAT) {
+        entry.key.floatKey = column->floatValues[row];
+    }
+    entry.row = row;
+    return entry;
+}
+
+// Separators outlive the row they were taken from, so string keys are copied.
+static IndexEntry separatorFor(const Column *column, const IndexEntry *entry) {
+    IndexEntry separator = *entry;
+    if (column->type == STRING) {
+        separator.key.strKey = strdup(entryString(column, entry));
+    }
+    return separator;
+}
+
+static BTreeNode *createNode(bool isLeaf) {
+    BTreeNode *node;
+    if (isLeaf) {
+        BTreeLeaf *leaf = poolAlloc(sizeof(BTreeLeaf));
+        if (!leaf) {
+            return NULL;
+        }
+        leaf->next = NULL;
+        node = &leaf->node;
+    } else {
+        BTreeInternal *internal = poolAlloc(sizeof(BTreeInternal));
+        if (!internal) {
+            return NULL;
+        }
+        node = &internal->node;
+    }
+    node->isLeaf = isLeaf;
+    node->count = 0;
+    return node;
+}
+
+static void freeNode(BTreeNode *node, bool ownsStrings) {
+    if (!node->isLeaf) {
+        BTreeInternal *internal = (BTreeInternal *)node;
+        for (int i = 0; i <= node->count; i++) {
+            freeNode(internal->children[i], ownsStrings);
+        }
+        if (ownsStrings) {
+            for (int i = 0; i < node->count; i++) {
+                free(node->entries[i].key.strKey);
+            }
+        }
+    }
+    poolFree(node, node->isLeaf ? sizeof(BTreeLeaf) : sizeof(BTreeInternal));
+}
+
+void freeBTree(BTree *tree) {
+    if (!tree) {
+        return;
+    }
+    if (tree->root) {
+        freeNode(tree->root, tree->type == STRING);
+    }
+    free(tree);
+}
+
+static size_t nodeBytes(const BTreeNode *node) {
+    if (node->isLeaf) {
+        return sizeof(BTreeLeaf);
+    }
+    const BTreeInternal *internal = (const BTreeInternal *)node;
+    size_t bytes = sizeof(BTreeInternal);
+    for (int i = 0; i <= node->count; i++) {
+        bytes += nodeBytes(internal->children[i]);
+    }
+    return bytes;
+}
+
+size_t btreeBytes(const BTree *tree) {
+    return tree && tree->root ? sizeof(BTree) + nodeBytes(tree->root) : 0;
+}
+
+static int childFor(const Column *column, const BTreeNode *node, const IndexEntry *entry) {
+    int low = 0, high = node->count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (compareEntries(column, &node->entries[mid], entry) <= 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void freeEmptyNode(BTreeNode *node) {
+    if (node) {
+        poolFree(node, node->isLeaf ? sizeof(BTreeLeaf) : sizeof(BTreeInternal));
+    }
+}
+
+// Inserts entry below node. When node splits, the new right sibling and the
+// separator to insert into the parent are returned through the out pointers.
+// A full node gets its sibling before anything below it changes, so when an
+// allocation fails the tree is left as it was.
+static bool insertInto(BTreeNode *node, const Column *column, const IndexEntry *entry, IndexEntry *separator, BTreeNode **sibling) {
+    *sibling = NULL;
+    BTreeNode *right = NULL;
+    if (node->count == BTREE_ORDER - 1) {
+        right = createNode(node->isLeaf);
+        if (!right) {
+            return false;
+        }
+    }
+
+    if (node->isLeaf) {
+        int pos = childFor(column, node, entry);
+        memmove(&node->entries[pos + 1], &node->entries[pos], (node->count - pos) * sizeof(IndexEntry));
+        node->entries[pos] = *entry;
+        node->count++;
+        if (!right) {
+            return true;
+        }
+
+        BTreeLeaf *rightLeaf = (BTreeLeaf *)right;
+        int half = node->count / 2;
+        right->count = node->count - half;
+        memcpy(right->entries, &node->entries[half], right->count * sizeof(IndexEntry));
+        node->count = half;
+        rightLeaf->next = ((BTreeLeaf *)node)->next;
+        ((BTreeLeaf *)node)->next = rightLeaf;
+
+        *separator = separatorFor(column, &right->entries[0]);
+        *sibling = right;
+        return true;
+    }
+
+    BTreeInternal *internal = (BTreeInternal *)node;
+    int child = childFor(column, node, entry);
+    IndexEntry childSeparator;
+    BTreeNode *childSibling;
+    if (!insertInto(internal->children[child], column, entry, &childSeparator, &childSibling)) {
+        freeEmptyNode(right);
+        return false;
+    }
+    if (!childSibling) {
+        freeEmptyNode(right);
+        return true;
+    }
+
+    memmove(&node->entries[child + 1], &node->entries[child], (node->count - child) * sizeof(IndexEntry));
+    memmove(&internal->children[child + 2], &internal->children[child + 1], (node->count - child) * sizeof(BTreeNode *));
+    node->entries[child] = childSeparator;
+    internal->children[child + 1] = childSibling;
+    node->count++;
+    if (!right) {
+        return true;
+    }
+
+    BTreeInternal *rightInternal = (BTreeInternal *)right;
+    int mid = node->count / 2;
+    right->count = node->count - mid - 1;
+    memcpy(right->entries, &node->entries[mid + 1], right->count * sizeof(IndexEntry));
+    memcpy(rightInternal->children, &internal->children[mid + 1], (right->count + 1) * sizeof(BTreeNode *));
+    *separator = node->entries[mid];
+    node->count = mid;
+    *sibling = right;
+    return true;
+}
+
+bool btreeInsert(BTree *tree, const Column *column, int row) {
+    IndexEntry entry = entryForRow(column, row);
+    IndexEntry separator;
+    BTreeNode *sibling;
+
+    // The root splits only when it is full, so the new root is allocated
+    // up front like the siblings.
+    BTreeInternal *root = NULL;
+    if (tree->root->count == BTREE_ORDER - 1) {
+        root = (BTreeInternal *)createNode(false);
+    }
+    if ((tree->root->count == BTREE_ORDER - 1 && !root) ||
+        !insertInto(tree->root, column, &entry, &separator, &sibling)) {
+        freeEmptyNode(root ? &root->node : NULL);
+        reportError("Error: Memory allocation failed for index on column '%s'.\n", column->name);
+        return false;
+    }
+    tree->count++;
+    if (!sibling) {
+        freeEmptyNode(root ? &root->node : NULL);
+        return true;
+    }
+
+    root->node.count = 1;
+    root->node.entries[0] = separator;
+    root->children[0] = tree->root;
+    root->children[1] = sibling;
+    tree->root = &root->node;
+    return true;
+}
+
+// Removes the entry of row while its value is still stored in the column.
+// Leaves are allowed to underflow; deletes rebuild the tree through
+// btreeRemapRows, which packs it again.
+void btreeRemove(BTree *tree, const Column *column, int row) {
+    IndexEntry entry = entryForRow(column, row);
+    BTreeNode *node = tree->root;
+    while (!node->isLeaf) {
+        node = ((BTreeInternal *)node)->children[childFor(column, node, &entry)];
+    }
+
+    for (int i = 0; i < node->count; i++) {
+        if (node->entries[i].row == row && compareKeys(column, &node->entries[i], &entry) == 0) {
+            memmove(&node->entries[i], &node->entries[i + 1], (node->count - i - 1) * sizeof(IndexEntry));
+            node->count--;
+            tree->count--;
+            return;
+        }
+    }
+}
+
+static BTreeLeaf *firstLeaf(const BTree *tree) {
+    BTreeNode *node = tree->root;
+    while (!node->isLeaf) {
+        node = ((BTreeInternal *)node)->children[0];
+    }
+    return (BTreeLeaf *)node;
+}
+
+static void freeLevel(BTreeNode **level, int first, int end, bool ownsStrings) {
+    for (int i = first; i < end; i++) {
+        freeNode(level[i], ownsStrings);
+    }
+}
+
+// Builds a packed tree bottom-up from entries already in index order.
+static BTreeNode *bulkLoad(const Column *column, const IndexEntry *entries, int count) {
+    int perLeaf = BTREE_ORDER - 1;
+    int levelCount = count > 0 ? (count + perLeaf - 1) / perLeaf : 1;
+    BTreeNode **level = malloc(levelCount * sizeof(BTreeNode *));
+    IndexEntry *lowest = malloc(levelCount * sizeof(IndexEntry));
+    if (!level || !lowest) {
+        free(level);
+        free(lowest);
+        return NULL;
+    }
+
+    BTreeLeaf *previous = NULL;
+    for (int i = 0; i < levelCount; i++) {
+        BTreeLeaf *leaf = (BTreeLeaf *)createNode(true);
+        if (!leaf) {
+            freeLevel(level, 0, i, false);
+            free(level);
+            free(lowest);
+            return NULL;
+        }
+        int start = i * perLeaf;
+        int n = count - start < perLeaf ? count - start : perLeaf;
+        if (n < 0) {
+            n = 0;
+        }
+        memcpy(leaf->node.entries, &entries[start], n * sizeof(IndexEntry));
+        leaf->node.count = n;
+        if (n > 0) {
+            lowest[i] = entries[start];
+        }
+        if (previous) {
+            previous->next = leaf;
+        }
+        previous = leaf;
+        level[i] = &leaf->node;
+    }
+
+    int perInternal = BTREE_ORDER;
+    while (levelCount > 1) {
+        int parentCount = (levelCount + perInternal - 1) / perInternal;
+        for (int i = 0; i < parentCount; i++) {
+            BTreeInternal *parent = (BTreeInternal *)createNode(false);
+            if (!parent) {
+                // Parents 0 to i - 1 own the nodes they were built from;
+                // the rest of the lower level is still unowned.
+                bool ownsStrings = column->type == STRING;
+                freeLevel(level, 0, i, ownsStrings);
+                freeLevel(level, i * perInternal, levelCount, ownsStrings);
+                free(level);
+                free(lowest);
+                return NULL;
+            }
+            int start = i * perInternal;
+            int n = levelCount - start < perInternal ? levelCount - start : perInternal;
+            for (int j = 0; j < n; j++) {
+                parent->children[j] = level[start + j];
+                if (j > 0) {
+                    parent->node.entries[j - 1] = separatorFor(column, &lowest[start + j]);
+                }
+            }
+            parent->node.count = n - 1;
+            level[i] = &parent->node;
+            lowest[i] = lowest[start];
+        }
+        levelCount = parentCount;
+    }
+
+    BTreeNode *root = level[0];
+    free(level);
+    free(lowest);
+    return root;
+}
+
+static int compareEntriesForSort(const void *a, const void *b, void *column) {
+    return compareEntries(column, a, b);
+}
+
+BTree *buildBTree(const Column *column, int rowCount) {
+    BTree *tree = malloc(sizeof(BTree));
+    IndexEntry *entries = malloc((rowCount > 0 ? rowCount : 1) * sizeof(IndexEntry));
+    if (!tree || !entries) {
+        free(tree);
+        free(entries);
+        reportError("Error: Memory allocation failed for index on column '%s'.\n", column->name);
+        return NULL;
+    }
+
+    for (int row = 0; row < rowCount; row++) {
+        entries[row] = entryForRow(column, row);
+    }
+    qsort_r(entries, rowCount, sizeof(IndexEntry), compareEntriesForSort, (void *)column);
+
+    tree->root = bulkLoad(column, entries, rowCount);
+    tree->type = column->type;
+    tree->count = rowCount;
+    free(entries);
+    if (!tree->root) {
+        free(tree);
+        reportError("Error: Memory allocation failed for index on column '%s'.\n", column->name);
+        return NULL;
+    }
+    return tree;
+}
+
+// Renumbers rows after rows were removed from the table. newRows maps every
+// old row to its new position, or -1 when the row was deleted. Entries keep
+// their relative order, so the tree is rebuilt without sorting.
+bool btreeRemapRows(BTree *tree, const Column *column, const int *newRows) {
+    IndexEntry *entries = malloc((tree->count > 0 ? tree->count : 1) * sizeof(IndexEntry));
+    if (!entries) {
+        reportError("Error: Memory allocation failed for index on column '%s'.\n", column->name);
+        return false;
+    }
+
+    int count = 0;
+    for (BTreeLeaf *leaf = firstLeaf(tree); leaf; leaf = leaf->next) {
+        for (int i = 0; i < leaf->node.count; i++) {
+            int row = newRows[leaf->node.entries[i].row];
+            if (row >= 0) {
+                entries[count] = leaf->node.entries[i];
+                entries[count].row = row;
+                count++;
+            }
+        }
+    }
+
+    BTreeNode *root = bulkLoad(column, entries, count);
+    free(entries);
+    if (!root) {
+        reportError("Error: Memory allocation failed for index on column '%s'.\n", column->name);
+        return false;
+    }
+    freeNode(tree->root, tree->type == STRING);
+    tree->root = root;
+    tree->count = count;
+    return true;
+}
+
+// Appends to rows every row whose value lies within the given bounds, in
+// index order. A NULL bound leaves that side open. Returns the row count.
+int btreeRange(const BTree *tree, const Column *column, const Value *low, bool lowInclusive, const Value *high, bool highInclusive, int *rows) {
+    BTreeNode *node = tree->root;
+    while (!node->isLeaf) {
+        int child = 0;
+        if (low) {
+            while (child < node->count) {
+                int cmp = compareValueToEntry(column, low, &node->entries[child]);
+                if (cmp < 0 || (cmp == 0 && lowInclusive)) {
+                    break;
+                }
+                child++;
+            }
+        }
+        node = ((BTreeInternal *)node)->children[child];
+    }
+
+    int count = 0;
+    for (BTreeLeaf *leaf = (BTreeLeaf *)node; leaf; leaf = leaf->next) {
+        for (int i = 0; i < leaf->node.count; i++) {
+            const IndexEntry *entry = &leaf->node.entries[i];
+            if (low) {
+                int cmp = compareValueToEntry(column, low, entry);
+                if (cmp > 0 || (cmp == 0 && !lowInclusive)) {
+                    continue;
+                }
+            }
+            if (high) {
+                int cmp = compareValueToEntry(column, high, entry);
+                if (cmp < 0 || (cmp == 0 && !highInclusive)) {
+                    return count;
+                }
+            }
+            rows[count++] = entry->row;
+        }
+    }
+    return count;
+}
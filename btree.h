@@ -0,0 +1,55 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include "storage.h"
+
+#define BTREE_ORDER 64
+
+// Entries order by (value, row). Leaves reference string values through the
+// row; separators in internal nodes keep their own copy of the string so
+// later edits of that row cannot reorder the tree.
+typedef union {
+    int intKey;
+    float floatKey;
+    char *strKey;
+} IndexKey;
+
+typedef struct {
+    IndexKey key;
+    int row;
+} IndexEntry;
+
+typedef struct BTreeNode {
+    bool isLeaf;
+    int count;
+    IndexEntry entries[BTREE_ORDER];
+} BTreeNode;
+
+typedef struct {
+    BTreeNode node;
+    BTreeNode *children[BTREE_ORDER + 1];
+} BTreeInternal;
+
+typedef struct BTreeLeaf {
+    BTreeNode node;
+    struct BTreeLeaf *next;
+} BTreeLeaf;
+
+typedef struct BTree {
+    BTreeNode *root;
+    DataType type;
+    int count;
+} BTree;
+
+BTree *buildBTree(const Column *column, int rowCount);
+void freeBTree(BTree *tree);
+// Bytes of the tree's nodes, not counting copied string separators.
+size_t btreeBytes(const BTree *tree);
+
+bool btreeInsert(BTree *tree, const Column *column, int row);
+void btreeRemove(BTree *tree, const Column *column, int row);
+bool btreeRemapRows(BTree *tree, const Column *column, const int *newRows);
+
+int btreeRange(const BTree *tree, const Column *column, const Value *low, bool lowInclusive, const Value *high, bool highInclusive, int *rows);
+
+#endif
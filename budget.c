@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "budget.h"
+#include "hashindex.h"
+#include "btree.h"
+#include "pool.h"
+#include "stats.h"
+#include "output.h"
+#include "fileio.h"
+
+#define EVICT_SCRATCH_DIRECTORY "data/evict"
+
+unsigned long tableUseClock = 1;
+static size_t budgetBytes = 0;
+// Set once the budget could not be met, so the warning is shown once until
+// it is met again.
+static bool overBudgetWarned = false;
+
+void setMemoryBudget(size_t bytes) {
+    budgetBytes = bytes;
+}
+
+size_t memoryBudget(void) {
+    return budgetBytes;
+}
+
+// Writes the column blocks of a table with unsaved rows to a new spill file.
+// The database file is left alone, so the rows are still uncommitted.
+static bool spillTable(Table *table) {
+    int fd = openScratchFile(EVICT_SCRATCH_DIRECTORY, "table");
+    if (fd < 0) {
+        fprintf(commandOutput(), "Warning: Could not create an eviction file in '%s': %s\n", EVICT_SCRATCH_DIRECTORY, strerror(errno));
+        return false;
+    }
+
+    bool *indexed = malloc((table->columnCount > 0 ? table->columnCount : 1) * sizeof(bool));
+    bool ok = indexed != NULL;
+    uint64_t offset = 0;
+    for (int i = 0; ok && i < table->columnCount; i++) {
+        const Column *column = &table->columns[i];
+        size_t size = (size_t)table->rowCount * columnValueWidth(column);
+        ok = writeFully(fd, column->values, size, offset);
+        offset += size;
+        indexed[i] = column->orderedIndex != NULL;
+    }
+    if (!ok) {
+        fprintf(commandOutput(), "Warning: Could not write table '%s' to '%s': %s\n", table->tableName, EVICT_SCRATCH_DIRECTORY,
+                indexed ? strerror(errno) : "out of memory");
+        free(indexed);
+        close(fd);
+        return false;
+    }
+    table->spilled = true;
+    table->spillFd = fd;
+    table->spillIndexed = indexed;
+    return true;
+}
+
+bool evictTable(Table *table) {
+    if ((table->dirty || !table->storedColumns) && !spillTable(table)) {
+        return false;
+    }
+    bumpCatalogVersion();
+    for (int i = 0; i < table->columnCount; i++) {
+        Column *column = &table->columns[i];
+        freeColumnStorage(column, table->maxRows);
+        freeHashIndex(column->primaryIndex);
+        column->primaryIndex = NULL;
+        freeBTree(column->orderedIndex);
+        column->orderedIndex = NULL;
+    }
+    table->maxRows = 0;
+    table->loaded = false;
+    return true;
+}
+
+bool readSpilledTable(Table *table) {
+    uint64_t offset = 0;
+    for (int i = 0; i < table->columnCount; i++) {
+        Column *column = &table->columns[i];
+        size_t size = (size_t)table->rowCount * columnValueWidth(column);
+        if (!readFully(table->spillFd, column->values, size, offset)) {
+            reportError("Error: Could not read evicted table '%s' back: %s\n", table->tableName, strerror(errno));
+            return false;
+        }
+        offset += size;
+        countStat(STAT_BYTES_READ, size);
+    }
+    return true;
+}
+
+// The loaded table used longest ago, not counting those the current command
+// used, those that hold no rows and those passed over in skipped because
+// they could not be written out.
+static Table *coldestTable(Database **databases, int databaseCount, Table **skipped, int skippedCount) {
+    Table *coldest = NULL;
+    for (int i = 0; i < databaseCount; i++) {
+        for (int j = 0; j < databases[i]->tableCount; j++) {
+            Table *table = databases[i]->tables[j];
+            if (!table->loaded || table->maxRows == 0 || table->lastUsed >= tableUseClock) {
+                continue;
+            }
+            bool wasSkipped = false;
+            for (int k = 0; k < skippedCount && !wasSkipped; k++) {
+                wasSkipped = skipped[k] == table;
+            }
+            if (!wasSkipped && (!coldest || table->lastUsed < coldest->lastUsed)) {
+                coldest = table;
+            }
+        }
+    }
+    return coldest;
+}
+
+// Tables that failed to spill in one call, passed over for the rest of it.
+#define MAX_SKIPPED_TABLES 16
+
+void enforceMemoryBudget(Database **databases, int databaseCount) {
+    Table *skipped[MAX_SKIPPED_TABLES];
+    int skippedCount = 0;
+    while (budgetBytes > 0 && poolLiveBytes() > budgetBytes) {
+        Table *table = skippedCount < MAX_SKIPPED_TABLES ? coldestTable(databases, databaseCount, skipped, skippedCount) : NULL;
+        if (!table) {
+            if (!overBudgetWarned) {
+                fprintf(commandOutput(), "Warning: Table storage is %.1f MB, over the TableMemoryBudget of %.1f MB, and no more tables can be unloaded.\n",
+                        poolLiveBytes() / (1024.0 * 1024), budgetBytes / (1024.0 * 1024));
+                overBudgetWarned = true;
+            }
+            break;
+        }
+        if (evictTable(table)) {
+            countStat(STAT_TABLES_EVICTED, 1);
+        } else {
+            skipped[skippedCount++] = table;
+        }
+    }
+    if (budgetBytes == 0 || poolLiveBytes() <= budgetBytes) {
+        overBudgetWarned = false;
+    }
+    tableUseClock++;
+}
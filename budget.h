@@ -0,0 +1,40 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stddef.h>
+#include "storage.h"
+
+// Memory budget for table storage. After each command, while the pool holds
+// more than the budget, the least recently used loaded table is evicted: its
+// column vectors and indexes are freed and it goes back to the unloaded
+// state of a freshly mapped table, so ensureTableLoaded reads it in again
+// the next time a command uses it. A table whose rows are all in its
+// database file is read from there. One with unsaved changes, or never
+// saved, is first written to an unlinked spill file under data/evict and
+// read back from that; the database file is not touched, since saving on its
+// own would commit changes that exit --no-save is meant to discard. Tables
+// the last command used are never evicted, so a working set larger than the
+// budget does not reload on every command. When the budget still cannot be
+// met, a warning is printed once until it is.
+//
+// The clock advances once per command; ensureTableLoaded stamps each table
+// it is asked for with it.
+extern unsigned long tableUseClock;
+
+// Budget in bytes, 0 for no limit.
+void setMemoryBudget(size_t bytes);
+size_t memoryBudget(void);
+
+// Frees the rows and indexes of a table, keeping its schema and row count,
+// after spilling them if they are not all in its database file. Returns
+// false, leaving the table loaded, if the spill file could not be written.
+bool evictTable(Table *table);
+
+// Reads the column blocks of a spilled table into its reserved vectors.
+bool readSpilledTable(Table *table);
+
+// Evicts tables of databases until the pool fits the budget or only tables
+// that cannot be evicted are left.
+void enforceMemoryBudget(Database **databases, int databaseCount);
+
+#endif
@@ -2,11 +2,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include "config.h"
+#include "output.h"
 
 static ConfigNode* createNode(const char* key, const char* value) {
     ConfigNode *newNode = (ConfigNode *)malloc(sizeof(ConfigNode));
     if (newNode == NULL) {
-        perror("Error allocating memory");
+        printSystemError("Error allocating memory");
         exit(1);
     }
     strcpy(newNode->key, key);
@@ -34,13 +35,14 @@ void loadConfig(const char *filename, ConfigNode **configList) {
     char line[100];
 
     if (file == NULL) {
-        perror("Error opening file");
+        printSystemError("Error opening file");
         exit(1);
     }
 
     while (fgets(line, sizeof(line), file) != NULL) {
-        sscanf(line, "%s = %s", key, value);
-        addConfig(configList, key, value);
+        if (sscanf(line, "%49s = %49s", key, value) == 2) {
+            addConfig(configList, key, value);
+        }
     }
 
     fclose(file);
@@ -57,6 +59,16 @@ const char* checkConfig(const ConfigNode *head, const char *key) {
     return "Key not found";
 }
 
+// Returns the raw value of key, or NULL if the key is not set.
+const char* getConfigValue(const ConfigNode *head, const char *key) {
+    for (const ConfigNode *current = head; current != NULL; current = current->next) {
+        if (strcmp(current->key, key) == 0) {
+            return current->value;
+        }
+    }
+    return NULL;
+}
+
 void freeConfigList(ConfigNode *head) {
     ConfigNode *current = head;
     while (current != NULL) {
@@ -66,21 +78,38 @@ void freeConfigList(ConfigNode *head) {
     }
 }
 
-void ChangeConfigOption(const char * State) {
-    FILE *file;
-    const char *filename = "config.txt";
+// Sets key to value in the config file, keeping every other key as it is.
+void setConfigValue(const char *filename, const char *key, const char *value) {
+    ConfigNode *configList = NULL;
+    FILE *file = fopen(filename, "r");
+    if (file != NULL) {
+        fclose(file);
+        loadConfig(filename, &configList);
+    }
+
+    ConfigNode *current = configList;
+    while (current != NULL && strcmp(current->key, key) != 0) {
+        current = current->next;
+    }
+    if (current != NULL) {
+        snprintf(current->value, sizeof(current->value), "%s", value);
+    } else {
+        addConfig(&configList, key, value);
+    }
 
     file = fopen(filename, "w");
     if (file == NULL) {
-        perror("Error opening file");
+        printSystemError("Error opening file");
+        freeConfigList(configList);
         return;
     }
-
-    if(strcmp(State, "True") == 0){
-        fprintf(file, "AutomaticallyLoadDatabases = True\n");
-    } else {
-        fprintf(file, "AutomaticallyLoadDatabases = False\n");
+    for (current = configList; current != NULL; current = current->next) {
+        fprintf(file, "%s = %s\n", current->key, current->value);
     }
     fclose(file);
+    freeConfigList(configList);
+}
 
+void ChangeConfigOption(const char * State) {
+    setConfigValue("config.txt", "AutomaticallyLoadDatabases", strcmp(State, "True") == 0 ? "True" : "False");
 }
\ No newline at end of file
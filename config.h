@@ -9,6 +9,8 @@ typedef struct ConfigNode {
 
 void loadConfig(const char *filename, ConfigNode **configList);
 const char* checkConfig(const ConfigNode *head, const char *key);
+const char* getConfigValue(const ConfigNode *head, const char *key);
+void setConfigValue(const char *filename, const char *key, const char *value);
 void freeConfigList(ConfigNode *head);
 void ChangeConfigOption(const char * State);
 
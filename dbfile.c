@@ -0,0 +1,634 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dbfile.h"
+#include "btree.h"
+#include "output.h"
+#include "stats.h"
+#include "budget.h"
+#include "fileio.h"
+
+_Static_assert(sizeof(FileHeader) == 128, "FileHeader layout changed");
+
+// Version 2 headers end before walSequence.
+#define VERSION2_HEADER_SIZE offsetof(FileHeader, walSequence)
+_Static_assert(sizeof(TableEntry) == 128, "TableEntry layout changed");
+_Static_assert(sizeof(ColumnEntry) == 136, "ColumnEntry layout changed");
+
+// Column descriptor of version 1 files, which dumped the old Column struct
+// followed by isPrimaryKey and isRequired again as 4-byte ints.
+typedef struct {
+    char name[MAX_NAME_LEN];
+    DataType type;
+    int stringSize;
+    bool isPrimaryKey;
+    bool isRequired;
+} StoredColumn;
+
+static uint64_t alignOffset(uint64_t offset) {
+    return (offset + DBFILE_ALIGNMENT - 1) & ~(uint64_t)(DBFILE_ALIGNMENT - 1);
+}
+
+// Copies at most size - 1 bytes of a name that may fill its field without a
+// terminator, as names read from a file can, and terminates it.
+static void copyName(char *dest, const char *src, size_t size) {
+    const char *end = memchr(src, '\0', size - 1);
+    size_t length = end ? (size_t)(end - src) : size - 1;
+    memcpy(dest, src, length);
+    dest[length] = '\0';
+}
+
+static void initColumn(Column *column) {
+    column->values = NULL;
+    column->primaryIndex = NULL;
+    column->orderedIndex = NULL;
+    column->sharedEpoch = 0;
+}
+
+// Copies a block of the old file into the new one. copy_file_range lets the
+// kernel share or copy the extents without passing the data through user
+// space; the mapping is the fallback where it is unsupported.
+static bool copyBlock(const MappedFile *source, uint64_t sourceOffset, int fd, uint64_t offset, uint64_t size) {
+    loff_t in = sourceOffset, out = offset;
+    while (size > 0) {
+        ssize_t copied = copy_file_range(source->fd, &in, fd, &out, size, 0);
+        if (copied <= 0) {
+            if (copied < 0 && errno == EINTR) {
+                continue;
+            }
+            return writeFully(fd, source->base + in, size, out);
+        }
+        size -= copied;
+    }
+    return true;
+}
+
+// Copies a column block of a spilled table into the new file, through a
+// buffer where copy_file_range is unsupported.
+static bool copySpilledBlock(int spillFd, uint64_t spillOffset, int fd, uint64_t offset, uint64_t size) {
+    loff_t in = spillOffset, out = offset;
+    while (size > 0) {
+        ssize_t copied = copy_file_range(spillFd, &in, fd, &out, size, 0);
+        if (copied < 0 && errno == EINTR) {
+            continue;
+        }
+        if (copied <= 0) {
+            break;
+        }
+        size -= copied;
+    }
+    char buffer[64 * 1024];
+    while (size > 0) {
+        size_t chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+        if (!readFully(spillFd, buffer, chunk, in) || !writeFully(fd, buffer, chunk, out)) {
+            return false;
+        }
+        in += chunk;
+        out += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+static void syncDirectory(const char *path) {
+    char directory[MAX_NAME_LEN + 20];
+    snprintf(directory, sizeof(directory), "%s", path);
+    char *slash = strrchr(directory, '/');
+    if (slash) {
+        *slash = '\0';
+    } else {
+        strcpy(directory, ".");
+    }
+    int fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// Points db at the file just written, so unloaded and unchanged tables are
+// read or copied from it from now on, and marks everything clean. If the new
+// file cannot be mapped the old mapping is kept and db stays dirty, which is
+// still consistent since the old file holds the same clean blocks.
+static void attachSavedFile(Database *db, int fd, uint64_t fileSize) {
+    char *base = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    MappedFile *mapping = base == MAP_FAILED ? NULL : malloc(sizeof(MappedFile));
+    if (!mapping) {
+        if (base != MAP_FAILED) {
+            munmap(base, fileSize);
+        }
+        close(fd);
+        return;
+    }
+    mapping->base = base;
+    mapping->size = fileSize;
+    mapping->fd = fd;
+
+    // The catalog was laid out from db, so each table's columns follow the
+    // previous table's.
+    const ColumnEntry *columnEntries = (const ColumnEntry *)(base + sizeof(FileHeader) + db->tableCount * sizeof(TableEntry));
+    for (int i = 0; i < db->tableCount; i++) {
+        Table *table = db->tables[i];
+        table->storedColumns = columnEntries;
+        columnEntries += table->columnCount;
+        table->mappedBase = base;
+        table->dirty = false;
+        dropSpill(table);
+    }
+    unmapDatabaseFile(db->mapping);
+    db->mapping = mapping;
+    db->dirty = false;
+}
+
+bool writeDatabaseFile(Database *db, const char *path) {
+    int totalColumns = 0;
+    for (int i = 0; i < db->tableCount; i++) {
+        totalColumns += db->tables[i]->columnCount;
+    }
+
+    size_t catalogSize = sizeof(FileHeader) + db->tableCount * sizeof(TableEntry) + totalColumns * sizeof(ColumnEntry);
+    char *catalog = calloc(1, catalogSize);
+    if (!catalog) {
+        reportError("Error: Memory allocation failed while saving database '%s'.\n", db->name);
+        return false;
+    }
+
+    FileHeader *header = (FileHeader *)catalog;
+    TableEntry *tableEntries = (TableEntry *)(catalog + sizeof(FileHeader));
+    ColumnEntry *columnEntries = (ColumnEntry *)(tableEntries + db->tableCount);
+
+    memcpy(header->magic, DBFILE_MAGIC, sizeof(header->magic));
+    header->version = DBFILE_VERSION;
+    header->tableCount = db->tableCount;
+    copyName(header->name, db->name, sizeof(header->name));
+    header->walSequence = db->walSequence;
+
+    uint64_t offset = alignOffset(catalogSize);
+    int columnIndex = 0;
+    for (int i = 0; i < db->tableCount; i++) {
+        const Table *table = db->tables[i];
+        TableEntry *tableEntry = &tableEntries[i];
+        copyName(tableEntry->name, table->tableName, sizeof(tableEntry->name));
+        tableEntry->columnCount = table->columnCount;
+        tableEntry->rowCount = table->rowCount;
+        tableEntry->firstColumn = columnIndex;
+
+        uint64_t dataStart = offset;
+        for (int j = 0; j < table->columnCount; j++) {
+            const Column *column = &table->columns[j];
+            ColumnEntry *columnEntry = &columnEntries[columnIndex++];
+            copyName(columnEntry->name, column->name, sizeof(columnEntry->name));
+            columnEntry->type = column->type;
+            columnEntry->stringSize = column->stringSize > 0 ? column->stringSize : 0;
+            bool indexed = table->loaded ? column->orderedIndex != NULL
+                         : table->spilled ? table->spillIndexed[j]
+                                          : (table->storedColumns[j].flags & COLUMN_FLAG_INDEXED) != 0;
+            columnEntry->flags = (column->isPrimaryKey ? COLUMN_FLAG_PRIMARY : 0) |
+                                 (column->isRequired ? COLUMN_FLAG_REQUIRED : 0) |
+                                 (indexed ? COLUMN_FLAG_INDEXED : 0);
+            columnEntry->blockOffset = offset;
+            columnEntry->blockSize = (uint64_t)table->rowCount * columnValueWidth(column);
+            offset = alignOffset(offset + columnEntry->blockSize);
+        }
+        tableEntry->dataSize = offset - dataStart;
+    }
+
+    // Write next to the old file and rename over it, so a crash leaves either
+    // the old file or the new one. Tables that have not changed since the old
+    // file was written are copied from it rather than from memory.
+    char tempPath[MAX_NAME_LEN + 20];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    int fd = open(tempPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printSystemError("Error opening file for saving");
+        free(catalog);
+        return false;
+    }
+
+    bool ok = writeFully(fd, catalog, catalogSize, 0);
+    columnIndex = 0;
+    for (int i = 0; ok && i < db->tableCount; i++) {
+        const Table *table = db->tables[i];
+        bool fromSpill = !table->loaded && table->spilled;
+        bool fromFile = !fromSpill && !table->dirty && table->storedColumns;
+        uint64_t spillOffset = 0;
+        for (int j = 0; ok && j < table->columnCount; j++) {
+            const ColumnEntry *columnEntry = &columnEntries[columnIndex++];
+            if (columnEntry->blockSize == 0) {
+                continue;
+            }
+            if (fromSpill) {
+                ok = copySpilledBlock(table->spillFd, spillOffset, fd, columnEntry->blockOffset, columnEntry->blockSize);
+                spillOffset += columnEntry->blockSize;
+            } else if (fromFile) {
+                ok = copyBlock(db->mapping, table->storedColumns[j].blockOffset, fd, columnEntry->blockOffset, columnEntry->blockSize);
+            } else {
+                ok = writeFully(fd, table->columns[j].values, columnEntry->blockSize, columnEntry->blockOffset);
+            }
+        }
+    }
+    free(catalog);
+
+    ok = ok && ftruncate(fd, offset) == 0 && fsync(fd) == 0;
+    if (ok && rename(tempPath, path) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        reportError("Error: Could not write database file '%s'.\n", path);
+        close(fd);
+        remove(tempPath);
+        return false;
+    }
+
+    syncDirectory(path);
+    attachSavedFile(db, fd, offset);
+    countStat(STAT_BYTES_WRITTEN, offset);
+    return true;
+}
+
+static bool finishLoadedTable(Table *table, bool *indexed) {
+    for (int c = 0; c < table->columnCount; c++) {
+        Column *column = &table->columns[c];
+        if (column->type == STRING) {
+            int width = stringSlotWidth(column);
+            for (int r = 0; r < table->rowCount; r++) {
+                column->strValues[(size_t)r * width + width - 1] = '\0';
+            }
+        }
+        if (indexed && indexed[c]) {
+            column->orderedIndex = buildBTree(column, table->rowCount);
+        }
+    }
+    if (!buildPrimaryIndexes(table)) {
+        reportError("Error: Could not build primary key index for table %s.\n", table->tableName);
+        return false;
+    }
+    return true;
+}
+
+static bool catalogFits(uint64_t offset, uint64_t size, size_t fileSize) {
+    return offset <= fileSize && size <= fileSize - offset;
+}
+
+// Maps a version 2 or later file and fills in the schema of every table from
+// the catalog. Table data stays in the mapping until ensureTableLoaded. On
+// success the database owns fd.
+static int mapDatabaseFile(int fd, size_t fileSize, const char *path, Database **databasesOut, int *versionOut) {
+    if (fileSize < VERSION2_HEADER_SIZE) {
+        reportError("Error: Could not read header of file '%s'.\n", path);
+        return -1;
+    }
+    char *base = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        printSystemError("Error mapping database file");
+        return -1;
+    }
+
+    const FileHeader *header = (const FileHeader *)base;
+    if (header->version > DBFILE_VERSION) {
+        reportError("Error: File '%s' uses format version %u, newer than this build supports.\n", path, header->version);
+        munmap(base, fileSize);
+        return -1;
+    }
+    size_t headerSize = header->version >= 3 ? sizeof(FileHeader) : VERSION2_HEADER_SIZE;
+
+    const TableEntry *tableEntries = (const TableEntry *)(base + headerSize);
+    const ColumnEntry *columnEntries = (const ColumnEntry *)(tableEntries + header->tableCount);
+    bool ok = catalogFits(headerSize, (uint64_t)header->tableCount * sizeof(TableEntry), fileSize);
+    uint64_t totalColumns = 0;
+    for (uint32_t i = 0; ok && i < header->tableCount; i++) {
+        totalColumns += tableEntries[i].columnCount;
+    }
+    ok = ok && catalogFits((const char *)columnEntries - base, totalColumns * sizeof(ColumnEntry), fileSize);
+    for (uint32_t i = 0; ok && i < header->tableCount; i++) {
+        ok = tableEntries[i].firstColumn <= totalColumns &&
+             tableEntries[i].columnCount <= totalColumns - tableEntries[i].firstColumn;
+    }
+    for (uint64_t i = 0; ok && i < totalColumns; i++) {
+        uint32_t type = columnEntries[i].type;
+        ok = (type == INT || type == FLOAT || type == STRING) &&
+             catalogFits(columnEntries[i].blockOffset, columnEntries[i].blockSize, fileSize) &&
+             columnEntries[i].blockOffset % DBFILE_ALIGNMENT == 0;
+    }
+    if (!ok) {
+        reportError("Error: The catalog of file '%s' is corrupt.\n", path);
+        munmap(base, fileSize);
+        return -1;
+    }
+
+    int maxTables = header->tableCount > 0 ? header->tableCount : 2;
+    Database *db = calloc(1, sizeof(Database));
+    Table **tables = calloc(maxTables, sizeof(Table *));
+    MappedFile *mapping = malloc(sizeof(MappedFile));
+    if (!db || !tables || !mapping) {
+        reportError("Error: Memory allocation failed while loading file '%s'.\n", path);
+        free(db);
+        free(tables);
+        free(mapping);
+        munmap(base, fileSize);
+        return -1;
+    }
+    db->maxTables = maxTables;
+    db->tables = tables;
+    db->mapping = mapping;
+    db->mapping->base = base;
+    db->mapping->size = fileSize;
+    db->mapping->fd = fd;
+    copyName(db->name, header->name, MAX_NAME_LEN);
+    db->walSequence = header->version >= 3 ? header->walSequence : 0;
+
+    for (uint32_t i = 0; ok && i < header->tableCount; i++) {
+        const TableEntry *tableEntry = &tableEntries[i];
+        Table *table = calloc(1, sizeof(Table));
+        if (!table) {
+            reportError("Error: Memory allocation failed while loading file '%s'.\n", path);
+            ok = false;
+            break;
+        }
+        copyName(table->tableName, tableEntry->name, MAX_NAME_LEN);
+        copyName(table->databaseName, db->name, MAX_NAME_LEN);
+        if (!addTable(db, table)) {
+            free(table);
+            ok = false;
+            break;
+        }
+        table->columns = calloc(tableEntry->columnCount > 0 ? tableEntry->columnCount : 1, sizeof(Column));
+        if (!table->columns) {
+            reportError("Error: Memory allocation failed while loading file '%s'.\n", path);
+            ok = false;
+            break;
+        }
+        table->columnCount = tableEntry->columnCount;
+        table->rowCount = tableEntry->rowCount;
+        table->loaded = false;
+        table->storedColumns = &columnEntries[tableEntry->firstColumn];
+        table->mappedBase = base;
+
+        for (int j = 0; j < table->columnCount; j++) {
+            const ColumnEntry *columnEntry = &table->storedColumns[j];
+            Column *column = &table->columns[j];
+            initColumn(column);
+            copyName(column->name, columnEntry->name, MAX_NAME_LEN);
+            column->type = columnEntry->type;
+            column->stringSize = columnEntry->stringSize;
+            column->isPrimaryKey = columnEntry->flags & COLUMN_FLAG_PRIMARY;
+            column->isRequired = columnEntry->flags & COLUMN_FLAG_REQUIRED;
+            if (columnEntry->blockSize != (uint64_t)table->rowCount * columnValueWidth(column)) {
+                reportError("Error: Column '%s' of table '%s' has a corrupt data block.\n", column->name, table->tableName);
+                ok = false;
+                break;
+            }
+        }
+        ok = ok && rebuildColumnMap(table);
+    }
+
+    if (!ok) {
+        db->mapping->fd = -1;
+        freeDatabase(db);
+        free(db);
+        return -1;
+    }
+    *databasesOut = db;
+    *versionOut = header->version;
+    return 1;
+}
+
+// Drops the pages of a copied block from the mapping so the data is not
+// resident twice. Clean file pages are simply read again if needed later.
+static void releaseMappedRange(const char *base, uint64_t offset, uint64_t size) {
+    uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t start = offset / pageSize * pageSize;
+    if (size > 0) {
+        madvise((void *)(base + start), offset + size - start, MADV_DONTNEED);
+    }
+}
+
+// Copies the column blocks of an unloaded table out of its spill file, or
+// else its database file mapping, and builds its indexes. Does nothing for
+// tables already in memory. Every command that uses a table's rows comes
+// through here, so this is also where the use is recorded for eviction.
+bool ensureTableLoaded(Table *table) {
+    table->lastUsed = tableUseClock;
+    if (table->loaded) {
+        return true;
+    }
+
+    int rowCount = table->rowCount;
+    table->rowCount = 0;
+    if (!reserveRows(table, rowCount)) {
+        reportError("Error: Memory allocation failed for rows in table %s of database %s.\n", table->tableName, table->databaseName);
+        table->rowCount = rowCount;
+        return false;
+    }
+    table->rowCount = rowCount;
+
+    if (table->spilled) {
+        if (!readSpilledTable(table)) {
+            for (int j = 0; j < table->columnCount; j++) {
+                freeColumnStorage(&table->columns[j], table->maxRows);
+            }
+            table->maxRows = 0;
+            return false;
+        }
+        table->loaded = true;
+        bool ok = finishLoadedTable(table, table->spillIndexed);
+        dropSpill(table);
+        return ok;
+    }
+
+    bool indexed[table->columnCount > 0 ? table->columnCount : 1];
+    for (int j = 0; j < table->columnCount; j++) {
+        const ColumnEntry *columnEntry = &table->storedColumns[j];
+        if (columnEntry->blockSize > 0) {
+            memcpy(table->columns[j].values, table->mappedBase + columnEntry->blockOffset, columnEntry->blockSize);
+            countStat(STAT_BYTES_READ, columnEntry->blockSize);
+        }
+        indexed[j] = columnEntry->flags & COLUMN_FLAG_INDEXED;
+        releaseMappedRange(table->mappedBase, columnEntry->blockOffset, columnEntry->blockSize);
+    }
+
+    table->loaded = true;
+    return finishLoadedTable(table, indexed);
+}
+
+static int readVersion1(FILE *file, const char *path, Database **databasesOut) {
+    int fileDatabaseCount;
+    if (fread(&fileDatabaseCount, sizeof(int), 1, file) != 1 || fileDatabaseCount < 0) {
+        reportError("Error: Could not read database count in file '%s'.\n", path);
+        return -1;
+    }
+
+    Database *loaded = calloc(fileDatabaseCount > 0 ? fileDatabaseCount : 1, sizeof(Database));
+    int count = 0;
+    bool ok = true;
+
+    for (int i = 0; ok && i < fileDatabaseCount; i++) {
+        Database *db = &loaded[count++];
+
+        if (fread(db->name, sizeof(char), MAX_NAME_LEN, file) != MAX_NAME_LEN) {
+            reportError("Error: Could not read database name for database %d in file '%s'.\n", i, path);
+            ok = false;
+            break;
+        }
+        db->name[MAX_NAME_LEN - 1] = '\0';
+
+        if (fread(&db->tableCount, sizeof(int), 1, file) != 1 || db->tableCount < 0) {
+            reportError("Error: Could not read table count for database %s.\n", db->name);
+            db->tableCount = 0;
+            ok = false;
+            break;
+        }
+
+        db->maxTables = db->tableCount > 0 ? db->tableCount : 2;
+        db->tables = calloc(db->maxTables, sizeof(Table *));
+        int tableCount = db->tableCount;
+        db->tableCount = 0;
+
+        for (int j = 0; ok && j < tableCount; j++) {
+            Table *table = calloc(1, sizeof(Table));
+            table->loaded = true;
+            table->dirty = true;
+
+            if (fread(table->tableName, sizeof(char), MAX_NAME_LEN, file) != MAX_NAME_LEN) {
+                reportError("Error: Could not read table name for table %d in database %s.\n", j, db->name);
+                free(table);
+                ok = false;
+                break;
+            }
+            table->tableName[MAX_NAME_LEN - 1] = '\0';
+            copyName(table->databaseName, db->name, MAX_NAME_LEN);
+            if (!addTable(db, table)) {
+                free(table);
+                ok = false;
+                break;
+            }
+
+            int columnCount;
+            if (fread(&columnCount, sizeof(int), 1, file) != 1 || columnCount < 0) {
+                reportError("Error: Could not read column count for table %s in database %s.\n", table->tableName, db->name);
+                ok = false;
+                break;
+            }
+            table->columns = calloc(columnCount > 0 ? columnCount : 1, sizeof(Column));
+
+            for (int k = 0; k < columnCount; k++) {
+                Column *column = &table->columns[k];
+                StoredColumn stored;
+                int isPrimaryKey, isRequired;
+                if (fread(&stored, sizeof(StoredColumn), 1, file) != 1 ||
+                    fread(&isPrimaryKey, sizeof(int), 1, file) != 1 ||
+                    fread(&isRequired, sizeof(int), 1, file) != 1) {
+                    reportError("Error: Could not read column data for column %d in table %s of database %s.\n", k, table->tableName, db->name);
+                    ok = false;
+                    break;
+                }
+
+                initColumn(column);
+                memcpy(column->name, stored.name, MAX_NAME_LEN);
+                column->name[MAX_NAME_LEN - 1] = '\0';
+                column->type = stored.type;
+                column->stringSize = stored.stringSize;
+                column->isPrimaryKey = stored.isPrimaryKey;
+                column->isRequired = stored.isRequired;
+                table->columnCount++;
+            }
+            if (!ok || !rebuildColumnMap(table)) {
+                ok = false;
+                break;
+            }
+
+            int rowCount;
+            if (fread(&rowCount, sizeof(int), 1, file) != 1 || rowCount < 0) {
+                reportError("Error: Could not read row count for table %s in database %s.\n", table->tableName, db->name);
+                ok = false;
+                break;
+            }
+            if (!reserveRows(table, rowCount)) {
+                reportError("Error: Memory allocation failed for rows in table %s of database %s.\n", table->tableName, db->name);
+                ok = false;
+                break;
+            }
+            table->rowCount = rowCount;
+
+            for (int r = 0; ok && r < rowCount; r++) {
+                for (int c = 0; c < table->columnCount; c++) {
+                    Column *col = &table->columns[c];
+                    size_t read = 1, expected = 1;
+                    if (col->type == INT) {
+                        read = fread(&col->intValues[r], sizeof(int), 1, file);
+                    } else if (col->type == FLOAT) {
+                        read = fread(&col->floatValues[r], sizeof(float), 1, file);
+                    } else if (col->type == STRING && col->stringSize > 0) {
+                        expected = col->stringSize;
+                        read = fread(getStringValue(col, r), sizeof(char), expected, file);
+                    }
+                    if (read != expected) {
+                        reportError("Error: Could not read row %d of table %s in database %s.\n", r, table->tableName, db->name);
+                        ok = false;
+                        break;
+                    }
+                }
+            }
+            ok = ok && finishLoadedTable(table, NULL);
+        }
+    }
+
+    if (!ok) {
+        for (int i = 0; i < count; i++) {
+            freeDatabase(&loaded[i]);
+        }
+        free(loaded);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        loaded[i].dirty = true;
+    }
+    *databasesOut = loaded;
+    return count;
+}
+
+// Reads every database stored in path into a newly allocated array. Version 1
+// files may hold several databases and are read eagerly; later versions hold
+// one database and are mapped, leaving their tables unloaded.
+int readDatabaseFile(const char *path, Database **databasesOut, int *versionOut) {
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        reportError("Error: Could not open file '%s' for loading.\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    char magic[8];
+    if (pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && memcmp(magic, DBFILE_MAGIC, sizeof(magic)) == 0) {
+        int count = mapDatabaseFile(fd, info.st_size, path, databasesOut, versionOut);
+        if (count < 0) {
+            close(fd);
+        }
+        return count;
+    }
+
+    *versionOut = 1;
+    FILE *file = fdopen(fd, "rb");
+    if (!file) {
+        reportError("Error: Could not open file '%s' for loading.\n", path);
+        close(fd);
+        return -1;
+    }
+    int count = readVersion1(file, path, databasesOut);
+    if (count >= 0) {
+        countStat(STAT_BYTES_READ, info.st_size);
+    }
+    fclose(file);
+    return count;
+}
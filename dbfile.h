@@ -0,0 +1,62 @@
+#ifndef DBFILE_H
+#define DBFILE_H
+
+#include <stdint.h>
+#include "storage.h"
+
+// Version 3 of the data/<name>.bin format. A file holds one database:
+//
+//   FileHeader
+//   TableEntry  x tableCount
+//   ColumnEntry x (sum of columnCount over all tables)
+//   column data blocks, each DBFILE_ALIGNMENT aligned
+//
+// The header and entries form the catalog, so the schema can be read without
+// touching any row data. Files are mapped rather than read, and a table's
+// blocks are only copied out of the mapping when it is first used. A column
+// block holds rowCount values in the same layout as the in-memory column
+// vector: int32 or float32 values, or string slots of stringSize + 1 bytes.
+// Fields use the host byte order.
+//
+// walSequence is the last write-ahead log record the file contains. Version 2
+// files are the same without it, and are read as containing none.
+#define DBFILE_MAGIC "AQADELDB"
+#define DBFILE_VERSION 3
+#define DBFILE_ALIGNMENT 8
+#define DBFILE_NAME_LEN 104
+
+#define COLUMN_FLAG_PRIMARY 1u
+#define COLUMN_FLAG_REQUIRED 2u
+#define COLUMN_FLAG_INDEXED 4u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t tableCount;
+    char name[DBFILE_NAME_LEN];
+    uint64_t walSequence;
+} FileHeader;
+
+typedef struct {
+    char name[DBFILE_NAME_LEN];
+    uint32_t columnCount;
+    uint32_t rowCount;
+    uint64_t firstColumn;
+    uint64_t dataSize;
+} TableEntry;
+
+typedef struct ColumnEntry {
+    char name[DBFILE_NAME_LEN];
+    uint32_t type;
+    uint32_t stringSize;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t blockOffset;
+    uint64_t blockSize;
+} ColumnEntry;
+
+bool writeDatabaseFile(Database *db, const char *path);
+int readDatabaseFile(const char *path, Database **databasesOut, int *versionOut);
+bool ensureTableLoaded(Table *table);
+
+#endif
@@ -0,0 +1,63 @@
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "fileio.h"
+
+int openScratchFile(const char *directory, const char *prefix) {
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    char path[256];
+    if (snprintf(path, sizeof(path), "%s/%sXXXXXX", directory, prefix) >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    return fd;
+}
+
+bool writeFully(int fd, const void *data, size_t size, uint64_t offset) {
+    const char *bytes = data;
+    while (size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            if (written == 0) {
+                errno = ENOSPC;
+            }
+            return false;
+        }
+        bytes += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+bool readFully(int fd, void *data, size_t size, uint64_t offset) {
+    char *bytes = data;
+    while (size > 0) {
+        ssize_t result = pread(fd, bytes, size, offset);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            if (result == 0) {
+                errno = EIO;
+            }
+            return false;
+        }
+        bytes += result;
+        size -= result;
+        offset += result;
+    }
+    return true;
+}
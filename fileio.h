@@ -0,0 +1,20 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Creates an unlinked file named prefix plus a unique suffix in directory,
+// creating the directory first if needed. The file lives on only through the
+// returned descriptor, so nothing is left behind if the process dies while
+// using it. Returns -1 with errno set on failure.
+int openScratchFile(const char *directory, const char *prefix);
+
+// Write or read all size bytes at offset, retrying short transfers and
+// interrupted calls. Return false with errno set on failure; a transfer that
+// makes no progress sets ENOSPC when writing and EIO when reading.
+bool writeFully(int fd, const void *data, size_t size, uint64_t offset);
+bool readFully(int fd, void *data, size_t size, uint64_t offset);
+
+#endif
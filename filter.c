@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "filter.h"
+#include "hashindex.h"
+#include "btree.h"
+#include "simdfilter.h"
+#include "stats.h"
+
+bool parseOperator(const char *text, CompareOp *op) {
+    if (strcmp(text, "==") == 0) {
+        *op = CMP_EQ;
+    } else if (strcmp(text, "<") == 0) {
+        *op = CMP_LT;
+    } else if (strcmp(text, "<=") == 0) {
+        *op = CMP_LE;
+    } else if (strcmp(text, ">") == 0) {
+        *op = CMP_GT;
+    } else if (strcmp(text, ">=") == 0) {
+        *op = CMP_GE;
+    } else if (strcmp(text, "between") == 0) {
+        *op = CMP_BETWEEN;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static const char *operatorText(CompareOp op) {
+    switch (op) {
+        case CMP_EQ: return "==";
+        case CMP_LT: return "<";
+        case CMP_LE: return "<=";
+        case CMP_GT: return ">";
+        case CMP_GE: return ">=";
+        case CMP_BETWEEN: return "between";
+    }
+    return "?";
+}
+
+void describeCondition(const Condition *condition, char *buffer, int size) {
+    if (condition->op == CMP_BETWEEN) {
+        snprintf(buffer, size, "'%s' between '%s' and '%s'", condition->column->name, condition->valueText, condition->upperText);
+    } else {
+        snprintf(buffer, size, "'%s' %s '%s'", condition->column->name, operatorText(condition->op), condition->valueText);
+    }
+}
+
+bool conditionMatches(const Condition *condition, int row) {
+    int cmp = compareToValue(condition->column, row, &condition->value);
+    switch (condition->op) {
+        case CMP_EQ: return cmp == 0;
+        case CMP_LT: return cmp < 0;
+        case CMP_LE: return cmp <= 0;
+        case CMP_GT: return cmp > 0;
+        case CMP_GE: return cmp >= 0;
+        case CMP_BETWEEN: return cmp >= 0 && compareToValue(condition->column, row, &condition->upper) <= 0;
+    }
+    return false;
+}
+
+static int countBits(const uint64_t *mask, int rowCount) {
+    int count = 0;
+    for (int word = 0; word < SELECTION_WORDS(rowCount); word++) {
+        count += __builtin_popcountll(mask[word]);
+    }
+    return count;
+}
+
+// Sets bit i of mask, clearing the others, when row firstRow + i satisfies
+// condition, for i in [0, rowCount). Returns how many rows matched. Integer,
+// float and string equality conditions run on the SIMD kernels.
+int conditionMask(const Condition *condition, int firstRow, int rowCount, uint64_t *mask) {
+    const Column *column = condition->column;
+    countStat(STAT_ROWS_SCANNED, rowCount);
+
+    if (column->type == INT) {
+        // Every operator is a closed range [low, high] over the integers.
+        long long low = INT_MIN, high = INT_MAX;
+        long long value = condition->value.intValue;
+        switch (condition->op) {
+            case CMP_EQ: low = high = value; break;
+            case CMP_LT: high = value - 1; break;
+            case CMP_LE: high = value; break;
+            case CMP_GT: low = value + 1; break;
+            case CMP_GE: low = value; break;
+            case CMP_BETWEEN: low = value; high = condition->upper.intValue; break;
+        }
+        if (low > high) {
+            memset(mask, 0, SELECTION_WORDS(rowCount) * sizeof(uint64_t));
+            return 0;
+        }
+        intRangeMask(column->intValues + firstRow, rowCount, (int)low, (int)high, mask);
+    } else if (column->type == FLOAT) {
+        static const FloatTest tests[] = {
+            [CMP_EQ] = FLOAT_EQ, [CMP_LT] = FLOAT_LT, [CMP_LE] = FLOAT_LE,
+            [CMP_GT] = FLOAT_GT, [CMP_GE] = FLOAT_GE, [CMP_BETWEEN] = FLOAT_BETWEEN,
+        };
+        floatCompareMask(column->floatValues + firstRow, rowCount, tests[condition->op],
+                         condition->value.floatValue, condition->upper.floatValue, mask);
+    } else if (condition->op == CMP_EQ) {
+        stringEqualMask(getStringValue(column, firstRow), stringSlotWidth(column), rowCount, condition->value.strValue, mask);
+    } else {
+        memset(mask, 0, SELECTION_WORDS(rowCount) * sizeof(uint64_t));
+        for (int i = 0; i < rowCount; i++) {
+            if (conditionMatches(condition, firstRow + i)) {
+                mask[i >> 6] |= (uint64_t)1 << (i & 63);
+            }
+        }
+    }
+    return countBits(mask, rowCount);
+}
+
+#define FILTER_CHUNK_ROWS 1024
+
+// Evaluates condition on rows [firstRow, firstRow + rowCount) and writes the
+// matching rows to selection in ascending order. selection must have room for
+// rowCount entries.
+int filterBlock(const Condition *condition, int firstRow, int rowCount, int *selection) {
+    uint64_t mask[SELECTION_WORDS(FILTER_CHUNK_ROWS)];
+    int count = 0;
+    for (int chunk = 0; chunk < rowCount; chunk += FILTER_CHUNK_ROWS) {
+        int chunkRows = rowCount - chunk < FILTER_CHUNK_ROWS ? rowCount - chunk : FILTER_CHUNK_ROWS;
+        conditionMask(condition, firstRow + chunk, chunkRows, mask);
+        for (int word = 0; word < SELECTION_WORDS(chunkRows); word++) {
+            for (uint64_t bits = mask[word]; bits; bits &= bits - 1) {
+                selection[count++] = firstRow + chunk + word * 64 + __builtin_ctzll(bits);
+            }
+        }
+    }
+    return count;
+}
+
+static int compareRows(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Writes the rows satisfying condition to rows in ascending order and returns
+// how many there are. rows must have room for table->rowCount entries. The
+// primary key hash index answers equality, an ordered index answers ranges;
+// everything else is a scan.
+int findMatchingRows(const Table *table, const Condition *condition, int *rows) {
+    const Column *column = condition->column;
+
+    if (condition->op == CMP_EQ && column->primaryIndex) {
+        int row = hashIndexFind(column->primaryIndex, column, &condition->value);
+        if (row < 0) {
+            return 0;
+        }
+        rows[0] = row;
+        countStat(STAT_ROWS_SCANNED, 1);
+        return 1;
+    }
+
+    if (column->orderedIndex) {
+        const Value *low = NULL, *high = NULL;
+        bool lowInclusive = true, highInclusive = true;
+        switch (condition->op) {
+            case CMP_EQ: low = high = &condition->value; break;
+            case CMP_LT: high = &condition->value; highInclusive = false; break;
+            case CMP_LE: high = &condition->value; break;
+            case CMP_GT: low = &condition->value; lowInclusive = false; break;
+            case CMP_GE: low = &condition->value; break;
+            case CMP_BETWEEN: low = &condition->value; high = &condition->upper; break;
+        }
+        int count = btreeRange(column->orderedIndex, column, low, lowInclusive, high, highInclusive, rows);
+        qsort(rows, count, sizeof(int), compareRows);
+        countStat(STAT_ROWS_SCANNED, count);
+        return count;
+    }
+
+    return filterBlock(condition, 0, table->rowCount, rows);
+}
+
+// Sets the selection bit of every row satisfying condition and returns how
+// many rows were selected. selection must be zeroed and cover rowCount bits.
+int markMatchingRows(const Table *table, const Condition *condition, uint64_t *selection) {
+    if (condition->column->primaryIndex || condition->column->orderedIndex) {
+        int *rows = malloc((table->rowCount > 0 ? table->rowCount : 1) * sizeof(int));
+        if (rows) {
+            int count = findMatchingRows(table, condition, rows);
+            for (int i = 0; i < count; i++) {
+                SELECTION_SET(selection, rows[i]);
+            }
+            free(rows);
+            return count;
+        }
+    }
+
+    return conditionMask(condition, 0, table->rowCount, selection);
+}
@@ -0,0 +1,27 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "storage.h"
+
+typedef enum { CMP_EQ, CMP_LT, CMP_LE, CMP_GT, CMP_GE, CMP_BETWEEN } CompareOp;
+
+// A single-column predicate such as 'price >= 10' or 'id between 3 and 7'.
+typedef struct {
+    Column *column;
+    CompareOp op;
+    Value value;
+    Value upper;
+    const char *valueText;
+    const char *upperText;
+} Condition;
+
+bool parseOperator(const char *text, CompareOp *op);
+void describeCondition(const Condition *condition, char *buffer, int size);
+
+bool conditionMatches(const Condition *condition, int row);
+int conditionMask(const Condition *condition, int firstRow, int rowCount, uint64_t *mask);
+int filterBlock(const Condition *condition, int firstRow, int rowCount, int *selection);
+int findMatchingRows(const Table *table, const Condition *condition, int *rows);
+int markMatchingRows(const Table *table, const Condition *condition, uint64_t *selection);
+
+#endif
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashindex.h"
+#include "pool.h"
+#include "output.h"
+
+#define MIN_INDEX_CAPACITY 16
+
+static unsigned mixHash(unsigned h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static unsigned hashInt(int value) {
+    return mixHash((unsigned)value);
+}
+
+static unsigned hashFloat(float value) {
+    unsigned bits;
+    if (value == 0.0f) {
+        value = 0.0f;
+    }
+    memcpy(&bits, &value, sizeof(bits));
+    return mixHash(bits);
+}
+
+static unsigned hashString(const char *value) {
+    unsigned h = 2166136261u;
+    while (*value) {
+        h ^= (unsigned char)*value++;
+        h *= 16777619u;
+    }
+    return mixHash(h);
+}
+
+unsigned hashColumnValue(const Column *column, int row) {
+    if (column->type == INT) {
+        return hashInt(column->intValues[row]);
+    } else if (column->type == FLOAT) {
+        return hashFloat(column->floatValues[row]);
+    }
+    return hashString(getStringValue(column, row));
+}
+
+unsigned hashValue(const Value *value) {
+    if (value->type == INT) {
+        return hashInt(value->intValue);
+    } else if (value->type == FLOAT) {
+        return hashFloat(value->floatValue);
+    }
+    return hashString(value->strValue);
+}
+
+static bool rowsEqual(const Column *column, int a, int b) {
+    if (column->type == INT) {
+        return column->intValues[a] == column->intValues[b];
+    } else if (column->type == FLOAT) {
+        return column->floatValues[a] == column->floatValues[b];
+    }
+    return strcmp(getStringValue(column, a), getStringValue(column, b)) == 0;
+}
+
+static int capacityFor(int rows) {
+    int capacity = MIN_INDEX_CAPACITY;
+    while ((long)capacity * 7 / 10 < rows) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+static void freeSlots(int *rows, unsigned *hashes, int capacity) {
+    poolFree(rows, capacity * sizeof(int));
+    poolFree(hashes, capacity * sizeof(unsigned));
+}
+
+static bool allocateSlots(HashIndex *index, int capacity) {
+    int *rows = poolAlloc(capacity * sizeof(int));
+    unsigned *hashes = poolAlloc(capacity * sizeof(unsigned));
+    if (!rows || !hashes) {
+        poolFree(rows, capacity * sizeof(int));
+        poolFree(hashes, capacity * sizeof(unsigned));
+        reportError("Error: Memory allocation failed for hash index.\n");
+        return false;
+    }
+    memset(rows, 0, capacity * sizeof(int));
+    index->rows = rows;
+    index->hashes = hashes;
+    index->capacity = capacity;
+    index->count = 0;
+    return true;
+}
+
+static void placeSlot(HashIndex *index, int row, unsigned hash) {
+    int mask = index->capacity - 1;
+    int slot = hash & mask;
+    while (index->rows[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    index->rows[slot] = row + 1;
+    index->hashes[slot] = hash;
+    index->count++;
+}
+
+static bool growIndex(HashIndex *index) {
+    int *oldRows = index->rows;
+    unsigned *oldHashes = index->hashes;
+    int oldCapacity = index->capacity;
+
+    if (!allocateSlots(index, oldCapacity * 2)) {
+        index->rows = oldRows;
+        index->hashes = oldHashes;
+        index->capacity = oldCapacity;
+        return false;
+    }
+    for (int i = 0; i < oldCapacity; i++) {
+        if (oldRows[i] != 0) {
+            placeSlot(index, oldRows[i] - 1, oldHashes[i]);
+        }
+    }
+    freeSlots(oldRows, oldHashes, oldCapacity);
+    return true;
+}
+
+HashIndex *createHashIndex(int expectedRows) {
+    HashIndex *index = malloc(sizeof(HashIndex));
+    if (!index) {
+        reportError("Error: Memory allocation failed for hash index.\n");
+        return NULL;
+    }
+    if (!allocateSlots(index, capacityFor(expectedRows))) {
+        free(index);
+        return NULL;
+    }
+    return index;
+}
+
+void freeHashIndex(HashIndex *index) {
+    if (!index) {
+        return;
+    }
+    freeSlots(index->rows, index->hashes, index->capacity);
+    free(index);
+}
+
+int hashIndexFind(const HashIndex *index, const Column *column, const Value *key) {
+    unsigned hash = hashValue(key);
+    int mask = index->capacity - 1;
+    for (int slot = hash & mask; index->rows[slot] != 0; slot = (slot + 1) & mask) {
+        if (index->hashes[slot] == hash && valueEquals(column, index->rows[slot] - 1, key)) {
+            return index->rows[slot] - 1;
+        }
+    }
+    return -1;
+}
+
+// Returns another row holding the same value as row, or -1 if it is unique.
+int hashIndexFindRow(const HashIndex *index, const Column *column, int row) {
+    unsigned hash = hashColumnValue(column, row);
+    int mask = index->capacity - 1;
+    for (int slot = hash & mask; index->rows[slot] != 0; slot = (slot + 1) & mask) {
+        int candidate = index->rows[slot] - 1;
+        if (candidate != row && index->hashes[slot] == hash && rowsEqual(column, candidate, row)) {
+            return candidate;
+        }
+    }
+    return -1;
+}
+
+bool hashIndexInsert(HashIndex *index, const Column *column, int row) {
+    if ((long)(index->count + 1) * 10 > (long)index->capacity * 7 && !growIndex(index)) {
+        return false;
+    }
+    placeSlot(index, row, hashColumnValue(column, row));
+    return true;
+}
+
+static int findSlotOfRow(const HashIndex *index, const Column *column, int row) {
+    int mask = index->capacity - 1;
+    for (int slot = hashColumnValue(column, row) & mask; index->rows[slot] != 0; slot = (slot + 1) & mask) {
+        if (index->rows[slot] == row + 1) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// Removes row while its value is still stored in the column. Uses backward
+// shift deletion so lookups never have to skip tombstones.
+void hashIndexRemove(HashIndex *index, const Column *column, int row) {
+    int hole = findSlotOfRow(index, column, row);
+    if (hole < 0) {
+        return;
+    }
+
+    int mask = index->capacity - 1;
+    int slot = hole;
+    while (1) {
+        slot = (slot + 1) & mask;
+        if (index->rows[slot] == 0) {
+            break;
+        }
+        int home = index->hashes[slot] & mask;
+        bool movable = (hole <= slot) ? (home <= hole || home > slot) : (home <= hole && home > slot);
+        if (movable) {
+            index->rows[hole] = index->rows[slot];
+            index->hashes[hole] = index->hashes[slot];
+            hole = slot;
+        }
+    }
+    index->rows[hole] = 0;
+    index->count--;
+}
+
+// Renumbers the indexed rows after the table was compacted. Deleted rows must
+// already have been removed. Slots are re-placed from their stored hashes,
+// shrinking the table when most of its entries are gone.
+bool hashIndexRemapRows(HashIndex *index, const int *newRows) {
+    int capacity = capacityFor(index->count);
+    if (capacity >= index->capacity) {
+        for (int slot = 0; slot < index->capacity; slot++) {
+            if (index->rows[slot] != 0) {
+                index->rows[slot] = newRows[index->rows[slot] - 1] + 1;
+            }
+        }
+        return true;
+    }
+
+    int *oldRows = index->rows;
+    unsigned *oldHashes = index->hashes;
+    int oldCapacity = index->capacity;
+    if (!allocateSlots(index, capacity)) {
+        index->rows = oldRows;
+        index->hashes = oldHashes;
+        index->capacity = oldCapacity;
+        for (int slot = 0; slot < oldCapacity; slot++) {
+            if (oldRows[slot] != 0) {
+                oldRows[slot] = newRows[oldRows[slot] - 1] + 1;
+            }
+        }
+        return true;
+    }
+    for (int slot = 0; slot < oldCapacity; slot++) {
+        if (oldRows[slot] != 0) {
+            placeSlot(index, newRows[oldRows[slot] - 1], oldHashes[slot]);
+        }
+    }
+    freeSlots(oldRows, oldHashes, oldCapacity);
+    return true;
+}
+
+bool rebuildHashIndex(HashIndex *index, const Column *column, int rowCount) {
+    freeSlots(index->rows, index->hashes, index->capacity);
+    index->rows = NULL;
+    index->hashes = NULL;
+    if (!allocateSlots(index, capacityFor(rowCount))) {
+        return false;
+    }
+    for (int row = 0; row < rowCount; row++) {
+        placeSlot(index, row, hashColumnValue(column, row));
+    }
+    return true;
+}
@@ -0,0 +1,29 @@
+#ifndef HASHINDEX_H
+#define HASHINDEX_H
+
+#include "storage.h"
+
+// Open-addressing (linear probing) hash index over the values of one column.
+// Slots hold row + 1 so that 0 marks an empty slot; the full hash of every
+// occupied slot is kept alongside to skip most value comparisons.
+typedef struct HashIndex {
+    int *rows;
+    unsigned *hashes;
+    int capacity;
+    int count;
+} HashIndex;
+
+HashIndex *createHashIndex(int expectedRows);
+void freeHashIndex(HashIndex *index);
+
+unsigned hashColumnValue(const Column *column, int row);
+unsigned hashValue(const Value *value);
+
+int hashIndexFind(const HashIndex *index, const Column *column, const Value *key);
+int hashIndexFindRow(const HashIndex *index, const Column *column, int row);
+bool hashIndexInsert(HashIndex *index, const Column *column, int row);
+void hashIndexRemove(HashIndex *index, const Column *column, int row);
+bool hashIndexRemapRows(HashIndex *index, const int *newRows);
+bool rebuildHashIndex(HashIndex *index, const Column *column, int rowCount);
+
+#endif
@@ -0,0 +1,393 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "join.h"
+#include "hashindex.h"
+#include "parallel.h"
+#include "scan.h"
+#include "output.h"
+#include "fileio.h"
+
+// Both inputs are split into partitions by the top bits of the key hash, and
+// each partition is joined on its own: a chained hash table is built over its
+// rows of the smaller input and probed with its rows of the larger one.
+// Partitions run in parallel on the worker threads. When the hash tables
+// would not fit the memory budget, the partitions are written to an unlinked
+// scratch file under data/join and joined a few at a time.
+#define JOIN_SCRATCH_DIRECTORY "data/join"
+#define JOIN_PARTITION_MIN_ROWS 65536
+#define JOIN_PARTITION_BUILD_ROWS 16384
+#define JOIN_MIN_PARTITIONS 16
+#define JOIN_MAX_PARTITIONS 4096
+#define JOIN_SPILL_BUFFER_ENTRIES 1024
+#define JOIN_SPILL_WAVE 4
+
+static size_t joinMemoryBudget = (size_t)256 * 1024 * 1024;
+
+// Bytes the build side of a join may take in memory.
+void setJoinMemoryBudget(size_t bytes) {
+    joinMemoryBudget = bytes;
+}
+
+typedef struct {
+    int row;
+    unsigned hash;
+} JoinEntry;
+
+typedef struct {
+    long long offset;
+    int count;
+} JoinChunk;
+
+// The rows of one input in one partition. When spilling, entries only
+// buffers the last JOIN_SPILL_BUFFER_ENTRIES of them and the rest are in
+// chunks of the scratch file.
+typedef struct {
+    JoinEntry *entries;
+    int count;
+    int capacity;
+    JoinChunk *chunks;
+    int chunkCount;
+    int spilledCount;
+} JoinBucket;
+
+typedef struct {
+    int *leftRows;
+    int *rightRows;
+    int count;
+    int capacity;
+} JoinPairs;
+
+typedef struct {
+    const JoinSide *build;
+    const JoinSide *probe;
+    bool buildIsLeft;
+    int limit;
+    int partitionCount;
+    int partitionShift;
+    JoinBucket *buildBuckets;
+    JoinBucket *probeBuckets;
+    bool spill;
+    int scratchFd;
+    long long scratchSize;
+    JoinPairs *pairs;
+    int firstPartition;
+    bool failed;
+} JoinJob;
+
+static bool openJoinScratchFile(JoinJob *job) {
+    job->scratchFd = openScratchFile(JOIN_SCRATCH_DIRECTORY, "join");
+    if (job->scratchFd < 0) {
+        reportError("Error: Could not create a join file in '%s': %s\n", JOIN_SCRATCH_DIRECTORY, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool spillBucket(JoinJob *job, JoinBucket *bucket) {
+    JoinChunk *chunks = realloc(bucket->chunks, (bucket->chunkCount + 1) * sizeof(JoinChunk));
+    if (!chunks) {
+        return false;
+    }
+    bucket->chunks = chunks;
+    size_t size = (size_t)bucket->count * sizeof(JoinEntry);
+    if (!writeFully(job->scratchFd, bucket->entries, size, job->scratchSize)) {
+        reportError("Error: Could not write join partition: %s\n", strerror(errno));
+        return false;
+    }
+    chunks[bucket->chunkCount++] = (JoinChunk){job->scratchSize, bucket->count};
+    job->scratchSize += size;
+    bucket->spilledCount += bucket->count;
+    bucket->count = 0;
+    return true;
+}
+
+static bool appendEntry(JoinJob *job, JoinBucket *bucket, JoinEntry entry) {
+    if (bucket->count == bucket->capacity) {
+        if (job->spill && bucket->capacity == JOIN_SPILL_BUFFER_ENTRIES) {
+            if (!spillBucket(job, bucket)) {
+                return false;
+            }
+        } else {
+            int capacity = bucket->capacity > 0 ? bucket->capacity * 2 : 64;
+            if (job->spill && capacity > JOIN_SPILL_BUFFER_ENTRIES) {
+                capacity = JOIN_SPILL_BUFFER_ENTRIES;
+            }
+            JoinEntry *entries = realloc(bucket->entries, (size_t)capacity * sizeof(JoinEntry));
+            if (!entries) {
+                return false;
+            }
+            bucket->entries = entries;
+            bucket->capacity = capacity;
+        }
+    }
+    bucket->entries[bucket->count++] = entry;
+    return true;
+}
+
+// Number of rows of side that take part in the join, or -1 on failure.
+static long long countSideRows(const JoinSide *side) {
+    if (!side->condition) {
+        return side->table->rowCount;
+    }
+    Scan scan;
+    if (!openScan(&scan, side->table, side->condition)) {
+        return -1;
+    }
+    long long count = 0;
+    while (nextScanBatch(&scan)) {
+        count += scan.count;
+    }
+    closeScan(&scan);
+    return count;
+}
+
+static bool partitionSide(JoinJob *job, const JoinSide *side, JoinBucket *buckets) {
+    Scan scan;
+    if (!openScan(&scan, side->table, side->condition)) {
+        return false;
+    }
+    bool partitioned = true;
+    while (partitioned && nextScanBatch(&scan)) {
+        for (int i = 0; i < scan.count && partitioned; i++) {
+            unsigned hash = hashColumnValue(side->key, scan.rows[i]);
+            int partition = job->partitionCount > 1 ? (int)(hash >> job->partitionShift) : 0;
+            partitioned = appendEntry(job, &buckets[partition], (JoinEntry){scan.rows[i], hash});
+        }
+    }
+    closeScan(&scan);
+    if (!partitioned) {
+        reportError("Error: Memory allocation failed while joining table '%s'.\n", side->table->tableName);
+    }
+    return partitioned;
+}
+
+// Sets entries to every entry of bucket. Spilled buckets are read back into
+// a new array that the caller frees.
+static bool loadBucket(JoinJob *job, JoinBucket *bucket, JoinEntry **entriesOut, int *count) {
+    *count = bucket->spilledCount + bucket->count;
+    *entriesOut = bucket->entries;
+    if (!job->spill) {
+        return true;
+    }
+    JoinEntry *entries = *entriesOut = malloc((size_t)*count * sizeof(JoinEntry) + 1);
+    if (!entries) {
+        return false;
+    }
+    int loaded = 0;
+    for (int c = 0; c < bucket->chunkCount; c++) {
+        size_t size = (size_t)bucket->chunks[c].count * sizeof(JoinEntry);
+        if (!readFully(job->scratchFd, entries + loaded, size, bucket->chunks[c].offset)) {
+            return false;
+        }
+        loaded += bucket->chunks[c].count;
+    }
+    if (bucket->count > 0) {
+        memcpy(entries + loaded, bucket->entries, (size_t)bucket->count * sizeof(JoinEntry));
+    }
+    return true;
+}
+
+static bool keysEqual(const Column *a, int rowA, const Column *b, int rowB) {
+    if (a->type == INT) {
+        return a->intValues[rowA] == b->intValues[rowB];
+    } else if (a->type == FLOAT) {
+        return a->floatValues[rowA] == b->floatValues[rowB];
+    }
+    return strcmp(getStringValue(a, rowA), getStringValue(b, rowB)) == 0;
+}
+
+static bool addPair(JoinPairs *pairs, int left, int right) {
+    if (pairs->count == pairs->capacity) {
+        int capacity = pairs->capacity > 0 ? pairs->capacity * 2 : 256;
+        int *leftRows = realloc(pairs->leftRows, (size_t)capacity * sizeof(int));
+        if (leftRows) {
+            pairs->leftRows = leftRows;
+        }
+        int *rightRows = realloc(pairs->rightRows, (size_t)capacity * sizeof(int));
+        if (rightRows) {
+            pairs->rightRows = rightRows;
+        }
+        if (!leftRows || !rightRows) {
+            return false;
+        }
+        pairs->capacity = capacity;
+    }
+    pairs->leftRows[pairs->count] = left;
+    pairs->rightRows[pairs->count] = right;
+    pairs->count++;
+    return true;
+}
+
+// Builds the hash table of one partition and probes it. Chains are built
+// back to front so matches come out in row order.
+static void joinPartition(void *context, int index) {
+    JoinJob *job = context;
+    int partition = job->firstPartition + index;
+    JoinPairs *pairs = &job->pairs[partition];
+    JoinEntry *build, *probe;
+    int buildCount, probeCount;
+    bool loaded = loadBucket(job, &job->buildBuckets[partition], &build, &buildCount);
+    loaded = loadBucket(job, &job->probeBuckets[partition], &probe, &probeCount) && loaded;
+    int capacity = 16;
+    while (capacity < buildCount * 2 && capacity < (1 << 30)) {
+        capacity *= 2;
+    }
+    int *heads = malloc(capacity * sizeof(int));
+    int *next = malloc((size_t)buildCount * sizeof(int) + 1);
+    bool joined = loaded && heads && next;
+
+    if (joined && buildCount > 0 && probeCount > 0) {
+        memset(heads, 0xff, capacity * sizeof(int));
+        for (int i = buildCount - 1; i >= 0; i--) {
+            unsigned slot = build[i].hash & (capacity - 1);
+            next[i] = heads[slot];
+            heads[slot] = i;
+        }
+
+        const Column *buildKey = job->build->key;
+        const Column *probeKey = job->probe->key;
+        for (int p = 0; p < probeCount && joined; p++) {
+            unsigned hash = probe[p].hash;
+            for (int b = heads[hash & (capacity - 1)]; b >= 0 && joined; b = next[b]) {
+                if (build[b].hash != hash || !keysEqual(buildKey, build[b].row, probeKey, probe[p].row)) {
+                    continue;
+                }
+                joined = job->buildIsLeft ? addPair(pairs, build[b].row, probe[p].row) : addPair(pairs, probe[p].row, build[b].row);
+                if (job->limit >= 0 && pairs->count >= job->limit) {
+                    p = probeCount;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (!joined) {
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+    }
+    free(heads);
+    free(next);
+    if (job->spill) {
+        free(build);
+        free(probe);
+    }
+}
+
+static void freeJoinJob(JoinJob *job) {
+    for (int p = 0; p < job->partitionCount; p++) {
+        if (job->buildBuckets) {
+            free(job->buildBuckets[p].entries);
+            free(job->buildBuckets[p].chunks);
+        }
+        if (job->probeBuckets) {
+            free(job->probeBuckets[p].entries);
+            free(job->probeBuckets[p].chunks);
+        }
+        if (job->pairs) {
+            free(job->pairs[p].leftRows);
+            free(job->pairs[p].rightRows);
+        }
+    }
+    free(job->buildBuckets);
+    free(job->probeBuckets);
+    free(job->pairs);
+    if (job->scratchFd >= 0) {
+        close(job->scratchFd);
+    }
+}
+
+// Joins the rows of left and right whose keys are equal, keeping at most
+// limit pairs unless limit is negative. result must be released with
+// freeJoinResult. Without a sort the pairs come out grouped by partition.
+bool hashJoin(const JoinSide *left, const JoinSide *right, int limit, JoinResult *result) {
+    memset(result, 0, sizeof(JoinResult));
+    long long leftCount = countSideRows(left);
+    long long rightCount = countSideRows(right);
+    if (leftCount < 0 || rightCount < 0) {
+        return false;
+    }
+
+    JoinJob job;
+    memset(&job, 0, sizeof(job));
+    job.scratchFd = -1;
+    job.limit = limit;
+    job.buildIsLeft = leftCount <= rightCount;
+    job.build = job.buildIsLeft ? left : right;
+    job.probe = job.buildIsLeft ? right : left;
+    long long buildCount = job.buildIsLeft ? leftCount : rightCount;
+
+    // An entry, a chain link and about two hash table heads per build row.
+    size_t buildBytes = (size_t)buildCount * (sizeof(JoinEntry) + 3 * sizeof(int));
+    int partitionBits = 0;
+    if (leftCount + rightCount >= JOIN_PARTITION_MIN_ROWS) {
+        while ((1 << partitionBits) < JOIN_MIN_PARTITIONS ||
+               ((1 << partitionBits) < JOIN_MAX_PARTITIONS && (long long)JOIN_PARTITION_BUILD_ROWS << partitionBits < buildCount)) {
+            partitionBits++;
+        }
+    }
+    job.spill = buildBytes > joinMemoryBudget;
+    if (job.spill) {
+        while ((1 << partitionBits) < JOIN_MAX_PARTITIONS && buildBytes / (1 << partitionBits) * JOIN_SPILL_WAVE > joinMemoryBudget) {
+            partitionBits++;
+        }
+    }
+    job.partitionCount = 1 << partitionBits;
+    job.partitionShift = 32 - partitionBits;
+
+    job.buildBuckets = calloc(job.partitionCount, sizeof(JoinBucket));
+    job.probeBuckets = calloc(job.partitionCount, sizeof(JoinBucket));
+    job.pairs = calloc(job.partitionCount, sizeof(JoinPairs));
+    bool joined = job.buildBuckets && job.probeBuckets && job.pairs;
+    if (!joined) {
+        reportError("Error: Memory allocation failed while joining table '%s'.\n", left->table->tableName);
+    }
+    joined = joined && (!job.spill || openJoinScratchFile(&job));
+    joined = joined && partitionSide(&job, job.build, job.buildBuckets) && partitionSide(&job, job.probe, job.probeBuckets);
+
+    if (joined) {
+        int wave = job.spill ? JOIN_SPILL_WAVE : job.partitionCount;
+        for (job.firstPartition = 0; job.firstPartition < job.partitionCount && !job.failed; job.firstPartition += wave) {
+            int count = job.partitionCount - job.firstPartition < wave ? job.partitionCount - job.firstPartition : wave;
+            runParallel(count, joinPartition, &job);
+        }
+        if (job.failed) {
+            reportError("Error: Memory allocation failed while joining table '%s'.\n", left->table->tableName);
+            joined = false;
+        }
+    }
+
+    if (joined) {
+        long long total = 0;
+        for (int p = 0; p < job.partitionCount; p++) {
+            total += job.pairs[p].count;
+        }
+        if (limit >= 0 && total > limit) {
+            total = limit;
+        }
+        result->leftRows = malloc((size_t)total * sizeof(int) + 1);
+        result->rightRows = malloc((size_t)total * sizeof(int) + 1);
+        if (!result->leftRows || !result->rightRows) {
+            reportError("Error: Memory allocation failed while joining table '%s'.\n", left->table->tableName);
+            freeJoinResult(result);
+            joined = false;
+        }
+        for (int p = 0; joined && p < job.partitionCount && result->count < total; p++) {
+            int take = job.pairs[p].count < total - result->count ? job.pairs[p].count : (int)(total - result->count);
+            memcpy(result->leftRows + result->count, job.pairs[p].leftRows, (size_t)take * sizeof(int));
+            memcpy(result->rightRows + result->count, job.pairs[p].rightRows, (size_t)take * sizeof(int));
+            result->count += take;
+        }
+    }
+    freeJoinJob(&job);
+    return joined;
+}
+
+void freeJoinResult(JoinResult *result) {
+    free(result->leftRows);
+    free(result->rightRows);
+    memset(result, 0, sizeof(JoinResult));
+}
@@ -0,0 +1,27 @@
+#ifndef JOIN_H
+#define JOIN_H
+
+#include "filter.h"
+
+// One input of a join: the rows of table satisfying condition, which may be
+// NULL, matched on key.
+typedef struct {
+    const Table *table;
+    const Condition *condition;
+    const Column *key;
+} JoinSide;
+
+// Matching rows of a join: leftRows[i] of the left table goes with
+// rightRows[i] of the right one.
+typedef struct {
+    int *leftRows;
+    int *rightRows;
+    int count;
+} JoinResult;
+
+void setJoinMemoryBudget(size_t bytes);
+
+bool hashJoin(const JoinSide *left, const JoinSide *right, int limit, JoinResult *result);
+void freeJoinResult(JoinResult *result);
+
+#endif
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "lexer.h"
+#include "output.h"
+
+static bool isSymbol(char c) {
+    return strchr("()[]{},=<>?", c) != NULL;
+}
+
+// Splits source into tokens. Decoded token texts are packed into one arena,
+// which never needs more room than the source itself plus a terminator per
+// token.
+bool tokenize(const char *source, TokenList *list) {
+    size_t length = strlen(source);
+    list->tokens = malloc((length + 1) * sizeof(Token));
+    list->arena = malloc(2 * length + 2);
+    list->count = 0;
+    if (!list->tokens || !list->arena) {
+        reportError("Error: Memory allocation failed while parsing command.\n");
+        freeTokenList(list);
+        return false;
+    }
+
+    char *out = list->arena;
+    const char *p = source;
+    while (1) {
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        Token *token = &list->tokens[list->count++];
+        token->offset = p - source;
+        token->text = out;
+
+        if (!*p) {
+            token->type = TOKEN_END;
+            token->length = 0;
+            *out++ = '\0';
+            return true;
+        }
+
+        if (*p == '"') {
+            token->type = TOKEN_STRING;
+            p++;
+            while (*p && *p != '"') {
+                if (*p == '\\' && (p[1] == '"' || p[1] == '\\')) {
+                    p++;
+                }
+                *out++ = *p++;
+            }
+            if (!*p) {
+                reportError("Error: Unterminated string starting at position %d.\n", token->offset + 1);
+                freeTokenList(list);
+                return false;
+            }
+            p++;
+        } else if (*p == '?') {
+            token->type = TOKEN_PARAM;
+            *out++ = *p++;
+        } else if (isSymbol(*p)) {
+            token->type = TOKEN_SYMBOL;
+            *out++ = *p;
+            if ((*p == '=' || *p == '<' || *p == '>') && p[1] == '=') {
+                *out++ = *++p;
+            }
+            p++;
+        } else {
+            token->type = TOKEN_WORD;
+            while (*p && !isspace((unsigned char)*p) && !isSymbol(*p) && *p != '"') {
+                *out++ = *p++;
+            }
+        }
+        *out++ = '\0';
+        token->length = (p - source) - token->offset;
+    }
+}
+
+void freeTokenList(TokenList *list) {
+    free(list->tokens);
+    free(list->arena);
+    list->tokens = NULL;
+    list->arena = NULL;
+    list->count = 0;
+}
+
+bool tokenIs(const Token *token, TokenType type, const char *text) {
+    return token->type == type && (!text || strcmp(token->text, text) == 0);
+}
@@ -0,0 +1,33 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stdbool.h>
+
+typedef enum {
+    TOKEN_END,
+    TOKEN_WORD,     // names, keywords and bare values such as 42 or -1.5
+    TOKEN_STRING,   // "double quoted", with \" and \\ escapes
+    TOKEN_SYMBOL,   // ( ) [ ] { } , = == < <= > >=
+    TOKEN_PARAM     // ? placeholder in a prepared statement
+} TokenType;
+
+typedef struct {
+    TokenType type;
+    char *text;     // decoded, NUL-terminated copy owned by the TokenList
+    int offset;     // position and length of the token in the source
+    int length;
+} Token;
+
+// All tokens of one command. The list always ends with a TOKEN_END token.
+typedef struct {
+    Token *tokens;
+    int count;
+    char *arena;
+} TokenList;
+
+bool tokenize(const char *source, TokenList *list);
+void freeTokenList(TokenList *list);
+
+bool tokenIs(const Token *token, TokenType type, const char *text);
+
+#endif
@@ -7,155 +7,155 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include "config.h"
-
-#define MAX_NAME_LEN 100
-
-typedef enum { INT, STRING, FLOAT } DataType;
-
-typedef struct {
-    char name[MAX_NAME_LEN];
-    DataType type;
-    int stringSize;
-    bool isPrimaryKey;
-    bool isRequired;
-} Column;
-
-
-typedef struct {
-    int *intValues;
-    char **strValues;
-    float *floatValues;
-} RowData;
-
-typedef struct {
-    char tableName[MAX_NAME_LEN];
-    char databaseName[MAX_NAME_LEN];
-    Column *columns;
-    int columnCount;
-    RowData *rows;
-    int rowCount;
-    int maxRows;
-} Table;
-
-typedef struct {
-    char name[MAX_NAME_LEN];
-    Table *tables;
-    int tableCount;
-    int maxTables;
-} Database;
-
-Database *databases = NULL;
+#include "storage.h"
+#include "hashindex.h"
+#include "btree.h"
+#include "filter.h"
+#include "lexer.h"
+#include "parser.h"
+#include "scan.h"
+#include "aggregate.h"
+#include "sort.h"
+#include "output.h"
+#include "join.h"
+#include "dbfile.h"
+#include "wal.h"
+#include "parallel.h"
+#include "server.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "budget.h"
+
+// Loaded databases, each allocated on its own so Database pointers stay valid
+// while the database is loaded. databaseMap resolves names to them.
+Database **databases = NULL;
 int databaseCount = 0;
 int maxDatabases = 1;
+NameMap databaseMap;
 char currentDatabase[MAX_NAME_LEN] = "";
+// True when commands come from a script or a pipe rather than a terminal;
+// prompts and confirmations are then skipped.
+static bool batchMode = false;
 
 Table *getTableByName(Database *db, const char *tableName);
+static void runMutation(char *command);
 
 void initializeDatabases() {
-    databases = malloc(maxDatabases * sizeof(Database));
+    databases = malloc(maxDatabases * sizeof(Database *));
 }
 
 void expandDatabaseList() {
     maxDatabases *= 2;
-    databases = realloc(databases, maxDatabases * sizeof(Database));
+    databases = realloc(databases, maxDatabases * sizeof(Database *));
 }
 
-void expandTableList(Database *db) {
-    db->maxTables *= 2;
-    db->tables = realloc(db->tables, db->maxTables * sizeof(Table));
+Database* getDatabaseByName(const char *name) {
+    return nameMapFind(&databaseMap, name);
 }
 
-void expandRowList(Table *table) {
-    table->maxRows *= 2;
-    table->rows = realloc(table->rows, table->maxRows * sizeof(RowData));
-    for (int i = table->rowCount; i < table->maxRows; i++) {
-        table->rows[i].intValues = malloc(table->columnCount * sizeof(int));
-        table->rows[i].strValues = malloc(table->columnCount * sizeof(char *));
-        table->rows[i].floatValues = malloc(table->columnCount * sizeof(float));
-        for (int j = 0; j < table->columnCount; j++) {
-            table->rows[i].strValues[j] = malloc(MAX_NAME_LEN * sizeof(char));
-        }
+// Adds db to the catalog. Fails if a database of the same name is loaded.
+static bool registerDatabase(Database *db) {
+    if (getDatabaseByName(db->name)) {
+        reportError("Error: Database '%s' is already loaded.\n", db->name);
+        return false;
     }
+    if (databaseCount >= maxDatabases) {
+        expandDatabaseList();
+    }
+    if (!nameMapInsert(&databaseMap, db->name, db)) {
+        return false;
+    }
+    databases[databaseCount++] = db;
+    return true;
 }
 
-Database* getDatabaseByName(const char *name) {
+static void unregisterDatabase(Database *db) {
+    nameMapRemove(&databaseMap, db->name);
     for (int i = 0; i < databaseCount; i++) {
-        if (strcmp(databases[i].name, name) == 0) {
-            return &databases[i];
+        if (databases[i] == db) {
+            memmove(&databases[i], &databases[i + 1], (databaseCount - i - 1) * sizeof(Database *));
+            databaseCount--;
+            break;
         }
     }
-    return NULL;
 }
 
+// Returns the named table, first loading its rows if the database was mapped
+// and the table has not been used yet.
 Table *getTableByName(Database *db, const char *tableName) {
-    for (int i = 0; i < db->tableCount; i++) {
-        if (strcmp(db->tables[i].tableName, tableName) == 0) {
-            return &db->tables[i];
-        }
+    Table *table = findTable(db, tableName);
+    return table && ensureTableLoaded(table) ? table : NULL;
+}
+
+// Records that table, or with no table only the catalog of db, differs from
+// the saved file, so the next commit rewrites it.
+static void markDirty(Database *db, Table *table) {
+    db->dirty = true;
+    if (table) {
+        table->dirty = true;
     }
-    return NULL;
+}
+
+static void closeDatabaseWal(Database *db) {
+    closeWal(db->wal);
+    db->wal = NULL;
 }
 
 void createDatabase(char *dbName) {
-    if (databaseCount >= maxDatabases) {
-        expandDatabaseList();
+    Database *newDb = calloc(1, sizeof(Database));
+    strncpy(newDb->name, dbName, MAX_NAME_LEN - 1);
+    newDb->dirty = true;
+    if (!registerDatabase(newDb)) {
+        free(newDb);
+        return;
     }
-    Database *newDb = &databases[databaseCount++];
-    strncpy(newDb->name, dbName, MAX_NAME_LEN);
-    newDb->tables = malloc(2 * sizeof(Table));
-    newDb->tableCount = 0;
-    newDb->maxTables = 2;
 
-    strncpy(currentDatabase, dbName, MAX_NAME_LEN);
-    printf("Database '%s' created and selected.\n", currentDatabase);
+    strncpy(currentDatabase, newDb->name, MAX_NAME_LEN - 1);
+    currentDatabase[MAX_NAME_LEN - 1] = '\0';
+    fprintf(commandOutput(), "Database '%s' created and selected.\n", currentDatabase);
 }
 
 void useDatabase(char *dbName) {
     Database *db = getDatabaseByName(dbName);
     if (db) {
-        strncpy(currentDatabase, dbName, MAX_NAME_LEN);
-        printf("Using database '%s'.\n", currentDatabase);
+        strncpy(currentDatabase, db->name, MAX_NAME_LEN - 1);
+        currentDatabase[MAX_NAME_LEN - 1] = '\0';
+        fprintf(commandOutput(), "Using database '%s'.\n", currentDatabase);
     } else {
-        printf("Error: Database '%s' does not exist.\n", dbName);
+        reportError("Error: Database '%s' does not exist.\n", dbName);
     }
 }
 
 void createTable(char *command) {
     if (strlen(currentDatabase) == 0) {
-        printf("Error: No database selected. Use 'useDatabase' first.\n");
+        reportError("Error: No database selected. Use 'useDatabase' first.\n");
         return;
     }
 
     Database *db = getDatabaseByName(currentDatabase);
     if (!db) {
-        printf("Error: Database '%s' does not exist.\n", currentDatabase);
+        reportError("Error: Database '%s' does not exist.\n", currentDatabase);
         return;
     }
 
     char *tableName = strtok(command, "[");
     if (!tableName) {
-        printf("Error: Invalid syntax.\n");
+        reportError("Error: Invalid syntax.\n");
         return;
     }
 
-    if (db->tableCount >= db->maxTables) {
-        expandTableList(db);
-    }
-
-    Table *newTable = &db->tables[db->tableCount++];
-    strncpy(newTable->tableName, tableName, MAX_NAME_LEN);
-    strncpy(newTable->databaseName, currentDatabase, MAX_NAME_LEN);
-    newTable->columnCount = 0;
-    newTable->rowCount = 0;
-    newTable->maxRows = 2;
-    newTable->rows = malloc(newTable->maxRows * sizeof(RowData));
-
     char *columnsDef = strtok(NULL, "]");
     if (!columnsDef) {
-        printf("Error: Invalid syntax in column definition.\n");
+        reportError("Error: Invalid syntax in column definition.\n");
         return;
     }
 
+    Table *newTable = calloc(1, sizeof(Table));
+    strncpy(newTable->tableName, tableName, MAX_NAME_LEN - 1);
+    memcpy(newTable->databaseName, currentDatabase, MAX_NAME_LEN);
+    newTable->loaded = true;
+    newTable->dirty = true;
+
     char *col = strtok(columnsDef, ",");
     newTable->columns = malloc(MAX_NAME_LEN * sizeof(Column));
     while (col && newTable->columnCount < MAX_NAME_LEN) {
@@ -173,6 +173,11 @@ void createTable(char *command) {
         }
 
         strncpy(column->name, colName, MAX_NAME_LEN);
+        column->values = NULL;
+        column->primaryIndex = NULL;
+        column->orderedIndex = NULL;
+        column->sharedEpoch = 0;
+        column->stringSize = 0;
         column->isPrimaryKey = isPrimary;
         column->isRequired = isRequired;
 
@@ -185,191 +190,380 @@ void createTable(char *command) {
             sscanf(colType, "string{%d}", &strLen);
             column->stringSize = strLen;
         } else {
-            printf("Error: Unsupported data type.\n");
+            reportError("Error: Unsupported data type.\n");
+            freeTableStorage(newTable);
+            free(newTable);
             return;
         }
 
         col = strtok(NULL, ",");
     }
 
-    expandRowList(newTable);
-    printf("Table '%s' created in database '%s' with %d columns.\n", newTable->tableName, currentDatabase, newTable->columnCount);
-}
-
-void insertValues(char *command) {
-    if (strlen(currentDatabase) == 0) {
-        printf("Error: No database selected. Use 'useDatabase' first.\n");
-        return;
-    }
-
-    Database *db = getDatabaseByName(currentDatabase);
-    if (!db) {
-        printf("Error: Database '%s' not found.\n", currentDatabase);
+    if (!rebuildColumnMap(newTable) || !buildPrimaryIndexes(newTable) || !addTable(db, newTable)) {
+        freeTableStorage(newTable);
+        free(newTable);
         return;
     }
+    markDirty(db, newTable);
+    fprintf(commandOutput(), "Table '%s' created in database '%s' with %d columns.\n", newTable->tableName, currentDatabase, newTable->columnCount);
+}
 
-    char *tableName = strtok(command, "(");
-    if (!tableName) {
-        printf("Error: Invalid syntax.\n");
-        return;
+static void removeRowsFromPrimaryIndexes(Table *table, int firstRow, int count) {
+    for (int i = 0; i < table->columnCount; i++) {
+        Column *col = &table->columns[i];
+        if (!col->primaryIndex) {
+            continue;
+        }
+        for (int row = firstRow; row < firstRow + count; row++) {
+            hashIndexRemove(col->primaryIndex, col, row);
+        }
     }
+}
 
-    Table *table = NULL;
-    for (int i = 0; i < db->tableCount; i++) {
-        if (strcmp(db->tables[i].tableName, tableName) == 0) {
-            table = &db->tables[i];
-            break;
+static void removeRowsFromOrderedIndexes(Table *table, int firstRow, int count) {
+    for (int i = 0; i < table->columnCount; i++) {
+        Column *col = &table->columns[i];
+        if (!col->orderedIndex) {
+            continue;
+        }
+        for (int row = firstRow; row < firstRow + count; row++) {
+            btreeRemove(col->orderedIndex, col, row);
         }
     }
-    if (!table) {
-        printf("Error: Table '%s' not found in database '%s'.\n", tableName, currentDatabase);
+}
+
+// Appends every tuple of an insertValues statement. The whole batch is
+// validated and appended at once, or not at all.
+static void executeInsert(Statement *statement) {
+    Database *db = statement->db;
+    Table *table = statement->table;
+    int tupleCount = statement->tupleCount;
+
+    int firstRow = table->rowCount;
+    if (!reserveRows(table, firstRow + tupleCount)) {
         return;
     }
 
-    if (table->rowCount >= table->maxRows) {
-        expandRowList(table);
+    for (int t = 0; t < tupleCount; t++) {
+        for (int i = 0; i < table->columnCount; i++) {
+            Column *col = &table->columns[i];
+            Operand *value = &statement->values[t * table->columnCount + i];
+            if (col->isRequired && strlen(value->text) == 0) {
+                reportError("Error: Column '%s' is required.\n", col->name);
+                return;
+            }
+            setValue(col, firstRow + t, &value->value);
+        }
     }
 
-    char *valuesDef = strtok(NULL, ")");
-    if (!valuesDef) {
-        printf("Error: Values not defined correctly.\n");
-        return;
+    for (int i = 0; i < table->columnCount; i++) {
+        Column *col = &table->columns[i];
+        if (!col->primaryIndex) {
+            continue;
+        }
+        for (int row = firstRow; row < firstRow + tupleCount; row++) {
+            if (hashIndexFindRow(col->primaryIndex, col, row) >= 0) {
+                reportError("Error: Duplicate value for primary key '%s'.\n", col->name);
+                removeRowsFromPrimaryIndexes(table, firstRow, tupleCount);
+                return;
+            }
+            if (!hashIndexInsert(col->primaryIndex, col, row)) {
+                removeRowsFromPrimaryIndexes(table, firstRow, tupleCount);
+                return;
+            }
+        }
     }
 
-    int valueCount = 0;
-    char **values = malloc(sizeof(char*) * table->columnCount);
-    char *valueStart = valuesDef;
-    int inQuotes = 0;
-
-    for (char *p = valuesDef; *p; p++) {
-        if (*p == '"') {
-            inQuotes = !inQuotes;
+    for (int i = 0; i < table->columnCount; i++) {
+        Column *col = &table->columns[i];
+        if (!col->orderedIndex) {
+            continue;
         }
-        if (*p == ',' && !inQuotes) {
-            *p = '\0';
-            values[valueCount++] = valueStart;
-            valueStart = p + 1;
+        for (int row = firstRow; row < firstRow + tupleCount; row++) {
+            if (!btreeInsert(col->orderedIndex, col, row)) {
+                removeRowsFromOrderedIndexes(table, firstRow, tupleCount);
+                removeRowsFromPrimaryIndexes(table, firstRow, tupleCount);
+                return;
+            }
         }
     }
-    values[valueCount++] = valueStart;
+    table->rowCount += tupleCount;
+    markDirty(db, table);
+    countStat(STAT_ROWS_MODIFIED, tupleCount);
+
+    if (tupleCount == 1) {
+        fprintf(commandOutput(), "Values inserted into table '%s'.\n", table->tableName);
+    } else {
+        fprintf(commandOutput(), "%d rows inserted into table '%s'.\n", tupleCount, table->tableName);
+    }
+}
 
-    if (valueCount != table->columnCount) {
-        printf("Error: Number of values (%d) does not match the number of columns (%d) in table '%s'.\n", valueCount, table->columnCount, table->tableName);
-        free(values);
+// Prints columns of the given rows as a table, or of rows 0 to rowCount - 1
+// when rows is NULL. Only the listed columns are read, and column widths come
+// from a sample of the rows.
+static void printRows(Column **columns, int columnCount, const int *rows, int rowCount) {
+    TablePrinter printer;
+    if (!openTablePrinter(&printer, columns, columnCount)) {
         return;
     }
+    estimateTableWidths(&printer, rows, 0, rowCount);
+    printTableHeader(&printer);
+    for (int r = 0; r < rowCount; r++) {
+        printTableRow(&printer, rows ? rows[r] : r);
+    }
+    printTableFooter(&printer);
+    closeTablePrinter(&printer);
+}
 
-    RowData *newRow = &table->rows[table->rowCount++];
+// Prints the rows from offsetRows on, up to limitRows of them, a page at a
+// time, so output starts before the whole range is formatted. Column widths
+// are estimated from a sample of the range, or with 'stream' taken from the
+// column types without reading any row.
+static void executeDisplay(Statement *statement) {
+    Table *table = statement->table;
+    Column *columns[table->columnCount > 0 ? table->columnCount : 1];
     for (int i = 0; i < table->columnCount; i++) {
-        Column *col = &table->columns[i];
-        char *value = values[i];
+        columns[i] = &table->columns[i];
+    }
+    int firstRow = statement->offsetRows < table->rowCount ? statement->offsetRows : table->rowCount;
+    int rowCount = table->rowCount - firstRow;
+    if (statement->limitRows >= 0 && statement->limitRows < rowCount) {
+        rowCount = statement->limitRows;
+    }
 
-        if (col->isRequired && (value == NULL || strlen(value) == 0)) {
-            printf("Error: Column '%s' is required.\n", col->name);
-            table->rowCount--;
-            free(values);
-            return;
+    TablePrinter printer;
+    if (!openTablePrinter(&printer, columns, table->columnCount)) {
+        return;
+    }
+    if (statement->stream) {
+        schemaTableWidths(&printer);
+    } else {
+        estimateTableWidths(&printer, NULL, firstRow, rowCount);
+    }
+    printTableHeader(&printer);
+    for (int start = 0; start < rowCount; start += DISPLAY_PAGE_ROWS) {
+        int end = start + DISPLAY_PAGE_ROWS < rowCount ? start + DISPLAY_PAGE_ROWS : rowCount;
+        for (int r = start; r < end; r++) {
+            printTableRow(&printer, firstRow + r);
         }
+        flushOutput(&printer.output);
+    }
+    printTableFooter(&printer);
+    closeTablePrinter(&printer);
+    if (statement->hasLimit || statement->hasOffset) {
+        fprintf(commandOutput(), "%d of %d row(s) shown from table '%s', starting at offset %d.\n", rowCount, table->rowCount, table->tableName, firstRow);
+    }
+}
 
-        if (col->isPrimaryKey) {
-            for (int j = 0; j < table->rowCount - 1; j++) {
-                if ((col->type == INT && table->rows[j].intValues[i] == atoi(value)) ||
-                    (col->type == FLOAT && table->rows[j].floatValues[i] == atof(value)) ||
-                    (col->type == STRING && strcmp(table->rows[j].strValues[i], value) == 0)) {
-                    printf("Error: Duplicate value for primary key '%s'.\n", col->name);
-                    table->rowCount--;
-                    free(values);
-                    return;
-                }
-            }
-        }
+static void executeAggregate(Statement *statement) {
+    Table *table = statement->table;
+    Table result;
+    if (!aggregateTable(table, statement->hasCondition ? &statement->condition : NULL, statement->grouped,
+                        statement->groupByCount, statement->outputs, statement->itemCount, statement->outputOrder,
+                        statement->orderByCount, statement->limitRows, &result)) {
+        return;
+    }
 
-        if (col->type == INT) {
-            newRow->intValues[i] = atoi(value);
-        } else if (col->type == FLOAT) {
-            newRow->floatValues[i] = atof(value);
-        } else if (col->type == STRING) {
-            strncpy(newRow->strValues[i], value, col->stringSize);
-        }
+    int rowCount = result.rowCount;
+    Column *columns[result.columnCount];
+    for (int i = 0; i < result.columnCount; i++) {
+        columns[i] = &result.columns[i];
     }
+    printRows(columns, result.columnCount, NULL, rowCount);
+    fprintf(commandOutput(), "%d row(s) selected from table '%s'.\n", rowCount, table->tableName);
+    freeTableStorage(&result);
+}
 
-    free(values);
-    printf("Values inserted into table '%s'.\n", table->tableName);
+static int compareOrderedRows(void *context, int a, int b) {
+    const Statement *statement = context;
+    for (int k = 0; k < statement->orderByCount; k++) {
+        const OrderColumn *order = &statement->orderColumns[k];
+        int cmp = compareRowValues(order->column, a, b);
+        if (cmp) {
+            return order->descending ? -cmp : cmp;
+        }
+    }
+    return 0;
 }
 
-void displayTable(char *tableName) {
-    Database *db = getDatabaseByName(currentDatabase);
-    if (!db) {
-        printf("Error: Database '%s' does not exist.\n", currentDatabase);
+// Feeds every selected row to a Sorter, which keeps only the first limit rows
+// in a heap when there is a limit and otherwise sorts them all, spilling to
+// disk past the sort memory budget. The sorted rows are read twice, once to
+// size the columns and once to print them, so they are never all held here.
+static void executeOrderedSelect(Statement *statement) {
+    Table *table = statement->table;
+    Sorter sorter;
+    if (!openSorter(&sorter, compareOrderedRows, statement, statement->limitRows)) {
         return;
     }
 
-    Table *table = getTableByName(db, tableName);
-    if (!table) {
-        printf("Error: Table '%s' not found in database '%s'.\n", tableName, currentDatabase);
+    Scan scan;
+    if (!openScan(&scan, table, statement->hasCondition ? &statement->condition : NULL)) {
+        closeSorter(&sorter);
+        return;
+    }
+    bool sorted = true;
+    while (sorted && nextScanBatch(&scan)) {
+        sorted = addToSorter(&sorter, scan.rows, scan.count);
+    }
+    closeScan(&scan);
+    if (!sorted || !finishSorter(&sorter)) {
+        closeSorter(&sorter);
         return;
     }
 
-    int columnWidths[table->columnCount];
-    for (int i = 0; i < table->columnCount; i++) {
-        columnWidths[i] = strlen(table->columns[i].name);
-
-        for (int row = 0; row < table->rowCount; row++) {
-            int valueLength = 0;
-            Column *column = &table->columns[i];
-            
-            if (column->type == INT) {
-                valueLength = snprintf(NULL, 0, "%d", table->rows[row].intValues[i]);
-            } else if (column->type == FLOAT) {
-                valueLength = snprintf(NULL, 0, "%.2f", table->rows[row].floatValues[i]);
-            } else if (column->type == STRING) {
-                valueLength = strlen(table->rows[row].strValues[i]);
-            }
+    TablePrinter printer;
+    if (!openTablePrinter(&printer, statement->projected, statement->projectedCount)) {
+        closeSorter(&sorter);
+        return;
+    }
+    int row, rowCount = 0;
+    while (nextSortedItem(&sorter, &row)) {
+        measureTableRow(&printer, row);
+        rowCount++;
+    }
 
-            if (valueLength > columnWidths[i]) {
-                columnWidths[i] = valueLength;
-            }
+    rewindSorter(&sorter);
+    printTableHeader(&printer);
+    while (nextSortedItem(&sorter, &row)) {
+        printTableRow(&printer, row);
+    }
+    printTableFooter(&printer);
+    closeTablePrinter(&printer);
+    fprintf(commandOutput(), "%d row(s) selected from table '%s'.\n", rowCount, table->tableName);
+    closeSorter(&sorter);
+}
+
+typedef struct {
+    const Statement *statement;
+    const JoinResult *result;
+} JoinOrder;
+
+static int compareJoinedRows(void *context, int a, int b) {
+    const JoinOrder *order = context;
+    for (int k = 0; k < order->statement->orderByCount; k++) {
+        const OrderColumn *key = &order->statement->orderColumns[k];
+        const int *rows = key->side == 0 ? order->result->leftRows : order->result->rightRows;
+        int cmp = compareRowValues(key->column, rows[a], rows[b]);
+        if (cmp) {
+            return key->descending ? -cmp : cmp;
         }
     }
+    return 0;
+}
 
-    printf("\n");
-    for (int i = 0; i < table->columnCount; i++) {
-        for (int j = 0; j < columnWidths[i] + 3; j++) printf("-");
+// Hash joins the two tables, with the where clause applied to its table
+// before the join, then prints the pairs, sorted through a Sorter when there
+// is an order by. Headers name each column as Table.Column.
+static void executeJoin(Statement *statement) {
+    JoinSide left = {statement->table, NULL, statement->leftKey};
+    JoinSide right = {statement->joinTable, NULL, statement->rightKey};
+    if (statement->hasCondition) {
+        (statement->conditionSide == 0 ? &left : &right)->condition = &statement->condition;
+    }
+    JoinResult result;
+    if (!hashJoin(&left, &right, statement->orderByCount > 0 ? -1 : statement->limitRows, &result)) {
+        return;
     }
-    printf("-");
-    printf("\n");
 
-    for (int i = 0; i < table->columnCount; i++) {
-        printf("| %-*s ", columnWidths[i], table->columns[i].name);
+    int columnCount = statement->projectedCount;
+    char names[columnCount > 0 ? columnCount : 1][2 * MAX_NAME_LEN + 2];
+    const char *headers[columnCount > 0 ? columnCount : 1];
+    for (int i = 0; i < columnCount; i++) {
+        Table *table = statement->projectedSides[i] == 0 ? statement->table : statement->joinTable;
+        snprintf(names[i], sizeof(names[i]), "%s.%s", table->tableName, statement->projected[i]->name);
+        headers[i] = names[i];
     }
-    printf("|\n");
+    TablePrinter printer;
+    if (!openTablePrinter(&printer, statement->projected, columnCount)) {
+        freeJoinResult(&result);
+        return;
+    }
+    setJoinedColumns(&printer, statement->projectedSides, headers);
 
-    for (int i = 0; i < table->columnCount; i++) {
-        for (int j = 0; j < columnWidths[i] + 3; j++) printf("-");
-    }
-    printf("-");
-    printf("\n");
-
-    for (int row = 0; row < table->rowCount; row++) {
-        for (int col = 0; col < table->columnCount; col++) {
-            Column *column = &table->columns[col];
-            if (column->type == INT) {
-                printf("| %-*d ", columnWidths[col], table->rows[row].intValues[col]);
-            } else if (column->type == FLOAT) {
-                printf("| %-*.2f ", columnWidths[col], table->rows[row].floatValues[col]);
-            } else if (column->type == STRING) {
-                printf("| %-*s ", columnWidths[col], table->rows[row].strValues[col]);
+    int rowCount = result.count;
+    if (statement->orderByCount == 0) {
+        estimateJoinedWidths(&printer, result.leftRows, result.rightRows, rowCount);
+        printTableHeader(&printer);
+        for (int i = 0; i < rowCount; i++) {
+            printJoinedRow(&printer, (int[2]){result.leftRows[i], result.rightRows[i]});
+        }
+    } else {
+        JoinOrder order = {statement, &result};
+        Sorter sorter;
+        bool sorted = openSorter(&sorter, compareJoinedRows, &order, statement->limitRows);
+        int batch[SCAN_BATCH_ROWS];
+        for (int start = 0; sorted && start < result.count; start += SCAN_BATCH_ROWS) {
+            int count = result.count - start < SCAN_BATCH_ROWS ? result.count - start : SCAN_BATCH_ROWS;
+            for (int i = 0; i < count; i++) {
+                batch[i] = start + i;
             }
+            sorted = addToSorter(&sorter, batch, count);
+        }
+        if (!sorted || !finishSorter(&sorter)) {
+            closeSorter(&sorter);
+            closeTablePrinter(&printer);
+            freeJoinResult(&result);
+            return;
+        }
+        int item;
+        rowCount = 0;
+        while (nextSortedItem(&sorter, &item)) {
+            measureJoinedRow(&printer, (int[2]){result.leftRows[item], result.rightRows[item]});
+            rowCount++;
         }
-        printf("|\n");
+        rewindSorter(&sorter);
+        printTableHeader(&printer);
+        while (nextSortedItem(&sorter, &item)) {
+            printJoinedRow(&printer, (int[2]){result.leftRows[item], result.rightRows[item]});
+        }
+        closeSorter(&sorter);
     }
+    printTableFooter(&printer);
+    closeTablePrinter(&printer);
+    fprintf(commandOutput(), "%d row(s) selected from tables '%s' and '%s'.\n", rowCount, statement->table->tableName, statement->joinTable->tableName);
+    freeJoinResult(&result);
+}
 
-    for (int i = 0; i < table->columnCount; i++) {
-        for (int j = 0; j < columnWidths[i] + 3; j++) printf("-");
+// Runs the scan batch by batch, keeping the selected rows until the limit is
+// reached, then prints the projected columns of those rows.
+static void executeSelect(Statement *statement) {
+    if (statement->isAggregate) {
+        executeAggregate(statement);
+        return;
     }
-    printf("-");
-    printf("\n");
+    if (statement->joinTable) {
+        executeJoin(statement);
+        return;
+    }
+    if (statement->orderByCount > 0) {
+        executeOrderedSelect(statement);
+        return;
+    }
+    Table *table = statement->table;
+    int limit = statement->limitRows >= 0 ? statement->limitRows : table->rowCount;
+    int *rows = malloc((limit < table->rowCount ? limit : table->rowCount) * sizeof(int) + sizeof(int));
+    if (!rows) {
+        reportError("Error: Memory allocation failed while selecting from table '%s'.\n", table->tableName);
+        return;
+    }
+
+    Scan scan;
+    int rowCount = 0;
+    if (!openScan(&scan, table, statement->hasCondition ? &statement->condition : NULL)) {
+        free(rows);
+        return;
+    }
+    while (rowCount < limit && nextScanBatch(&scan)) {
+        int take = scan.count < limit - rowCount ? scan.count : limit - rowCount;
+        memcpy(rows + rowCount, scan.rows, take * sizeof(int));
+        rowCount += take;
+    }
+    closeScan(&scan);
 
+    printRows(statement->projected, statement->projectedCount, rows, rowCount);
+    fprintf(commandOutput(), "%d row(s) selected from table '%s'.\n", rowCount, table->tableName);
+    free(rows);
 }
 
 void editTable(char *command) {
@@ -379,32 +573,40 @@ void editTable(char *command) {
     char *dataTypeStr = strtok(NULL, " ");
 
     if (!tableName || !operation || !columnName) {
-        printf("Error: Invalid syntax.\n");
+        reportError("Error: Invalid syntax.\n");
         return;
     }
 
     Database *db = getDatabaseByName(currentDatabase);
     if (!db) {
-        printf("Error: No database selected or database not found.\n");
+        reportError("Error: No database selected or database not found.\n");
         return;
     }
 
     Table *table = getTableByName(db, tableName);
     if (!table) {
-        printf("Error: Table '%s' not found.\n", tableName);
+        reportError("Error: Table '%s' not found.\n", tableName);
         return;
     }
 
     if (strcmp(operation, "addColumn") == 0) {
         if (!dataTypeStr) {
-            printf("Error: Datatype required when adding a column.\n");
+            reportError("Error: Datatype required when adding a column.\n");
             return;
         }
 
         table->columns = realloc(table->columns, (table->columnCount + 1) * sizeof(Column));
 
         Column *newColumn = &table->columns[table->columnCount++];
-        strncpy(newColumn->name, columnName, MAX_NAME_LEN);
+        strncpy(newColumn->name, columnName, MAX_NAME_LEN - 1);
+        newColumn->name[MAX_NAME_LEN - 1] = '\0';
+        newColumn->stringSize = 0;
+        newColumn->isPrimaryKey = false;
+        newColumn->isRequired = false;
+        newColumn->values = NULL;
+        newColumn->primaryIndex = NULL;
+        newColumn->orderedIndex = NULL;
+        newColumn->sharedEpoch = 0;
 
         if (strcmp(dataTypeStr, "int") == 0) {
             newColumn->type = INT;
@@ -414,195 +616,120 @@ void editTable(char *command) {
             newColumn->type = STRING;
             sscanf(dataTypeStr, "string{%d}", &newColumn->stringSize);
         } else {
-            printf("Error: Unsupported data type.\n");
+            reportError("Error: Unsupported data type.\n");
+            table->columnCount--;
+            rebuildColumnMap(table);
             return;
         }
 
-        for (int i = 0; i < table->rowCount; i++) {
-            table->rows[i].intValues = realloc(table->rows[i].intValues, table->columnCount * sizeof(int));
-            table->rows[i].strValues = realloc(table->rows[i].strValues, table->columnCount * sizeof(char *));
-            table->rows[i].floatValues = realloc(table->rows[i].floatValues, table->columnCount * sizeof(float));
-
-            if (newColumn->type == INT) {
-                table->rows[i].intValues[table->columnCount - 1] = 0;
-            } else if (newColumn->type == FLOAT) {
-                table->rows[i].floatValues[table->columnCount - 1] = 0.0;
-            } else if (newColumn->type == STRING) {
-                table->rows[i].strValues[table->columnCount - 1] = malloc(newColumn->stringSize * sizeof(char));
-                strcpy(table->rows[i].strValues[table->columnCount - 1], "");
-            }
+        if (!resizeColumnStorage(newColumn, 0, table->maxRows)) {
+            table->columnCount--;
+            rebuildColumnMap(table);
+            return;
+        }
+        if (!rebuildColumnMap(table)) {
+            freeColumnStorage(newColumn, table->maxRows);
+            table->columnCount--;
+            rebuildColumnMap(table);
+            return;
         }
 
-        printf("Column '%s' added to table '%s'.\n", columnName, tableName);
+        markDirty(db, table);
+        fprintf(commandOutput(), "Column '%s' added to table '%s'.\n", columnName, tableName);
 
     } else if (strcmp(operation, "removeColumn") == 0) {
-        int colIndex = -1;
-        for (int i = 0; i < table->columnCount; i++) {
-            if (strcmp(table->columns[i].name, columnName) == 0) {
-                colIndex = i;
-                break;
-            }
-        }
-        if (colIndex == -1) {
-            printf("Error: Column '%s' not found.\n", columnName);
+        Column *column = findColumn(table, columnName);
+        if (!column) {
+            reportError("Error: Column '%s' not found.\n", columnName);
             return;
         }
+        int colIndex = column - table->columns;
 
-        for (int i = 0; i < table->rowCount; i++) {
-            if (table->columns[colIndex].type == STRING) {
-                free(table->rows[i].strValues[colIndex]);
-            }
-            for (int j = colIndex; j < table->columnCount - 1; j++) {
-                table->rows[i].intValues[j] = table->rows[i].intValues[j + 1];
-                table->rows[i].strValues[j] = table->rows[i].strValues[j + 1];
-                table->rows[i].floatValues[j] = table->rows[i].floatValues[j + 1];
-            }
-        }
+        freeColumnStorage(&table->columns[colIndex], table->maxRows);
+        freeHashIndex(table->columns[colIndex].primaryIndex);
+        freeBTree(table->columns[colIndex].orderedIndex);
 
         for (int i = colIndex; i < table->columnCount - 1; i++) {
             table->columns[i] = table->columns[i + 1];
         }
         table->columnCount--;
+        rebuildColumnMap(table);
 
-        printf("Column '%s' removed from table '%s'.\n", columnName, tableName);
+        markDirty(db, table);
+        fprintf(commandOutput(), "Column '%s' removed from table '%s'.\n", columnName, tableName);
     } else {
-        printf("Error: Invalid operation. Use 'addColumn' or 'removeColumn'.\n");
+        reportError("Error: Invalid operation. Use 'addColumn' or 'removeColumn'.\n");
     }
 }
 
 void deleteTable(char *tableName) {
     if (strlen(currentDatabase) == 0) {
-        printf("Error: No database selected.\n");
+        reportError("Error: No database selected.\n");
         return;
     }
     Database *db = getDatabaseByName(currentDatabase);
     if (!db) {
-        printf("Error: No database selected or database not found.\n");
+        reportError("Error: No database selected or database not found.\n");
         return;
     }
 
-    int tableIndex = -1;
-    for (int i = 0; i < db->tableCount; i++) {
-        if (strcmp(db->tables[i].tableName, tableName) == 0) {
-            tableIndex = i;
-            break;
-        }
-    }
-
-    if (tableIndex == -1) {
-        printf("Error: Table '%s' not found in database '%s'.\n", tableName, currentDatabase);
+    Table *table = findTable(db, tableName);
+    if (!table) {
+        reportError("Error: Table '%s' not found in database '%s'.\n", tableName, currentDatabase);
         return;
     }
 
-    Table *table = &db->tables[tableIndex];
-    for (int i = 0; i < table->rowCount; i++) {
-        for (int j = 0; j < table->columnCount; j++) {
-            if (table->columns[j].type == STRING) {
-                free(table->rows[i].strValues[j]);
-            }
-        }
-        free(table->rows[i].intValues);
-        free(table->rows[i].strValues);
-        free(table->rows[i].floatValues);
-    }
-    free(table->rows);
-    free(table->columns);
-
-    for (int i = tableIndex; i < db->tableCount - 1; i++) {
-        db->tables[i] = db->tables[i + 1];
-    }
-    db->tableCount--;
+    removeTable(db, table);
+    markDirty(db, NULL);
 
-    printf("Table '%s' deleted from database '%s'.\n", tableName, currentDatabase);
+    fprintf(commandOutput(), "Table '%s' deleted from database '%s'.\n", tableName, currentDatabase);
 }
 
 void unloadDatabase(char *dbName) {
-    int dbIndex = -1;
-    for (int i = 0; i < databaseCount; i++) {
-        if (strcmp(databases[i].name, dbName) == 0) {
-            dbIndex = i;
-            break;
-        }
-    }
-
-    if (dbIndex == -1) {
-        printf("Error: Database '%s' not found.\n", dbName);
+    Database *db = getDatabaseByName(dbName);
+    if (!db) {
+        reportError("Error: Database '%s' not found.\n", dbName);
         return;
     }
 
-    Database *db = &databases[dbIndex];
-    for (int i = 0; i < db->tableCount; i++) {
-        Table *table = &db->tables[i];
-        for (int j = 0; j < table->rowCount; j++) {
-            for (int k = 0; k < table->columnCount; k++) {
-                if (table->columns[k].type == STRING) {
-                    free(table->rows[j].strValues[k]);
-                }
-            }
-            free(table->rows[j].intValues);
-            free(table->rows[j].strValues);
-            free(table->rows[j].floatValues);
-        }
-        free(table->rows);
+    if (db->dirty) {
+        fprintf(commandOutput(), "Warning: Database '%s' has unsaved changes. They stay in its write-ahead log and are replayed when it is next loaded; run commitAll first to save them.\n", dbName);
     }
-    free(db->tables);
 
-    for (int i = dbIndex; i < databaseCount - 1; i++) {
-        databases[i] = databases[i + 1];
-    }
-    databaseCount--;
+    unregisterDatabase(db);
+    closeDatabaseWal(db);
+    freeDatabase(db);
+    free(db);
 
     if (strcmp(currentDatabase, dbName) == 0) {
         currentDatabase[0] = '\0';
     }
 
-    printf("Database '%s' unloaded.\n", dbName);
+    fprintf(commandOutput(), "Database '%s' unloaded.\n", dbName);
 }
 
 void deleteDatabase(char *dbName) {
-    int dbIndex = -1;
-    for (int i = 0; i < databaseCount; i++) {
-        if (strcmp(databases[i].name, dbName) == 0) {
-            dbIndex = i;
-            break;
-        }
-    }
-
-    if (dbIndex == -1) {
-        printf("Error: Database '%s' not found.\n", dbName);
-        return;
-    }
-
-    char confirmation;
-    printf("Are you sure you want to delete the database '%s'? (y/n): ", dbName);
-    scanf(" %c", &confirmation);
-    getchar();
-    if (confirmation != 'y' && confirmation != 'Y') {
-        printf("Database deletion canceled.\n");
+    Database *db = getDatabaseByName(dbName);
+    if (!db) {
+        reportError("Error: Database '%s' not found.\n", dbName);
         return;
     }
 
-    Database *db = &databases[dbIndex];
-    for (int i = 0; i < db->tableCount; i++) {
-        Table *table = &db->tables[i];
-        for (int j = 0; j < table->rowCount; j++) {
-            for (int k = 0; k < table->columnCount; k++) {
-                if (table->columns[k].type == STRING) {
-                    free(table->rows[j].strValues[k]);
-                }
-            }
-            free(table->rows[j].intValues);
-            free(table->rows[j].strValues);
-            free(table->rows[j].floatValues);
+    if (!batchMode) {
+        char confirmation;
+        fprintf(commandOutput(), "Are you sure you want to delete the database '%s'? (y/n): ", dbName);
+        scanf(" %c", &confirmation);
+        getchar();
+        if (confirmation != 'y' && confirmation != 'Y') {
+            fprintf(commandOutput(), "Database deletion canceled.\n");
+            return;
         }
-        free(table->rows);
     }
-    free(db->tables);
 
-    for (int i = dbIndex; i < databaseCount - 1; i++) {
-        databases[i] = databases[i + 1];
-    }
-    databaseCount--;
+    unregisterDatabase(db);
+    closeDatabaseWal(db);
+    freeDatabase(db);
+    free(db);
 
     if (strcmp(currentDatabase, dbName) == 0) {
         currentDatabase[0] = '\0';
@@ -611,315 +738,324 @@ void deleteDatabase(char *dbName) {
     char filePath[MAX_NAME_LEN + 10];
     snprintf(filePath, sizeof(filePath), "data/%s.bin", dbName);
     if (unlink(filePath) == 0) {
-        printf("File '%s' deleted successfully.\n", filePath);
+        fprintf(commandOutput(), "File '%s' deleted successfully.\n", filePath);
     } else {
-        perror("Error deleting file");
+        printSystemError("Error deleting file");
     }
+    removeWal(dbName);
 
-    printf("Database '%s' deleted.\n", dbName);
+    fprintf(commandOutput(), "Database '%s' deleted.\n", dbName);
 }
 
-void editValue(char *command) {
-    if (strlen(currentDatabase) == 0) {
-        printf("Error: No database selected.\n");
-        return;
+// Puts back the old values of the first count rows of an update and their
+// index entries. Removing an entry never allocates and a primary index
+// takes back a removed row without growing, but a B+tree insert can fail
+// on a split; the ordered index is then rebuilt, or dropped if even that
+// fails, so it never misses a row.
+static void restoreUpdatedRows(Table *table, Column *column, const int *rows, int count, const char *oldValues) {
+    size_t width = columnValueWidth(column);
+    bool ordered = true;
+    for (int i = 0; i < count; i++) {
+        int row = rows[i];
+        if (column->primaryIndex) {
+            hashIndexRemove(column->primaryIndex, column, row);
+        }
+        if (column->orderedIndex) {
+            btreeRemove(column->orderedIndex, column, row);
+        }
+        memcpy((char *)column->values + (size_t)row * width, oldValues + (size_t)i * width, width);
+        if (column->primaryIndex) {
+            hashIndexInsert(column->primaryIndex, column, row);
+        }
+        if (column->orderedIndex && ordered) {
+            ordered = btreeInsert(column->orderedIndex, column, row);
+        }
+    }
+    if (!ordered) {
+        freeBTree(column->orderedIndex);
+        column->orderedIndex = buildBTree(column, table->rowCount);
     }
+}
 
-    Database *db = getDatabaseByName(currentDatabase);
-    if (!db) {
-        printf("Error: Database '%s' not found.\n", currentDatabase);
+static void executeUpdate(Statement *statement) {
+    Database *db = statement->db;
+    Table *table = statement->table;
+    Column *targetColumn = statement->column;
+    Value newValue = statement->newValue.value;
+    bool conditionalUpdate = statement->hasCondition;
+
+    int matchCount = 0;
+    int *matches = malloc((table->rowCount > 0 ? table->rowCount : 1) * sizeof(int));
+    if (!matches) {
+        reportError("Error: Memory allocation failed while updating rows.\n");
         return;
     }
+    if (conditionalUpdate) {
+        matchCount = findMatchingRows(table, &statement->condition, matches);
+    } else {
+        for (int i = 0; i < table->rowCount; i++) {
+            matches[matchCount++] = i;
+        }
+        countStat(STAT_ROWS_SCANNED, table->rowCount);
+    }
 
-    char *tableName = strtok(command, " ");
-    Table *table = getTableByName(db, tableName);
-    if (!table) {
-        printf("Error: Table '%s' not found in database '%s'.\n", tableName, currentDatabase);
-        return;
+    if (targetColumn->primaryIndex && matchCount > 0) {
+        int existing = hashIndexFind(targetColumn->primaryIndex, targetColumn, &newValue);
+        if (matchCount > 1 || (existing >= 0 && existing != matches[0])) {
+            reportError("Error: Duplicate value for primary key '%s'.\n", targetColumn->name);
+            free(matches);
+            return;
+        }
     }
 
-    char *setClause = strtok(NULL, " ");
-    if (!setClause || strcmp(setClause, "set") != 0) {
-        printf("Error: Invalid syntax. Expected 'set' after table name.\n");
+    // The old values are kept so the update can be undone if an index entry
+    // cannot be added.
+    size_t width = columnValueWidth(targetColumn);
+    char *oldValues = malloc(matchCount > 0 ? (size_t)matchCount * width : 1);
+    if (!oldValues) {
+        reportError("Error: Memory allocation failed while updating rows.\n");
+        free(matches);
         return;
     }
-
-    char *columnName = strtok(NULL, " ");
-    char *equalsSign = strtok(NULL, " ");
-    char *newValueStr = strtok(NULL, "\"");
-    if (!columnName || !equalsSign || !newValueStr || strcmp(equalsSign, "=") != 0) {
-        printf("Error: Invalid syntax. Expected 'ColumnName = \"NewValue\"'.\n");
+    if (matchCount > 0 && !unshareColumn(targetColumn, table->maxRows)) {
+        free(oldValues);
+        free(matches);
         return;
     }
-
-    int targetColumnIndex = -1;
-    for (int i = 0; i < table->columnCount; i++) {
-        if (strcmp(table->columns[i].name, columnName) == 0) {
-            targetColumnIndex = i;
-            break;
+    int updated = 0;
+    bool indexed = true;
+    for (; indexed && updated < matchCount; updated++) {
+        int row = matches[updated];
+        memcpy(oldValues + (size_t)updated * width, (char *)targetColumn->values + (size_t)row * width, width);
+        if (targetColumn->primaryIndex) {
+            hashIndexRemove(targetColumn->primaryIndex, targetColumn, row);
+        }
+        if (targetColumn->orderedIndex) {
+            btreeRemove(targetColumn->orderedIndex, targetColumn, row);
+        }
+        setValue(targetColumn, row, &newValue);
+        if (targetColumn->primaryIndex) {
+            indexed = hashIndexInsert(targetColumn->primaryIndex, targetColumn, row);
+        }
+        if (indexed && targetColumn->orderedIndex) {
+            indexed = btreeInsert(targetColumn->orderedIndex, targetColumn, row);
         }
     }
-    if (targetColumnIndex == -1) {
-        printf("Error: Column '%s' not found in table '%s'.\n", columnName, table->tableName);
+    if (!indexed) {
+        restoreUpdatedRows(table, targetColumn, matches, updated, oldValues);
+    }
+    free(oldValues);
+    free(matches);
+    if (!indexed) {
+        reportError("Error: Column '%s' was not updated in table '%s': its index could not be updated.\n",
+                    targetColumn->name, table->tableName);
         return;
     }
+    markDirty(db, table);
+    countStat(STAT_ROWS_MODIFIED, updated);
 
-    Column *targetColumn = &table->columns[targetColumnIndex];
-    int intValue;
-    float floatValue;
-    char strValue[MAX_NAME_LEN];
-
-    if (targetColumn->type == INT) {
-        intValue = atoi(newValueStr);
-    } else if (targetColumn->type == FLOAT) {
-        floatValue = atof(newValueStr);
-    } else if (targetColumn->type == STRING) {
-        strncpy(strValue, newValueStr, targetColumn->stringSize);
-    }
+    fprintf(commandOutput(), "Column '%s' updated in table '%s'.\n", targetColumn->name, table->tableName);
+}
 
-    char *ifClause = strtok(NULL, " ");
-    int conditionalUpdate = (ifClause && strcmp(ifClause, "if") == 0);
-    int conditionColumnIndex = -1;
-    int conditionIntValue;
-    float conditionFloatValue;
-    char conditionStrValue[MAX_NAME_LEN];
+// Matches names ending in ".bin", skipping temporary files left by a save.
+static bool isDatabaseFile(const char *fileName) {
+    size_t length = strlen(fileName);
+    return length > 4 && strcmp(fileName + length - 4, ".bin") == 0;
+}
 
-    if (conditionalUpdate) {
-        char *conditionColumn = strtok(NULL, " ");
-        char *conditionEquals = strtok(NULL, " ");
-        char *conditionValue = strtok(NULL, "\"");
-        if (!conditionColumn || !conditionEquals || !conditionValue || strcmp(conditionEquals, "==") != 0) {
-            printf("Error: Invalid syntax in 'if' clause. Expected 'if ColumnName == \"Value\"'.\n");
-            return;
-        }
+// Runs a logged command against db with its output, errors included, sent
+// to output.
+static void replayCommand(Database *db, char *command, FILE *output) {
+    char savedDatabase[MAX_NAME_LEN];
+    strncpy(savedDatabase, currentDatabase, MAX_NAME_LEN);
+    strncpy(currentDatabase, db->name, MAX_NAME_LEN);
 
-        for (int i = 0; i < table->columnCount; i++) {
-            if (strcmp(table->columns[i].name, conditionColumn) == 0) {
-                conditionColumnIndex = i;
-                break;
-            }
-        }
-        if (conditionColumnIndex == -1) {
-            printf("Error: Condition column '%s' not found in table '%s'.\n", conditionColumn, table->tableName);
-            return;
-        }
+    FILE *savedOutput = commandOutput();
+    setCommandOutput(output);
+    runMutation(command);
+    setCommandOutput(savedOutput);
 
-        Column *conditionColumnType = &table->columns[conditionColumnIndex];
-        if (conditionColumnType->type == INT) {
-            conditionIntValue = atoi(conditionValue);
-        } else if (conditionColumnType->type == FLOAT) {
-            conditionFloatValue = atof(conditionValue);
-        } else if (conditionColumnType->type == STRING) {
-            strncpy(conditionStrValue, conditionValue, conditionColumnType->stringSize);
-        }
-    }
+    strncpy(currentDatabase, savedDatabase, MAX_NAME_LEN);
+}
 
-    for (int i = 0; i < table->rowCount; i++) {
-        int updateRow = 1;
+static Database *replayingDatabase;
+static FILE *replayOutput;
 
-        if (conditionalUpdate) {
-            Column *condCol = &table->columns[conditionColumnIndex];
-            if (condCol->type == INT && table->rows[i].intValues[conditionColumnIndex] != conditionIntValue) {
-                updateRow = 0;
-            } else if (condCol->type == FLOAT && table->rows[i].floatValues[conditionColumnIndex] != conditionFloatValue) {
-                updateRow = 0;
-            } else if (condCol->type == STRING && strcmp(table->rows[i].strValues[conditionColumnIndex], conditionStrValue) != 0) {
-                updateRow = 0;
-            }
-        }
+static void replayLoggedCommand(char *command) {
+    replayCommand(replayingDatabase, command, replayOutput);
+}
 
-        if (updateRow) {
-            if (targetColumn->type == INT) {
-                table->rows[i].intValues[targetColumnIndex] = intValue;
-            } else if (targetColumn->type == FLOAT) {
-                table->rows[i].floatValues[targetColumnIndex] = floatValue;
-            } else if (targetColumn->type == STRING) {
-                strncpy(table->rows[i].strValues[targetColumnIndex], strValue, targetColumn->stringSize);
-            }
-        }
+// Applies the commands logged for db since its file was last saved, without
+// showing their output.
+static void replayWal(const char *dbName) {
+    replayingDatabase = getDatabaseByName(dbName);
+    if (!replayingDatabase) {
+        return;
+    }
+    // Without /dev/null the output is shown rather than the log skipped.
+    FILE *devNull = fopen("/dev/null", "w");
+    replayOutput = devNull ? devNull : commandOutput();
+    int replayed = walReplay(dbName, &replayingDatabase->walSequence, replayLoggedCommand);
+    if (devNull) {
+        fclose(devNull);
+    }
+    replayOutput = NULL;
+    if (replayed > 0) {
+        fprintf(commandOutput(), "Replayed %d logged command(s) for database '%s'.\n", replayed, dbName);
+    } else if (replayed < 0) {
+        reportError("Error: Could not replay the write-ahead log of database '%s'.\n", dbName);
     }
+}
 
-    printf("Column '%s' updated in table '%s'.\n", columnName, table->tableName);
+// Recreates a database that was created but never saved from its log alone.
+static void recoverDatabase(const char *dbName) {
+    if (getDatabaseByName(dbName)) {
+        return;
+    }
+    Database *db = calloc(1, sizeof(Database));
+    if (!db) {
+        reportError("Error: Memory allocation failed while recovering database '%s'.\n", dbName);
+        return;
+    }
+    strncpy(db->name, dbName, MAX_NAME_LEN - 1);
+    db->dirty = true;
+    if (!registerDatabase(db)) {
+        free(db);
+        return;
+    }
+    fprintf(commandOutput(), "Recovering unsaved database '%s' from its write-ahead log.\n", dbName);
+    replayWal(dbName);
 }
 
-void saveDatabaseToFile() {
-    for (int i = 0; i < databaseCount; i++) {
-        char fileName[MAX_NAME_LEN + 10];
-        snprintf(fileName, sizeof(fileName), "data/%s.bin", databases[i].name);
-        printf("Attempting to save database to file: %s\n", fileName);
-        FILE *file = fopen(fileName, "wb");
-        if (!file) {
-            perror("Error opening file for saving");
-            continue;
+// Appends a command that changed the current database to its log. Returns
+// false if it could not be logged.
+static bool logMutation(const char *command) {
+    Database *db = getDatabaseByName(currentDatabase);
+    if (!db) {
+        return true;
+    }
+    if (!db->wal) {
+        db->wal = openWal(db->name);
+        if (!db->wal) {
+            return false;
         }
+    }
+    if (!walAppend(db->wal, db->walSequence + 1, command)) {
+        return false;
+    }
+    db->walSequence++;
+    return true;
+}
 
-        int singleDatabaseCount = 1;
-        fwrite(&singleDatabaseCount, sizeof(int), 1, file);
-
-        fwrite(databases[i].name, sizeof(char), MAX_NAME_LEN, file);
-        
-        fwrite(&databases[i].tableCount, sizeof(int), 1, file);
-
-        for (int j = 0; j < databases[i].tableCount; j++) {
-            Table *table = &databases[i].tables[j];
-
-            fwrite(table->tableName, sizeof(char), MAX_NAME_LEN, file);
-
-            fwrite(&table->columnCount, sizeof(int), 1, file);
-
-            for (int k = 0; k < table->columnCount; k++) {
-                Column *column = &table->columns[k];
-                fwrite(column, sizeof(Column), 1, file);
-
-                fwrite(&column->isPrimaryKey, sizeof(int), 1, file);
-                fwrite(&column->isRequired, sizeof(int), 1, file);
-            }
+// Writes db to data/<name>.bin and empties its write-ahead log, which the
+// file now covers. If the log cannot be emptied its records are still
+// skipped on the next load, since the file holds their sequence numbers.
+static bool saveDatabase(Database *db) {
+    char fileName[MAX_NAME_LEN + 10];
+    snprintf(fileName, sizeof(fileName), "data/%s.bin", db->name);
+    if (!writeDatabaseFile(db, fileName)) {
+        return false;
+    }
+    if (db->wal) {
+        return walReset(db->wal);
+    }
+    removeWal(db->name);
+    return true;
+}
 
-            fwrite(&table->rowCount, sizeof(int), 1, file);
-
-            for (int r = 0; r < table->rowCount; r++) {
-                for (int c = 0; c < table->columnCount; c++) {
-                    Column *col = &table->columns[c];
-                    if (col->type == INT) {
-                        fwrite(&table->rows[r].intValues[c], sizeof(int), 1, file);
-                    } else if (col->type == FLOAT) {
-                        fwrite(&table->rows[r].floatValues[c], sizeof(float), 1, file);
-                    } else if (col->type == STRING) {
-                        fwrite(table->rows[r].strValues[c], sizeof(char), col->stringSize, file);
-                    }
-                }
+// Saves every database changed since it was last loaded or saved.
+void saveDatabaseToFile() {
+    for (int i = 0; i < databaseCount; i++) {
+        if (!databases[i]->dirty) {
+            if (databases[i]->wal) {
+                walReset(databases[i]->wal);
             }
+            fprintf(commandOutput(), "Database '%s' has no unsaved changes.\n", databases[i]->name);
+            continue;
+        }
+        fprintf(commandOutput(), "Attempting to save database to file: data/%s.bin\n", databases[i]->name);
+        if (saveDatabase(databases[i])) {
+            fprintf(commandOutput(), "Database '%s' saved to file 'data/%s.bin'.\n", databases[i]->name, databases[i]->name);
         }
-
-        fclose(file);
-        printf("Database '%s' saved to file '%s'.\n", databases[i].name, fileName);
     }
 }
 
-void loadDatabaseFromFile(const char *database_file) {
-    char filePath[MAX_NAME_LEN + 10];
-    snprintf(filePath, sizeof(filePath), "data/%s", database_file);
-
-    FILE *file = fopen(filePath, "rb");
-    if (!file) {
-        printf("Error: Could not open file '%s' for loading. A new database will be created.\n", database_file);
-        return;
+static bool reserveDatabases(int count) {
+    if (count <= maxDatabases) {
+        return true;
     }
-
-    int fileDatabaseCount;
-    if (fread(&fileDatabaseCount, sizeof(int), 1, file) != 1) {
-        printf("Error: Could not read database count in file '%s'.\n", database_file);
-        fclose(file);
-        return;
+    Database **grown = realloc(databases, count * sizeof(Database *));
+    if (!grown) {
+        reportError("Error: Memory allocation failed for databases.\n");
+        return false;
     }
+    databases = grown;
+    maxDatabases = count;
+    return true;
+}
 
-    databases = realloc(databases, (databaseCount + fileDatabaseCount) * sizeof(Database));
-    if (!databases) {
-        printf("Error: Memory allocation failed for databases.\n");
-        fclose(file);
+// Adds the databases read from database_file to the catalog and replays
+// anything logged for them since they were saved.
+static void addLoadedDatabases(const char *database_file, Database *loaded, int fileDatabaseCount, int version) {
+    if (!reserveDatabases(databaseCount + fileDatabaseCount)) {
+        for (int i = 0; i < fileDatabaseCount; i++) {
+            freeDatabase(&loaded[i]);
+        }
+        free(loaded);
         return;
     }
 
     for (int i = 0; i < fileDatabaseCount; i++) {
-        Database *db = &databases[databaseCount + i];
-
-        if (fread(db->name, sizeof(char), MAX_NAME_LEN, file) != MAX_NAME_LEN) {
-            printf("Error: Could not read database name for database %d in file '%s'.\n", i, database_file);
-            fclose(file);
-            return;
+        Database *db = malloc(sizeof(Database));
+        if (!db) {
+            reportError("Error: Memory allocation failed for database '%s'.\n", loaded[i].name);
+            freeDatabase(&loaded[i]);
+            loaded[i].name[0] = '\0';
+            continue;
         }
-        printf("Loaded database name: %s\n", db->name);
-
-        if (fread(&db->tableCount, sizeof(int), 1, file) != 1) {
-            printf("Error: Could not read table count for database %s.\n", db->name);
-            fclose(file);
-            return;
+        *db = loaded[i];
+        if (!registerDatabase(db)) {
+            freeDatabase(db);
+            free(db);
+            loaded[i].name[0] = '\0';
+            continue;
         }
-
-        db->tables = malloc(db->tableCount * sizeof(Table));
-        if (!db->tables) {
-            printf("Error: Memory allocation failed for tables in database %s.\n", db->name);
-            fclose(file);
-            return;
+        fprintf(commandOutput(), "Loaded database name: %s (%d tables)\n", db->name, db->tableCount);
+    }
+    for (int i = 0; i < fileDatabaseCount; i++) {
+        if (loaded[i].name[0] != '\0') {
+            replayWal(loaded[i].name);
         }
+    }
+    free(loaded);
 
-        for (int j = 0; j < db->tableCount; j++) {
-            Table *table = &db->tables[j];
-
-            if (fread(table->tableName, sizeof(char), MAX_NAME_LEN, file) != MAX_NAME_LEN) {
-                printf("Error: Could not read table name for table %d in database %s.\n", j, db->name);
-                fclose(file);
-                return;
-            }
-            printf("Loaded table name: %s\n", table->tableName);
-
-            if (fread(&table->columnCount, sizeof(int), 1, file) != 1) {
-                printf("Error: Could not read column count for table %s in database %s.\n", table->tableName, db->name);
-                fclose(file);
-                return;
-            }
-
-            table->columns = malloc(table->columnCount * sizeof(Column));
-            if (!table->columns) {
-                printf("Error: Memory allocation failed for columns in table %s.\n", table->tableName);
-                fclose(file);
-                return;
-            }
-
-            for (int k = 0; k < table->columnCount; k++) {
-                Column *column = &table->columns[k];
-                if (fread(column, sizeof(Column), 1, file) != 1) {
-                    printf("Error: Could not read column data for column %d in table %s of database %s.\n", k, table->tableName, db->name);
-                    fclose(file);
-                    return;
-                }
-
-                if (fread(&column->isPrimaryKey, sizeof(int), 1, file) != 1 ||
-                    fread(&column->isRequired, sizeof(int), 1, file) != 1) {
-                    printf("Error: Could not read primaryKey or isRequired for column %d in table %s.\n", k, table->tableName);
-                    fclose(file);
-                    return;
-                }
-                printf("Loaded column name: %s, type: %d, primaryKey: %d, isRequired: %d\n", column->name, column->type, column->isPrimaryKey, column->isRequired);
-            }
-
-            if (fread(&table->rowCount, sizeof(int), 1, file) != 1) {
-                printf("Error: Could not read row count for table %s in database %s.\n", table->tableName, db->name);
-                fclose(file);
-                return;
-            }
-            table->maxRows = table->rowCount;
+    if (version < DBFILE_VERSION) {
+        fprintf(commandOutput(), "Note: '%s' uses format version %d and will be rewritten as version %d on the next commit.\n", database_file, version, DBFILE_VERSION);
+    }
+    fprintf(commandOutput(), "Database loaded from '%s'.\n", database_file);
+}
 
-            table->rows = malloc(table->rowCount * sizeof(RowData));
-            if (!table->rows) {
-                printf("Error: Memory allocation failed for rows in table %s of database %s.\n", table->tableName, db->name);
-                fclose(file);
-                return;
-            }
+void loadDatabaseFromFile(const char *database_file) {
+    char filePath[MAX_NAME_LEN + 10];
+    snprintf(filePath, sizeof(filePath), "data/%s", database_file);
 
-            for (int r = 0; r < table->rowCount; r++) {
-                table->rows[r].intValues = malloc(table->columnCount * sizeof(int));
-                table->rows[r].strValues = malloc(table->columnCount * sizeof(char *));
-                table->rows[r].floatValues = malloc(table->columnCount * sizeof(float));
-
-                for (int c = 0; c < table->columnCount; c++) {
-                    Column *col = &table->columns[c];
-                    if (col->type == INT) {
-                        fread(&table->rows[r].intValues[c], sizeof(int), 1, file);
-                    } else if (col->type == FLOAT) {
-                        fread(&table->rows[r].floatValues[c], sizeof(float), 1, file);
-                    } else if (col->type == STRING) {
-                        table->rows[r].strValues[c] = malloc(col->stringSize * sizeof(char));
-                        fread(table->rows[r].strValues[c], sizeof(char), col->stringSize, file);
-                    }
-                }
-            }
+    if (access(filePath, R_OK) != 0) {
+        char dbName[MAX_NAME_LEN];
+        snprintf(dbName, sizeof(dbName), "%.*s", (int)(strlen(database_file) - 4), database_file);
+        if (isDatabaseFile(database_file) && walExists(dbName)) {
+            recoverDatabase(dbName);
+            return;
         }
+        reportError("Error: Could not open file '%s' for loading. A new database will be created.\n", database_file);
+        return;
     }
 
-    databaseCount += fileDatabaseCount;
-    fclose(file);
-    printf("Database loaded from '%s'.\n", database_file);
+    Database *loaded;
+    int version;
+    int fileDatabaseCount = readDatabaseFile(filePath, &loaded, &version);
+    if (fileDatabaseCount >= 0) {
+        addLoadedDatabases(database_file, loaded, fileDatabaseCount, version);
+    }
 }
 
 void loadDatabase(char *databaseName) {
@@ -929,25 +1065,95 @@ void loadDatabase(char *databaseName) {
     useDatabase(databaseName);
 }
 
+typedef struct {
+    char fileName[256];
+    Database *loaded;
+    int count;
+    int version;
+} LoadJob;
+
+static void runLoadJob(void *context, int index) {
+    LoadJob *job = &((LoadJob *)context)[index];
+    char filePath[sizeof(job->fileName) + 8];
+    snprintf(filePath, sizeof(filePath), "data/%s", job->fileName);
+    job->count = readDatabaseFile(filePath, &job->loaded, &job->version);
+}
+
+static int compareLoadJobs(const void *a, const void *b) {
+    return strcmp(((const LoadJob *)a)->fileName, ((const LoadJob *)b)->fileName);
+}
+
+// Reads every database file in data/ on the worker threads, then adds the
+// results to the catalog in file name order on this thread.
 void loadAllDatabases() {
     DIR *dir;
     struct dirent *entry;
 
     dir = opendir("data");
     if (!dir) {
-        perror("Error opening directory");
+        printSystemError("Error opening directory");
         return;
     }
 
+    LoadJob *jobs = NULL;
+    int jobCount = 0, jobCapacity = 0;
     while ((entry = readdir(dir)) != NULL) {
-        if (strstr(entry->d_name, ".bin") != NULL) {
-            printf("Loading database from file: %s\n", entry->d_name);
-            loadDatabaseFromFile(entry->d_name);
+        if (isDatabaseFile(entry->d_name)) {
+            if (jobCount == jobCapacity) {
+                int capacity = jobCapacity ? jobCapacity * 2 : 16;
+                LoadJob *grown = realloc(jobs, capacity * sizeof(LoadJob));
+                if (!grown) {
+                    reportError("Error: Memory allocation failed while loading databases.\n");
+                    free(jobs);
+                    closedir(dir);
+                    return;
+                }
+                jobs = grown;
+                jobCapacity = capacity;
+            }
+            LoadJob *job = &jobs[jobCount++];
+            snprintf(job->fileName, sizeof(job->fileName), "%s", entry->d_name);
+            job->loaded = NULL;
+            job->count = -1;
+            job->version = 0;
+        }
+    }
+    if (jobCount > 1) {
+        qsort(jobs, jobCount, sizeof(LoadJob), compareLoadJobs);
+    }
+
+    runParallel(jobCount, runLoadJob, jobs);
+
+    int total = databaseCount;
+    for (int i = 0; i < jobCount; i++) {
+        total += jobs[i].count > 0 ? jobs[i].count : 0;
+    }
+    reserveDatabases(total);
+    for (int i = 0; i < jobCount; i++) {
+        fprintf(commandOutput(), "Loading database from file: %s\n", jobs[i].fileName);
+        if (jobs[i].count >= 0) {
+            addLoadedDatabases(jobs[i].fileName, jobs[i].loaded, jobs[i].count, jobs[i].version);
+        }
+    }
+    free(jobs);
+
+    // Databases that were never saved exist only as a log.
+    rewinddir(dir);
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length > 4 && length - 4 < MAX_NAME_LEN && strcmp(entry->d_name + length - 4, ".wal") == 0) {
+            char dbName[MAX_NAME_LEN];
+            snprintf(dbName, sizeof(dbName), "%.*s", (int)(length - 4), entry->d_name);
+            char binPath[MAX_NAME_LEN + 10];
+            snprintf(binPath, sizeof(binPath), "data/%s.bin", dbName);
+            if (access(binPath, F_OK) != 0 && walExists(dbName)) {
+                recoverDatabase(dbName);
+            }
         }
     }
 
     closedir(dir);
-    printf("\nAll databases loaded.\n");
+    fprintf(commandOutput(), "\nAll databases loaded.\n");
 }
 
 void listDatabases() {
@@ -956,13 +1162,13 @@ void listDatabases() {
 
     dir = opendir("data");
     if (!dir) {
-        perror("Error opening directory");
+        printSystemError("Error opening directory");
         return;
     }
-    printf("\nDatabase List:\n");
-    printf("--------------\n");
+    fprintf(commandOutput(), "\nDatabase List:\n");
+    fprintf(commandOutput(), "--------------\n");
     while ((entry = readdir(dir)) != NULL) {
-        if (strstr(entry->d_name, ".bin") != NULL) {
+        if (isDatabaseFile(entry->d_name)) {
             char dbName[256];
             strncpy(dbName, entry->d_name, sizeof(dbName) - 1);
             dbName[sizeof(dbName) - 1] = '\0';
@@ -971,176 +1177,328 @@ void listDatabases() {
                 *extPos = '\0';
             }
 
-            printf("- %s\n", dbName);
+            fprintf(commandOutput(), "- %s\n", dbName);
         }
     }
 
     closedir(dir);
-    printf("--------------\n");
+    fprintf(commandOutput(), "--------------\n");
 }
 
-void deleteValue(char *command) {
-    if (strlen(currentDatabase) == 0) {
-        printf("Error: No database selected. Use 'useDatabase' first.\n");
+static void executeDelete(Statement *statement) {
+    Database *db = statement->db;
+    Table *table = statement->table;
+    Condition *condition = &statement->condition;
+
+    uint64_t *selection = calloc(SELECTION_WORDS(table->rowCount) + 1, sizeof(uint64_t));
+    if (!selection) {
+        reportError("Error: Memory allocation failed while deleting rows.\n");
         return;
     }
+    int deletedRows = markMatchingRows(table, condition, selection);
+    if (deletedRows > 0) {
+        if (!deleteSelectedRows(table, selection)) {
+            free(selection);
+            return;
+        }
+        markDirty(db, table);
+        countStat(STAT_ROWS_MODIFIED, deletedRows);
+    }
+    free(selection);
 
-    char *tableName = strtok(command, " ");
-    if (!tableName) {
-        printf("Error: Invalid syntax. Usage: deleteValue TableName if ColumnName == Value\n");
+    char description[3 * MAX_NAME_LEN];
+    describeCondition(condition, description, sizeof(description));
+    if (deletedRows > 0) {
+        fprintf(commandOutput(), "%d row(s) deleted from table '%s' where %s.\n", deletedRows, table->tableName, description);
+    } else {
+        fprintf(commandOutput(), "No rows found in table '%s' where %s.\n", table->tableName, description);
+    }
+}
+
+static void executeStatement(Statement *statement) {
+    switch (statement->kind) {
+        case STMT_INSERT: executeInsert(statement); break;
+        case STMT_UPDATE: executeUpdate(statement); break;
+        case STMT_DELETE: executeDelete(statement); break;
+        case STMT_DISPLAY: executeDisplay(statement); break;
+        case STMT_SELECT: executeSelect(statement); break;
+    }
+}
+
+// Parses, resolves and runs one insertValues, editValue, deleteValue,
+// displayTable or select command against the current database.
+static void runStatement(const char *command) {
+    Statement statement;
+    if (!parseStatement(command, &statement)) {
         return;
     }
+    if (statement.parameterCount > 0) {
+        reportError("Error: '?' placeholders are only allowed in prepared statements.\n");
+    } else if (resolveStatement(&statement, getDatabaseByName(currentDatabase))) {
+        executeStatement(&statement);
+    }
+    freeStatement(&statement);
+}
 
-    char *ifKeyword = strtok(NULL, " ");
-    if (!ifKeyword || strcmp(ifKeyword, "if") != 0) {
-        printf("Error: Invalid syntax. Missing 'if' keyword.\n");
+typedef struct {
+    char name[MAX_NAME_LEN];
+    Statement statement;
+} PreparedStatement;
+
+// Prepared statements by name. They are resolved on first use and again
+// whenever the catalog has changed since, e.g. after editTable.
+static NameMap preparedStatements;
+
+static void freePreparedStatement(PreparedStatement *prepared) {
+    nameMapRemove(&preparedStatements, prepared->name);
+    freeStatement(&prepared->statement);
+    free(prepared);
+}
+
+// prepare Name AS Command
+void prepareStatement(char *command) {
+    char *name = strtok(command, " ");
+    char *asKeyword = strtok(NULL, " ");
+    char *text = strtok(NULL, "");
+    if (!name || !asKeyword || !text || strcasecmp(asKeyword, "AS") != 0) {
+        reportError("Error: Invalid syntax. Usage: prepare Name AS Command\n");
+        return;
+    }
+    if (strlen(name) >= MAX_NAME_LEN) {
+        reportError("Error: Statement name '%s' is too long.\n", name);
         return;
     }
 
-    char *columnName = strtok(NULL, " ");
-    if (!columnName) {
-        printf("Error: Invalid syntax. Missing column name.\n");
+    PreparedStatement *prepared = calloc(1, sizeof(PreparedStatement));
+    if (!prepared) {
+        reportError("Error: Memory allocation failed for statement '%s'.\n", name);
         return;
     }
+    strcpy(prepared->name, name);
+    if (!parseStatement(text, &prepared->statement)) {
+        free(prepared);
+        return;
+    }
+
+    PreparedStatement *existing = nameMapFind(&preparedStatements, name);
+    if (existing) {
+        freePreparedStatement(existing);
+    }
+    nameMapInsert(&preparedStatements, prepared->name, prepared);
+    fprintf(commandOutput(), "Statement '%s' prepared with %d parameter(s).\n", name, prepared->statement.parameterCount);
+}
 
-    char *equalOperator = strtok(NULL, " ");
-    if (!equalOperator || strcmp(equalOperator, "==") != 0) {
-        printf("Error: Invalid syntax. Use '==' to specify the condition.\n");
+// Collects the arguments of 'Name(Argument, ...)', each a word or a quoted
+// string.
+static bool readArguments(const TokenList *tokens, char **arguments, int *argumentCount) {
+    const Token *token = tokens->tokens;
+    *argumentCount = 0;
+    if (token->type != TOKEN_WORD || !tokenIs(++token, TOKEN_SYMBOL, "(")) {
+        return false;
+    }
+    token++;
+    if (!tokenIs(token, TOKEN_SYMBOL, ")")) {
+        while (1) {
+            if (token->type != TOKEN_WORD && token->type != TOKEN_STRING) {
+                return false;
+            }
+            arguments[(*argumentCount)++] = (token++)->text;
+            if (tokenIs(token, TOKEN_SYMBOL, ")")) {
+                break;
+            }
+            if (!tokenIs(token++, TOKEN_SYMBOL, ",")) {
+                return false;
+            }
+        }
+    }
+    return (token + 1)->type == TOKEN_END;
+}
+
+// execute Name(Argument, ...). Mutations are logged with their arguments
+// substituted, so replaying the log does not depend on prepared statements.
+void executePrepared(char *command) {
+    TokenList tokens;
+    if (!tokenize(command, &tokens)) {
         return;
     }
 
-    char *valueStr = strtok(NULL, " ");
-    if (!valueStr) {
-        printf("Error: Invalid syntax. Missing value to match.\n");
+    const char *name = tokens.tokens[0].text;
+    char *arguments[tokens.count];
+    int argumentCount;
+    if (!readArguments(&tokens, arguments, &argumentCount)) {
+        reportError("Error: Invalid syntax. Usage: execute Name(Argument, ...)\n");
+        freeTokenList(&tokens);
         return;
     }
 
-    bool isStringValue = valueStr[0] == '"' && valueStr[strlen(valueStr) - 1] == '"';
-    if (isStringValue) {
-        valueStr[strlen(valueStr) - 1] = '\0';
-        valueStr++;
+    PreparedStatement *prepared = nameMapFind(&preparedStatements, name);
+    if (!prepared) {
+        reportError("Error: Prepared statement '%s' not found.\n", name);
+        freeTokenList(&tokens);
+        return;
+    }
+
+    Statement *statement = &prepared->statement;
+    Database *db = getDatabaseByName(currentDatabase);
+    if ((isResolved(statement, db) || resolveStatement(statement, db)) &&
+        bindParameters(statement, arguments, argumentCount)) {
+        if (!isMutatingStatement(statement)) {
+            executeStatement(statement);
+        } else {
+            char *logged = renderStatement(statement, arguments);
+            unsigned long errors = threadReportedErrors();
+            executeStatement(statement);
+            if (threadReportedErrors() == errors && (!logged || !logMutation(logged))) {
+                reportError("Error: The command ran but could not be logged; commit to keep its changes.\n");
+            }
+            free(logged);
+        }
+    }
+    freeTokenList(&tokens);
+}
+
+void deallocateStatement(char *name) {
+    PreparedStatement *prepared = nameMapFind(&preparedStatements, name);
+    if (!prepared) {
+        reportError("Error: Prepared statement '%s' not found.\n", name);
+        return;
+    }
+    freePreparedStatement(prepared);
+    fprintf(commandOutput(), "Statement '%s' deallocated.\n", name);
+}
+
+void createIndex(char *command) {
+    char *tableName = strtok(command, " ");
+    char *columnName = strtok(NULL, " ");
+    if (!tableName || !columnName) {
+        reportError("Error: Invalid syntax. Usage: createIndex TableName ColumnName\n");
+        return;
     }
 
     Database *db = getDatabaseByName(currentDatabase);
     if (!db) {
-        printf("Error: Database '%s' does not exist.\n", currentDatabase);
+        reportError("Error: No database selected or database not found.\n");
         return;
     }
 
     Table *table = getTableByName(db, tableName);
     if (!table) {
-        printf("Error: Table '%s' not found in database '%s'.\n", tableName, currentDatabase);
+        reportError("Error: Table '%s' not found in database '%s'.\n", tableName, currentDatabase);
         return;
     }
 
-    int columnIndex = -1;
-    DataType columnType;
-    for (int i = 0; i < table->columnCount; i++) {
-        if (strcmp(table->columns[i].name, columnName) == 0) {
-            columnIndex = i;
-            columnType = table->columns[i].type;
-            break;
-        }
+    Column *column = findColumn(table, columnName);
+    if (!column) {
+        reportError("Error: Column '%s' not found in table '%s'.\n", columnName, tableName);
+        return;
     }
-
-    if (columnIndex == -1) {
-        printf("Error: Column '%s' not found in table '%s'.\n", columnName, tableName);
+    if (column->orderedIndex) {
+        reportError("Error: Column '%s' of table '%s' is already indexed.\n", columnName, tableName);
         return;
     }
 
-    int intValue;
-    float floatValue;
-    char strValue[MAX_NAME_LEN];
+    column->orderedIndex = buildBTree(column, table->rowCount);
+    if (column->orderedIndex) {
+        markDirty(db, NULL);
+        fprintf(commandOutput(), "Index created on column '%s' of table '%s'.\n", columnName, tableName);
+    }
+}
 
-    if (columnType == INT) {
-        intValue = atoi(valueStr);
-    } else if (columnType == FLOAT) {
-        floatValue = atof(valueStr);
-    } else if (columnType == STRING) {
-        strncpy(strValue, valueStr, MAX_NAME_LEN);
-    } else {
-        printf("Error: Unsupported data type in condition.\n");
+void dropIndex(char *command) {
+    char *tableName = strtok(command, " ");
+    char *columnName = strtok(NULL, " ");
+    if (!tableName || !columnName) {
+        reportError("Error: Invalid syntax. Usage: dropIndex TableName ColumnName\n");
         return;
     }
 
-    int deletedRows = 0;
-    for (int row = 0; row < table->rowCount; row++) {
-        bool match = false;
-
-        if (columnType == INT && table->rows[row].intValues[columnIndex] == intValue) {
-            match = true;
-        } else if (columnType == FLOAT && table->rows[row].floatValues[columnIndex] == floatValue) {
-            match = true;
-        } else if (columnType == STRING && strcmp(table->rows[row].strValues[columnIndex], strValue) == 0) {
-            match = true;
-        }
+    Database *db = getDatabaseByName(currentDatabase);
+    if (!db) {
+        reportError("Error: No database selected or database not found.\n");
+        return;
+    }
 
-        if (match) {
-            for (int j = row; j < table->rowCount - 1; j++) {
-                table->rows[j] = table->rows[j + 1];
-            }
-            table->rowCount--;
-            deletedRows++;
-            row--;
-        }
+    Table *table = getTableByName(db, tableName);
+    if (!table) {
+        reportError("Error: Table '%s' not found in database '%s'.\n", tableName, currentDatabase);
+        return;
     }
 
-    if (deletedRows > 0) {
-        printf("%d row(s) deleted from table '%s' where '%s' == '%s'.\n", deletedRows, tableName, columnName, isStringValue ? strValue : valueStr);
-    } else {
-        printf("No rows found in table '%s' where '%s' == '%s'.\n", tableName, columnName, isStringValue ? strValue : valueStr);
+    Column *column = findColumn(table, columnName);
+    if (!column) {
+        reportError("Error: Column '%s' not found in table '%s'.\n", columnName, tableName);
+        return;
     }
+    if (!column->orderedIndex) {
+        reportError("Error: Column '%s' of table '%s' has no index.\n", columnName, tableName);
+        return;
+    }
+    freeBTree(column->orderedIndex);
+    column->orderedIndex = NULL;
+    markDirty(db, NULL);
+    fprintf(commandOutput(), "Index dropped from column '%s' of table '%s'.\n", columnName, tableName);
 }
 
 void listTables() {
     if (strlen(currentDatabase) == 0) {
-        printf("Error: No database selected. Use 'useDatabase' first.\n");
+        reportError("Error: No database selected. Use 'useDatabase' first.\n");
         return;
     }
 
     Database *db = getDatabaseByName(currentDatabase);
     if (!db) {
-        printf("Error: Database '%s' does not exist.\n", currentDatabase);
+        reportError("Error: Database '%s' does not exist.\n", currentDatabase);
         return;
     }
 
     if (db->tableCount == 0) {
-        printf("No tables found in database '%s'.\n", currentDatabase);
+        fprintf(commandOutput(), "No tables found in database '%s'.\n", currentDatabase);
         return;
     }
 
-    printf("\nTable list of database: '%s':\n", currentDatabase);
-    printf("---------------------------------\n");
+    fprintf(commandOutput(), "\nTable list of database: '%s':\n", currentDatabase);
+    fprintf(commandOutput(), "---------------------------------\n");
     for (int i = 0; i < db->tableCount; i++) {
-        printf("- %s\n", db->tables[i].tableName);
+        fprintf(commandOutput(), "- %s\n", db->tables[i]->tableName);
     }
-    printf("---------------------------------\n");
+    fprintf(commandOutput(), "---------------------------------\n");
 }
 
 void help(){
-    printf("\n------------------------------------------------------------ Help Menu ------------------------------------------------------------\n");
-    printf("Available commands:\n");
-    printf("\ncreateDatabase DatabaseName  -  Creates a database with a specified name and by default switches to the database.\n");
-    printf("\nuseDatabase DatabaseName  -  Select a database to use\n");
-    printf("\nlistDatabases  -  Shows the list of saved/loadable databases.\n");
-    printf("\ncreateTable TableName[ColumnName datatype, ...]  -  Creates a table within a database.\nNote: for string datatypes: string{length}\n");
-    printf("\nlistTables  -  Shows a list of tables in the currently selected database.\n");
-    printf("\ninsertValues TableName(Value, ...)  -  Appends a value to a specified table.\nNote: for string put the value in \"\".\n");
-    printf("\ndisplayTable TableName  -  Displays a specified table.\n");
-    printf("\ndeleteValue TableName if ColumnName == Value  -  Deletes a value from a specified table.\nNote: Value should be in \"\" if string.\n");
-    printf("\neditTable TableName addColumn/removeColumn ColumnName Datatype  -  Adds or removes a column in a specified table.\nNote: Datatype required only when adding.\n");
-    printf("\ndeleteTable TableName  -  Deletes a table.\n");
-    printf("\ndeleteDatabase DatabaseName  -  Deletes a database.\n");
-    printf("\neditValue TableName set ColumnName = NewValue if ColumnName == Value  -  Edit the value of a specified column in a specified table.\nNote: Value and NewValue should be in \"\" if string.\n");
-    printf("\nloadDatabase DatabaseName  -  Manually load a specific saved database.\n");
-    printf("\nunloadDatabase DatabaseName  -  Unloads a database from memory.\n");
-    printf("\nloadAllDatabases  -  Manually load all saved databases.\n");
-    printf("\ntoggleLoadDatabase  -  Toggles automatic loading at boot of databases. || Alais - TLD\n");
-    printf("\ncommitAll  -  Saves all changes done till now permanently.\n");
-    printf("\nexit  -  Exits program while saving all changes.\n");
-    printf("\nexit --no-save  -  Exits program while discarding all changes.\n");
-    printf("\nhelp  -  Displays this message.\n");
-    printf("-----------------------------------------------------------------------------------------------------------------------------------\n");
+    fprintf(commandOutput(), "\n------------------------------------------------------------ Help Menu ------------------------------------------------------------\n");
+    fprintf(commandOutput(), "Available commands:\n");
+    fprintf(commandOutput(), "\ncreateDatabase DatabaseName  -  Creates a database with a specified name and by default switches to the database.\n");
+    fprintf(commandOutput(), "\nuseDatabase DatabaseName  -  Select a database to use\n");
+    fprintf(commandOutput(), "\nlistDatabases  -  Shows the list of saved/loadable databases.\n");
+    fprintf(commandOutput(), "\ncreateTable TableName[ColumnName datatype, ...]  -  Creates a table within a database.\nNote: for string datatypes: string{length}\n");
+    fprintf(commandOutput(), "\nlistTables  -  Shows a list of tables in the currently selected database.\n");
+    fprintf(commandOutput(), "\ninsertValues TableName(Value, ...)  -  Appends a value to a specified table.\nNote: for string put the value in \"\". Several rows can be given at once: TableName(Value, ...), (Value, ...).\n");
+    fprintf(commandOutput(), "\ndisplayTable TableName limit Rows offset Rows stream  -  Displays a specified table, or a page of it.\nNote: limit, offset and stream are optional. stream sizes columns from their types instead of a sample of the rows.\n");
+    fprintf(commandOutput(), "\nselect Column, ... from TableName where ColumnName == Value limit Rows  -  Displays chosen columns of the rows matching a condition.\nNote: use * for every column. The where and limit parts are optional.\n");
+    fprintf(commandOutput(), "\nselect count(*), sum(Column), ... from TableName where Condition group by Column, ...  -  Computes count, sum, min, max and avg over the matching rows, per group when group by is given.\n");
+    fprintf(commandOutput(), "\nselect ... from TableName where Condition order by Column desc, ... limit Rows  -  Sorts the result, asc by default. Aggregate queries may order by a listed aggregate.\n");
+    fprintf(commandOutput(), "\nselect Column, ... from TableName join OtherTable on TableName.Column = OtherTable.Column  -  Combines the rows of two tables whose columns are equal.\nNote: write columns as Table.Column when both tables have one of that name.\n");
+    fprintf(commandOutput(), "\ndeleteValue TableName if ColumnName == Value  -  Deletes a value from a specified table.\nNote: Value should be in \"\" if string. Conditions may also use <, <=, >, >= or 'between Low and High'.\n");
+    fprintf(commandOutput(), "\neditTable TableName addColumn/removeColumn ColumnName Datatype  -  Adds or removes a column in a specified table.\nNote: Datatype required only when adding.\n");
+    fprintf(commandOutput(), "\ndeleteTable TableName  -  Deletes a table.\n");
+    fprintf(commandOutput(), "\ndeleteDatabase DatabaseName  -  Deletes a database.\n");
+    fprintf(commandOutput(), "\neditValue TableName set ColumnName = NewValue if ColumnName == Value  -  Edit the value of a specified column in a specified table.\nNote: Value and NewValue should be in \"\" if string.\n");
+    fprintf(commandOutput(), "\nprepare Name AS Command  -  Parses an insertValues, editValue, deleteValue, displayTable or select command once for repeated use.\nNote: values written as ? are given on each run.\n");
+    fprintf(commandOutput(), "\nexecute Name(Value, ...)  -  Runs a prepared command with one value per ?.\n");
+    fprintf(commandOutput(), "\ndeallocate Name  -  Removes a prepared command.\n");
+    fprintf(commandOutput(), "\ncreateIndex TableName ColumnName  -  Builds an ordered index used by range and equality conditions on that column.\n");
+    fprintf(commandOutput(), "\ndropIndex TableName ColumnName  -  Removes the index from a column.\n");
+    fprintf(commandOutput(), "\nloadDatabase DatabaseName  -  Manually load a specific saved database.\n");
+    fprintf(commandOutput(), "\nunloadDatabase DatabaseName  -  Unloads a database from memory.\nNote: unsaved changes stay in the write-ahead log. With TableMemoryBudget in config, cold tables are unloaded automatically, those with unsaved changes to data/evict, and read back when used.\n");
+    fprintf(commandOutput(), "\nloadAllDatabases  -  Manually load all saved databases.\n");
+    fprintf(commandOutput(), "\ntoggleLoadDatabase  -  Toggles automatic loading at boot of databases. || Alais - TLD\n");
+    fprintf(commandOutput(), "\ncommitAll  -  Saves all changes done till now permanently.\n");
+    fprintf(commandOutput(), "\nexit  -  Exits program while saving all changes.\n");
+    fprintf(commandOutput(), "\nexit --no-save  -  Exits program while discarding all changes.\n");
+    fprintf(commandOutput(), "\nhistory  -  Lists the most recent commands.\nNote: the HistorySize config option sets how many are kept, 0 keeps none.\n");
+    fprintf(commandOutput(), "\nstats  -  Shows the latency of each kind of command, row, byte and allocation counters, and the memory of each loaded table.\nNote: stats reset clears them. Commands slower than SlowCommandThreshold milliseconds in config are logged to slow.log.\n");
+    fprintf(commandOutput(), "\nhelp  -  Displays this message.\n");
+    fprintf(commandOutput(), "-----------------------------------------------------------------------------------------------------------------------------------\n");
 }
 void ToggleAutomaticLoading(){
     ConfigNode *configList = NULL;
@@ -1149,29 +1507,63 @@ void ToggleAutomaticLoading(){
     ConfigValue = checkConfig(configList, "AutomaticallyLoadDatabases");
     if(strcmp(ConfigValue, "True") == 0){
         ChangeConfigOption("False");
-        printf("Disabled Automatic database loading.\n");
+        fprintf(commandOutput(), "Disabled Automatic database loading.\n");
     } else {
         ChangeConfigOption("True");
-        printf("Enabled Automatic database loading.\n");
+        fprintf(commandOutput(), "Enabled Automatic database loading.\n");
     }
     freeConfigList(configList);
 }
 
-typedef struct CommandNode {
-    char *command;
-    struct CommandNode *next;
-} CommandNode;
+// Recent commands, kept in a ring of historySize entries for the history
+// command. A batch run keeps none.
+#define DEFAULT_HISTORY_SIZE 100
+// Threads a server runs queries on; 0 runs them on the loop thread.
+#define DEFAULT_READER_THREADS 4
+// Commands taking at least this many milliseconds go to the slow command
+// log; 0 turns it off.
+#define DEFAULT_SLOW_COMMAND_THRESHOLD 1000
+#define SLOW_LOG_PATH "slow.log"
+
+static char **history = NULL;
+static int historySize = 0;
+static int historyCount = 0;
+static int historyNext = 0;
+
+static void setHistorySize(int size) {
+    if (size <= 0) return;
+    history = calloc(size, sizeof(char *));
+    if (history) historySize = size;
+}
 
-void freeCommandList(CommandNode *head) {
-    CommandNode *temp;
-    while (head != NULL) {
-        temp = head;
-        head = head->next;
-        free(temp->command);
-        free(temp);
+static void addToHistory(const char *command) {
+    if (historySize == 0) return;
+    free(history[historyNext]);
+    history[historyNext] = strdup(command);
+    historyNext = (historyNext + 1) % historySize;
+    if (historyCount < historySize) historyCount++;
+}
+
+static void printHistory() {
+    if (historySize == 0) {
+        fprintf(commandOutput(), "Command history is off.\n");
+        return;
+    }
+    int first = (historyNext - historyCount + historySize) % historySize;
+    for (int i = 0; i < historyCount; i++) {
+        fprintf(commandOutput(), "%5d  %s\n", i + 1, history[(first + i) % historySize]);
     }
 }
 
+static void freeHistory() {
+    for (int i = 0; i < historySize; i++) {
+        free(history[i]);
+    }
+    free(history);
+    history = NULL;
+    historySize = historyCount = historyNext = 0;
+}
+
 ssize_t custom_getline(char **lineptr, size_t *n, FILE *stream) {
     size_t pos = 0;
     int c;
@@ -1199,12 +1591,296 @@ ssize_t custom_getline(char **lineptr, size_t *n, FILE *stream) {
     return pos;
 }
 
-int main() {
+// Commands that change a database. Those that succeed are logged so they can
+// be replayed after a crash; failed ones changed nothing and are not.
+static const char *mutationCommands[] = {
+    "createTable ", "insertValues ", "deleteValue ", "editTable ",
+    "deleteTable ", "editValue ", "createIndex ", "dropIndex ", NULL
+};
+
+static bool isMutation(const char *command) {
+    for (int i = 0; mutationCommands[i]; i++) {
+        if (strncmp(command, mutationCommands[i], strlen(mutationCommands[i])) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void runMutation(char *command) {
+    if (strncmp(command, "createTable ", 12) == 0) {
+        createTable(command + 12);
+    } else if (strncmp(command, "insertValues ", 13) == 0 || strncmp(command, "deleteValue ", 12) == 0 ||
+               strncmp(command, "editValue ", 10) == 0) {
+        runStatement(command);
+    } else if (strncmp(command, "editTable ", 10) == 0) {
+        editTable(command + 10);
+    } else if (strncmp(command, "deleteTable ", 12) == 0) {
+        deleteTable(command + 12);
+    } else if (strncmp(command, "createIndex ", 12) == 0) {
+        createIndex(command + 12);
+    } else if (strncmp(command, "dropIndex ", 10) == 0) {
+        dropIndex(command + 10);
+    }
+}
+
+// Runs a mutation and logs it if it reported no error. The text is copied
+// first because commands are parsed in place.
+static void runLoggedMutation(char *command) {
+    char *logged = strdup(command);
+    if (!logged) {
+        reportError("Error: Memory allocation failed for command.\n");
+        return;
+    }
+    unsigned long errors = threadReportedErrors();
+    runMutation(command);
+    if (threadReportedErrors() == errors && !logMutation(logged)) {
+        reportError("Error: The command ran but could not be logged; commit to keep its changes.\n");
+    }
+    free(logged);
+}
+
+// Asks to confirm an exit and returns the answer; a batch run never asks.
+static bool confirmExit(const char *question) {
+    if (batchMode) return true;
+
+    char input[10];
+    int choice = 0;
+    fprintf(commandOutput(), "%s (0 - No , 1 - Yes, Enter key - Yes): ", question);
+    if (!fgets(input, sizeof(input), stdin)) return true;
+    return input[0] == '\n' || (sscanf(input, "%d", &choice) == 1 && choice == 1);
+}
+
+// Runs one command. Returns false when the command ends the session.
+static bool runCommand(char *command) {
+    if (strncmp(command, "createDatabase ", 15) == 0) {
+        createDatabase(command + 15);
+    } else if (strncmp(command, "useDatabase ", 12) == 0) {
+        useDatabase(command + 12);
+    } else if (isMutation(command)) {
+        runLoggedMutation(command);
+    } else if (strncmp(command, "displayTable ", 13) == 0 || strncmp(command, "select ", 7) == 0) {
+        runStatement(command);
+    } else if (strncmp(command, "prepare ", 8) == 0) {
+        prepareStatement(command + 8);
+    } else if (strncmp(command, "execute ", 8) == 0) {
+        executePrepared(command + 8);
+    } else if (strncmp(command, "deallocate ", 11) == 0) {
+        deallocateStatement(command + 11);
+    } else if (strncmp(command, "deleteDatabase ", 15) == 0) {
+        deleteDatabase(command + 15);
+    } else if (strncmp(command, "unloadDatabase ", 15) == 0) {
+        unloadDatabase(command + 15);
+    } else if (strncmp(command, "loadDatabase ", 13) == 0) {
+        loadDatabase(command + 13);
+    } else if (strcmp(command, "loadAllDatabases") == 0) {
+        loadAllDatabases();
+    } else if (strcmp(command, "toggleLoadDatabase") == 0 || strcmp(command, "TLD") == 0) {
+        ToggleAutomaticLoading();
+    } else if (strcmp(command, "commitAll") == 0) {
+        saveDatabaseToFile();
+    } else if (strcmp(command, "listDatabases") == 0) {
+        listDatabases();
+    } else if (strcmp(command, "listTables") == 0) {
+        listTables();
+    } else if (strcmp(command, "history") == 0) {
+        printHistory();
+    } else if (strcmp(command, "stats") == 0) {
+        printStats(databases, databaseCount);
+    } else if (strcmp(command, "stats reset") == 0) {
+        resetStats();
+        fprintf(commandOutput(), "Statistics cleared.\n");
+    } else if (strcmp(command, "help") == 0) {
+        help();
+    } else if (strcmp(command, "exit --no-save") == 0) {
+        if (confirmExit("Are you sure that you want to exit without saving?")) {
+            for (int i = 0; i < databaseCount; i++) {
+                closeDatabaseWal(databases[i]);
+                removeWal(databases[i]->name);
+            }
+            fprintf(commandOutput(), "\nExiting program.\n");
+            return false;
+        }
+    } else if (strcmp(command, "exit") == 0) {
+        if (confirmExit("Are you sure that you want to exit while saving?")) {
+            saveDatabaseToFile();
+            fprintf(commandOutput(), "\nExiting program.\n");
+            return false;
+        }
+    } else {
+        reportError("Invalid command.\n");
+    }
+    return true;
+}
+
+// A select or displayTable resolved against a snapshot of its tables, run
+// by a server reader thread while later commands change the tables.
+typedef struct {
+    Statement statement;
+    Snapshot snapshot;
+    CommandTimer timer;
+} ReadJob;
+
+// True when an index picks the rows of the statement, which is then quicker
+// to run at once than on a snapshot, whose tables have no indexes.
+static bool answeredByIndex(const Statement *statement) {
+    if (!statement->hasCondition) {
+        return false;
+    }
+    const Column *column = statement->condition.column;
+    return column->orderedIndex || (column->primaryIndex && statement->condition.op == CMP_EQ);
+}
+
+// Parses and resolves a query from a server client. Unless an index answers
+// it, it is resolved again against a snapshot of its tables and left in
+// readJob for a reader thread; otherwise it runs here like runStatement.
+static void serveQuery(const char *command, void **readJob, const CommandTimer *timer) {
+    ReadJob *job = malloc(sizeof(ReadJob));
+    if (!job) {
+        reportError("Error: Memory allocation failed for a query.\n");
+        return;
+    }
+    Statement *statement = &job->statement;
+    if (!parseStatement(command, statement)) {
+        free(job);
+        return;
+    }
+    Database *db = getDatabaseByName(currentDatabase);
+    if (statement->parameterCount > 0) {
+        reportError("Error: '?' placeholders are only allowed in prepared statements.\n");
+    } else if (resolveStatement(statement, db)) {
+        Table *tables[2] = {statement->table, statement->joinTable};
+        if (answeredByIndex(statement)) {
+            executeStatement(statement);
+        } else if (openSnapshot(&job->snapshot, db, tables, statement->joinTable ? 2 : 1)) {
+            if (resolveStatement(statement, &job->snapshot.db)) {
+                job->timer = *timer;
+                *readJob = job;
+                return;
+            }
+            closeSnapshot(&job->snapshot);
+        }
+    }
+    freeStatement(statement);
+    free(job);
+}
+
+static void runQuery(void *readJob) {
+    ReadJob *job = readJob;
+    executeStatement(&job->statement);
+    stopCommandTimer(&job->timer);
+}
+
+static void finishQuery(void *readJob) {
+    ReadJob *job = readJob;
+    freeStatement(&job->statement);
+    closeSnapshot(&job->snapshot);
+    free(job);
+}
+
+// Runs a command sent by a server client. exit only ends that connection.
+// Queries are handed to the reader threads when readJob allows it; their
+// time, counted until a reader has run them, is recorded there.
+static bool serveCommand(char *command, void **readJob) {
+    if (strcmp(command, "exit") == 0 || strcmp(command, "exit --no-save") == 0) {
+        return false;
+    }
+    CommandTimer timer;
+    startCommandTimer(&timer, command);
+    bool keepRunning = true;
+    if (readJob && (strncmp(command, "select ", 7) == 0 || strncmp(command, "displayTable ", 13) == 0)) {
+        serveQuery(command, readJob, &timer);
+    } else {
+        keepRunning = runCommand(command);
+    }
+    enforceMemoryBudget(databases, databaseCount);
+    if (!readJob || !*readJob) {
+        stopCommandTimer(&timer);
+    }
+    return keepRunning;
+}
+
+static void printUsage(const char *program) {
+    printf("Usage: %s [-f script] [--on-error=continue|stop]\n", program);
+    printf("       %s --socket path | --port number\n", program);
+    printf("Commands are read from the script, or from standard input. When they do not\n");
+    printf("come from a terminal, no prompts or confirmations are shown. With --socket or\n");
+    printf("--port, commands come from clients of a Unix domain socket or a loopback port.\n");
+}
+
+int main(int argc, char **argv) {
+    const char *scriptPath = NULL;
+    const char *socketPath = NULL;
+    int port = 0;
+    bool stopOnError = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            scriptPath = argv[++i];
+        } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+            if (port <= 0 || port > 65535) {
+                printUsage(argv[0]);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--on-error=stop") == 0) {
+            stopOnError = true;
+        } else if (strcmp(argv[i], "--on-error=continue") == 0) {
+            stopOnError = false;
+        } else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    FILE *input = stdin;
+    if (scriptPath) {
+        input = fopen(scriptPath, "r");
+        if (!input) {
+            reportError("Error: Could not open script '%s'.\n", scriptPath);
+            return 1;
+        }
+    }
+    bool serverMode = socketPath != NULL || port > 0;
+    batchMode = serverMode || scriptPath != NULL || !isatty(STDIN_FILENO);
+    if (batchMode) {
+        // Results go out in large blocks rather than a write per line.
+        setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    }
+
     initializeDatabases();
 
     ConfigNode *configList = NULL;
     loadConfig("config.txt", &configList);
     const char *ConfigValue;
+    ConfigValue = getConfigValue(configList, "WorkerThreads");
+    if (ConfigValue) {
+        setWorkerThreadCount(atoi(ConfigValue));
+    }
+    ConfigValue = getConfigValue(configList, "SortMemoryBudget");
+    if (ConfigValue && atoi(ConfigValue) > 0) {
+        setSortMemoryBudget((size_t)atoi(ConfigValue) * 1024 * 1024);
+    }
+    ConfigValue = getConfigValue(configList, "JoinMemoryBudget");
+    if (ConfigValue && atoi(ConfigValue) > 0) {
+        setJoinMemoryBudget((size_t)atoi(ConfigValue) * 1024 * 1024);
+    }
+    int readerThreads = DEFAULT_READER_THREADS;
+    ConfigValue = getConfigValue(configList, "ReaderThreads");
+    if (ConfigValue) {
+        readerThreads = atoi(ConfigValue);
+    }
+    ConfigValue = getConfigValue(configList, "TableMemoryBudget");
+    if (ConfigValue && atoi(ConfigValue) > 0) {
+        setMemoryBudget((size_t)atoi(ConfigValue) * 1024 * 1024);
+    }
+    ConfigValue = getConfigValue(configList, "SlowCommandThreshold");
+    setSlowCommandLog(SLOW_LOG_PATH, ConfigValue ? atoi(ConfigValue) : DEFAULT_SLOW_COMMAND_THRESHOLD);
+    ConfigValue = getConfigValue(configList, "HistorySize");
+    if (!batchMode) {
+        setHistorySize(ConfigValue ? atoi(ConfigValue) : DEFAULT_HISTORY_SIZE);
+    }
     ConfigValue = checkConfig(configList, "AutomaticallyLoadDatabases");
     if (strcmp(ConfigValue, "True") == 0) {
         loadAllDatabases();
@@ -1212,97 +1888,78 @@ int main() {
         printf("Automatic database loading is disabled in config.\n");
     }
     freeConfigList(configList);
-    
-    CommandNode *commandList = NULL;
-    CommandNode *currentCommand = NULL;
+    enforceMemoryBudget(databases, databaseCount);
+
+    if (serverMode) {
+        CommandHandlers handlers = {serveCommand, runQuery, finishQuery};
+        int status = runServer(socketPath, port, readerThreads, &handlers);
+        saveDatabaseToFile();
+        fflush(stdout);
+        return status;
+    }
+
+    char *command = NULL;
+    size_t capacity = 0;
+    int lineNumber = 0;
+    int failedCommands = 0;
+    int status = 0;
 
     while (1) {
-        printf("\nEnter command: ");
-        
-        char *tempCommand = NULL;
-        size_t len = 0;
-        ssize_t read = custom_getline(&tempCommand, &len, stdin);
-        
-        if (read > 0 && tempCommand[read - 1] == '\n') {
-            tempCommand[read - 1] = '\0';
-        }
-        
-        CommandNode *newCommandNode = (CommandNode *)malloc(sizeof(CommandNode));
-        newCommandNode->command = tempCommand;
-        newCommandNode->next = NULL;
-        
-        if (commandList == NULL) {
-            commandList = newCommandNode;
-        } else {
-            currentCommand->next = newCommandNode;
-        }
-        currentCommand = newCommandNode;
-
-        if (strncmp(tempCommand, "createDatabase ", 15) == 0) {
-            createDatabase(tempCommand + 15);
-        } else if (strncmp(tempCommand, "useDatabase ", 12) == 0) {
-            useDatabase(tempCommand + 12);
-        } else if (strncmp(tempCommand, "createTable ", 12) == 0) {
-            createTable(tempCommand + 12);
-        } else if (strncmp(tempCommand, "insertValues ", 13) == 0) {
-            insertValues(tempCommand + 13);
-        } else if (strncmp(tempCommand, "displayTable ", 13) == 0) {
-            displayTable(tempCommand + 13);
-        } else if (strncmp(tempCommand, "deleteValue ", 12) == 0) {
-            deleteValue(tempCommand + 12);
-        } else if (strncmp(tempCommand, "editTable ", 10) == 0) {
-            editTable(tempCommand + 10);
-        } else if (strncmp(tempCommand, "deleteTable ", 12) == 0) {
-            deleteTable(tempCommand + 12);
-        } else if (strncmp(tempCommand, "deleteDatabase ", 15) == 0) {
-            deleteDatabase(tempCommand + 15);
-        } else if (strncmp(tempCommand, "unloadDatabase ", 15) == 0) {
-            unloadDatabase(tempCommand + 15);
-        } else if (strncmp(tempCommand, "editValue ", 10) == 0) {
-            editValue(tempCommand + 10);
-        } else if (strncmp(tempCommand, "loadDatabase ", 13) == 0) {
-            loadDatabase(tempCommand + 13);
-        } else if (strcmp(tempCommand, "loadAllDatabases") == 0) {
-            loadAllDatabases();
-        } else if (strcmp(tempCommand, "toggleLoadDatabase") == 0 || strcmp(tempCommand, "TLD") == 0) {
-            ToggleAutomaticLoading();
-        } else if (strcmp(tempCommand, "commitAll") == 0) {
+        if (!batchMode) {
+            printf("\nEnter command: ");
+        }
+
+        ssize_t read = custom_getline(&command, &capacity, input);
+        if (read < 0) {
+            // End of input ends the session like exit, without asking.
             saveDatabaseToFile();
-        } else if (strcmp(tempCommand, "listDatabases") == 0) {
-            listDatabases();
-        } else if (strcmp(tempCommand, "listTables") == 0) {
-            listTables();
-        } else if (strcmp(tempCommand, "help") == 0) {
-            help();
-        } else if (strcmp(tempCommand, "exit --no-save") == 0) {
-            char input[10];
-            int choice = 0;
-
-            printf("Are you sure that you want to exit without saving? (0 - No , 1 - Yes, Enter key - Yes): ");
-            fgets(input, sizeof(input), stdin);
-
-            if (input[0] == '\n' || (sscanf(input, "%d", &choice) == 1 && choice == 1)) {
+            if (!batchMode) {
                 printf("\nExiting program.\n");
-                break;
             }
-        } else if (strcmp(tempCommand, "exit") == 0) {
-            char input[10];
-            int choice = 0;
-
-            printf("Are you sure that you want to exit while saving? (0 - No , 1 - Yes, Enter key - Yes): ");
-            fgets(input, sizeof(input), stdin);
+            break;
+        }
+        lineNumber++;
+        if (read > 0 && command[read - 1] == '\n') {
+            command[--read] = '\0';
+        }
+        if (read > 0 && command[read - 1] == '\r') {
+            command[--read] = '\0';
+        }
+        // Scripts may hold blank lines and -- comments.
+        if (batchMode && (read == 0 || strncmp(command, "--", 2) == 0)) {
+            continue;
+        }
 
-            if (input[0] == '\n' || (sscanf(input, "%d", &choice) == 1 && choice == 1)) {
-                saveDatabaseToFile();
-                printf("\nExiting program.\n");
+        addToHistory(command);
+        unsigned long errorsBefore = __atomic_load_n(&reportedErrors, __ATOMIC_RELAXED);
+        CommandTimer timer;
+        startCommandTimer(&timer, command);
+        bool keepRunning = runCommand(command);
+        enforceMemoryBudget(databases, databaseCount);
+        stopCommandTimer(&timer);
+        if (__atomic_load_n(&reportedErrors, __ATOMIC_RELAXED) != errorsBefore) {
+            failedCommands++;
+            if (batchMode && stopOnError) {
+                // Changes made so far stay in the write-ahead logs and are
+                // replayed on the next load; nothing is committed.
+                printf("Stopped at line %d after an error.\n", lineNumber);
+                status = 1;
                 break;
             }
-        } else {
-            printf("Invalid command.\n");
         }
+        if (!keepRunning) break;
     }
 
-    freeCommandList(commandList);
-    
-    return 0;
+    if (batchMode && failedCommands > 0) {
+        printf("%d command%s failed.\n", failedCommands, failedCommands == 1 ? "" : "s");
+        status = 1;
+    }
+
+    free(command);
+    freeHistory();
+    if (input != stdin) {
+        fclose(input);
+    }
+    fflush(stdout);
+    return status;
 }
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "namemap.h"
+#include "output.h"
+
+#define MIN_MAP_CAPACITY 8
+
+// FNV-1a.
+static unsigned hashName(const char *name) {
+    unsigned hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *)name; *c; c++) {
+        hash ^= *c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int findSlot(const NameMap *map, const char *key, unsigned hash) {
+    int mask = map->capacity - 1;
+    for (int slot = hash & mask;; slot = (slot + 1) & mask) {
+        const NameMapEntry *entry = &map->entries[slot];
+        if (!entry->key || (entry->hash == hash && strcmp(entry->key, key) == 0)) {
+            return slot;
+        }
+    }
+}
+
+static bool growMap(NameMap *map) {
+    int capacity = map->capacity ? map->capacity * 2 : MIN_MAP_CAPACITY;
+    NameMapEntry *entries = calloc(capacity, sizeof(NameMapEntry));
+    if (!entries) {
+        reportError("Error: Memory allocation failed for catalog.\n");
+        return false;
+    }
+
+    NameMapEntry *old = map->entries;
+    int oldCapacity = map->capacity;
+    map->entries = entries;
+    map->capacity = capacity;
+    for (int i = 0; i < oldCapacity; i++) {
+        if (old[i].key) {
+            map->entries[findSlot(map, old[i].key, old[i].hash)] = old[i];
+        }
+    }
+    free(old);
+    return true;
+}
+
+void *nameMapFind(const NameMap *map, const char *key) {
+    if (map->count == 0) {
+        return NULL;
+    }
+    const NameMapEntry *entry = &map->entries[findSlot(map, key, hashName(key))];
+    return entry->key ? entry->value : NULL;
+}
+
+// Returns false if key is already mapped or the map cannot grow.
+bool nameMapInsert(NameMap *map, const char *key, void *value) {
+    if ((map->count + 1) * 4 > map->capacity * 3 && !growMap(map)) {
+        return false;
+    }
+    unsigned hash = hashName(key);
+    NameMapEntry *entry = &map->entries[findSlot(map, key, hash)];
+    if (entry->key) {
+        return false;
+    }
+    entry->key = key;
+    entry->value = value;
+    entry->hash = hash;
+    map->count++;
+    return true;
+}
+
+// Removes key with backward-shift deletion, so lookups need no tombstones.
+void nameMapRemove(NameMap *map, const char *key) {
+    if (map->count == 0) {
+        return;
+    }
+    int mask = map->capacity - 1;
+    int slot = findSlot(map, key, hashName(key));
+    if (!map->entries[slot].key) {
+        return;
+    }
+
+    int next = slot;
+    while (1) {
+        next = (next + 1) & mask;
+        NameMapEntry *entry = &map->entries[next];
+        if (!entry->key) {
+            break;
+        }
+        int home = entry->hash & mask;
+        bool movable = slot <= next ? (home <= slot || home > next) : (home <= slot && home > next);
+        if (movable) {
+            map->entries[slot] = *entry;
+            slot = next;
+        }
+    }
+    map->entries[slot].key = NULL;
+    map->entries[slot].value = NULL;
+    map->count--;
+}
+
+void nameMapClear(NameMap *map) {
+    free(map->entries);
+    map->entries = NULL;
+    map->capacity = 0;
+    map->count = 0;
+}
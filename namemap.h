@@ -0,0 +1,26 @@
+#ifndef NAMEMAP_H
+#define NAMEMAP_H
+
+#include <stdbool.h>
+
+// Open-addressing hash map from names to objects, used for the catalog of
+// databases, tables and columns. Keys are not copied: each key must point at
+// the name stored in the object it maps to and stay valid while mapped.
+typedef struct {
+    const char *key;
+    void *value;
+    unsigned hash;
+} NameMapEntry;
+
+typedef struct {
+    NameMapEntry *entries;
+    int capacity;
+    int count;
+} NameMap;
+
+void *nameMapFind(const NameMap *map, const char *key);
+bool nameMapInsert(NameMap *map, const char *key, void *value);
+void nameMapRemove(NameMap *map, const char *key);
+void nameMapClear(NameMap *map);
+
+#endif
@@ -0,0 +1,310 @@
+#include <stdarg.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "output.h"
+
+// Rows measured by estimateTableWidths; smaller ranges are measured in full.
+#define WIDTH_SAMPLE_ROWS 4096
+// Width of a float column in schema widths, enough for -999999999.99.
+#define FLOAT_SCHEMA_WIDTH 13
+
+unsigned long reportedErrors = 0;
+static __thread unsigned long threadErrors = 0;
+static __thread FILE *threadOutput = NULL;
+
+FILE *commandOutput(void) {
+    return threadOutput ? threadOutput : stdout;
+}
+
+void setCommandOutput(FILE *stream) {
+    threadOutput = stream;
+}
+
+void reportError(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(commandOutput(), format, args);
+    va_end(args);
+    __atomic_add_fetch(&reportedErrors, 1, __ATOMIC_RELAXED);
+    threadErrors++;
+}
+
+unsigned long threadReportedErrors(void) {
+    return threadErrors;
+}
+
+void countThreadErrors(unsigned long count) {
+    threadErrors += count;
+}
+
+void printSystemError(const char *message) {
+    fprintf(commandOutput(), "%s: %s\n", message, strerror(errno));
+}
+
+bool openOutput(OutputBuffer *output, FILE *stream) {
+    output->stream = stream;
+    output->length = 0;
+    output->capacity = OUTPUT_BUFFER_SIZE;
+    output->data = malloc(output->capacity);
+    if (!output->data) {
+        reportError("Error: Memory allocation failed for output buffer.\n");
+        return false;
+    }
+    return true;
+}
+
+void flushOutput(OutputBuffer *output) {
+    if (output->length > 0) {
+        fwrite(output->data, 1, output->length, output->stream);
+        output->length = 0;
+    }
+}
+
+void appendOutput(OutputBuffer *output, const char *text, size_t length) {
+    if (output->length + length > output->capacity) {
+        flushOutput(output);
+        if (length > output->capacity) {
+            fwrite(text, 1, length, output->stream);
+            return;
+        }
+    }
+    memcpy(output->data + output->length, text, length);
+    output->length += length;
+}
+
+void closeOutput(OutputBuffer *output) {
+    flushOutput(output);
+    free(output->data);
+    output->data = NULL;
+}
+
+static void appendRepeated(OutputBuffer *output, char c, int count) {
+    char run[64];
+    memset(run, c, sizeof(run));
+    for (; count > 0; count -= sizeof(run)) {
+        appendOutput(output, run, count < (int)sizeof(run) ? count : (int)sizeof(run));
+    }
+}
+
+// Writes value in decimal to the end of text and returns where it starts.
+static char *formatInt(int value, char *end) {
+    long long magnitude = value < 0 ? -(long long)value : value;
+    char *start = end;
+    do {
+        *--start = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) {
+        *--start = '-';
+    }
+    return start;
+}
+
+static int intLength(int value) {
+    long long magnitude = value < 0 ? -(long long)value : value;
+    int length = value < 0 ? 2 : 1;
+    while (magnitude >= 10) {
+        magnitude /= 10;
+        length++;
+    }
+    return length;
+}
+
+// Writes value as %.2f would, to the end of text, and returns where it
+// starts, or NULL for huge and non-finite values. A float times 100 is exact
+// in a double, so rounding it half to even matches printf digit for digit.
+static char *formatFloat(float value, char *end) {
+    double scaled = fabs((double)value * 100.0);
+    if (!isfinite(value) || scaled >= 1e18) {
+        return NULL;
+    }
+    long long hundredths = (long long)scaled;
+    double fraction = scaled - hundredths;
+    if (fraction > 0.5 || (fraction == 0.5 && (hundredths & 1))) {
+        hundredths++;
+    }
+    char *start = end;
+    *--start = '0' + hundredths % 10;
+    *--start = '0' + hundredths / 10 % 10;
+    *--start = '.';
+    long long whole = hundredths / 100;
+    do {
+        *--start = '0' + whole % 10;
+        whole /= 10;
+    } while (whole);
+    if (signbit(value)) {
+        *--start = '-';
+    }
+    return start;
+}
+
+static int floatLength(float value) {
+    char text[64];
+    char *start = formatFloat(value, text + sizeof(text));
+    return start ? text + sizeof(text) - start : snprintf(NULL, 0, "%.2f", value);
+}
+
+static int valueLength(const Column *column, int row) {
+    if (column->type == INT) {
+        return intLength(column->intValues[row]);
+    }
+    if (column->type == FLOAT) {
+        return floatLength(column->floatValues[row]);
+    }
+    return strnlen(getStringValue(column, row), column->stringSize + 1);
+}
+
+bool openTablePrinter(TablePrinter *printer, Column **columns, int columnCount) {
+    printer->columns = columns;
+    printer->sides = NULL;
+    printer->names = NULL;
+    printer->columnCount = columnCount;
+    printer->widths = malloc((columnCount > 0 ? columnCount : 1) * sizeof(int));
+    if (!printer->widths || !openOutput(&printer->output, commandOutput())) {
+        free(printer->widths);
+        return false;
+    }
+    for (int i = 0; i < columnCount; i++) {
+        printer->widths[i] = strlen(columns[i]->name);
+    }
+    return true;
+}
+
+static void measureCell(TablePrinter *printer, int i, int row) {
+    const Column *column = printer->columns[i];
+    // A string column is never wider than its declared size.
+    if (column->type == STRING && printer->widths[i] >= column->stringSize) {
+        return;
+    }
+    int length = valueLength(column, row);
+    if (length > printer->widths[i]) {
+        printer->widths[i] = length;
+    }
+}
+
+void measureTableRow(TablePrinter *printer, int row) {
+    for (int i = 0; i < printer->columnCount; i++) {
+        measureCell(printer, i, row);
+    }
+}
+
+// Makes the printer print pairs of rows, with names as the column headers.
+void setJoinedColumns(TablePrinter *printer, const int *sides, const char **names) {
+    printer->sides = sides;
+    printer->names = names;
+    for (int i = 0; i < printer->columnCount; i++) {
+        printer->widths[i] = strlen(names[i]);
+    }
+}
+
+void measureJoinedRow(TablePrinter *printer, const int rows[2]) {
+    for (int i = 0; i < printer->columnCount; i++) {
+        measureCell(printer, i, rows[printer->sides[i]]);
+    }
+}
+
+// Sizes the columns from up to WIDTH_SAMPLE_ROWS rows spread evenly over
+// the given rows, or over firstRow onwards when rows is NULL.
+void estimateTableWidths(TablePrinter *printer, const int *rows, int firstRow, int rowCount) {
+    long long step = rowCount > WIDTH_SAMPLE_ROWS ? rowCount / WIDTH_SAMPLE_ROWS : 1;
+    for (long long r = 0; r < rowCount; r += step) {
+        measureTableRow(printer, rows ? rows[r] : firstRow + (int)r);
+    }
+    if (step > 1) {
+        measureTableRow(printer, rows ? rows[rowCount - 1] : firstRow + rowCount - 1);
+    }
+}
+
+// estimateTableWidths for the row pairs of a join.
+void estimateJoinedWidths(TablePrinter *printer, const int *leftRows, const int *rightRows, int rowCount) {
+    long long step = rowCount > WIDTH_SAMPLE_ROWS ? rowCount / WIDTH_SAMPLE_ROWS : 1;
+    for (long long r = 0; r < rowCount; r += step) {
+        measureJoinedRow(printer, (int[2]){leftRows[r], rightRows[r]});
+    }
+    if (step > 1) {
+        measureJoinedRow(printer, (int[2]){leftRows[rowCount - 1], rightRows[rowCount - 1]});
+    }
+}
+
+// Sizes the columns from their types alone, without looking at any row.
+void schemaTableWidths(TablePrinter *printer) {
+    for (int i = 0; i < printer->columnCount; i++) {
+        const Column *column = printer->columns[i];
+        int width = column->type == INT ? 11 : column->type == FLOAT ? FLOAT_SCHEMA_WIDTH : column->stringSize;
+        if (width > printer->widths[i]) {
+            printer->widths[i] = width;
+        }
+    }
+}
+
+static void printBorder(TablePrinter *printer) {
+    for (int i = 0; i < printer->columnCount; i++) {
+        appendRepeated(&printer->output, '-', printer->widths[i] + 3);
+    }
+    appendOutput(&printer->output, "-\n", 2);
+}
+
+// Writes "| text " padded to width.
+static void printCell(TablePrinter *printer, const char *text, int length, int width) {
+    appendOutput(&printer->output, "| ", 2);
+    appendOutput(&printer->output, text, length);
+    appendRepeated(&printer->output, ' ', (width > length ? width - length : 0) + 1);
+}
+
+void printTableHeader(TablePrinter *printer) {
+    appendOutput(&printer->output, "\n", 1);
+    printBorder(printer);
+    for (int i = 0; i < printer->columnCount; i++) {
+        const char *name = printer->names ? printer->names[i] : printer->columns[i]->name;
+        printCell(printer, name, strlen(name), printer->widths[i]);
+    }
+    appendOutput(&printer->output, "|\n", 2);
+    printBorder(printer);
+}
+
+static void printValue(TablePrinter *printer, int i, int row) {
+    const Column *column = printer->columns[i];
+    char text[64];
+    if (column->type == INT) {
+        char *start = formatInt(column->intValues[row], text + sizeof(text));
+        printCell(printer, start, text + sizeof(text) - start, printer->widths[i]);
+    } else if (column->type == FLOAT) {
+        char *start = formatFloat(column->floatValues[row], text + sizeof(text));
+        if (start) {
+            printCell(printer, start, text + sizeof(text) - start, printer->widths[i]);
+        } else {
+            int length = snprintf(text, sizeof(text), "%.2f", column->floatValues[row]);
+            printCell(printer, text, length < (int)sizeof(text) ? length : (int)sizeof(text) - 1, printer->widths[i]);
+        }
+    } else {
+        const char *value = getStringValue(column, row);
+        printCell(printer, value, strnlen(value, column->stringSize + 1), printer->widths[i]);
+    }
+}
+
+void printTableRow(TablePrinter *printer, int row) {
+    for (int i = 0; i < printer->columnCount; i++) {
+        printValue(printer, i, row);
+    }
+    appendOutput(&printer->output, "|\n", 2);
+}
+
+void printJoinedRow(TablePrinter *printer, const int rows[2]) {
+    for (int i = 0; i < printer->columnCount; i++) {
+        printValue(printer, i, rows[printer->sides[i]]);
+    }
+    appendOutput(&printer->output, "|\n", 2);
+}
+
+void printTableFooter(TablePrinter *printer) {
+    printBorder(printer);
+    flushOutput(&printer->output);
+}
+
+void closeTablePrinter(TablePrinter *printer) {
+    closeOutput(&printer->output);
+    free(printer->widths);
+    printer->widths = NULL;
+}
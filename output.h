@@ -0,0 +1,71 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include "storage.h"
+
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+// Rows displayTable formats before writing them out.
+#define DISPLAY_PAGE_ROWS 4096
+
+// Collects text in memory and writes it to stream in large blocks, so a page
+// of rows costs one write instead of one printf per cell.
+typedef struct {
+    FILE *stream;
+    char *data;
+    size_t length;
+    size_t capacity;
+} OutputBuffer;
+
+bool openOutput(OutputBuffer *output, FILE *stream);
+void appendOutput(OutputBuffer *output, const char *text, size_t length);
+void flushOutput(OutputBuffer *output);
+void closeOutput(OutputBuffer *output);
+
+// Stream the calling thread writes query results to: stdout unless the thread
+// set its own with setCommandOutput, as server reader threads do.
+FILE *commandOutput(void);
+void setCommandOutput(FILE *stream);
+
+// Prints an error message like printf to commandOutput and counts it in
+// reportedErrors, so a batch run can tell which statements failed. Every
+// "Error: ..." message goes through here. threadReportedErrors counts only
+// the calling thread's.
+extern unsigned long reportedErrors;
+void reportError(const char *format, ...) __attribute__((format(printf, 1, 2)));
+unsigned long threadReportedErrors(void);
+// Adds errors reported on other threads for the calling thread's command,
+// such as by parallel tasks, to its threadReportedErrors.
+void countThreadErrors(unsigned long count);
+
+// Prints message and the text of errno like perror, but to commandOutput.
+void printSystemError(const char *message);
+
+// Prints rows of columns as a bordered table. Column widths start at the
+// header names and are widened by measureTableRow or estimateTableWidths;
+// a value wider than its column is printed in full and only shifts its row.
+// For a join, sides gives the table of each column, 0 or 1, and a row is
+// a pair of row numbers, one per table.
+typedef struct {
+    OutputBuffer output;
+    Column **columns;
+    const int *sides;
+    const char **names;
+    int columnCount;
+    int *widths;
+} TablePrinter;
+
+bool openTablePrinter(TablePrinter *printer, Column **columns, int columnCount);
+void measureTableRow(TablePrinter *printer, int row);
+void estimateTableWidths(TablePrinter *printer, const int *rows, int firstRow, int rowCount);
+void schemaTableWidths(TablePrinter *printer);
+void setJoinedColumns(TablePrinter *printer, const int *sides, const char **names);
+void measureJoinedRow(TablePrinter *printer, const int rows[2]);
+void estimateJoinedWidths(TablePrinter *printer, const int *leftRows, const int *rightRows, int rowCount);
+void printTableHeader(TablePrinter *printer);
+void printTableRow(TablePrinter *printer, int row);
+void printJoinedRow(TablePrinter *printer, const int rows[2]);
+void printTableFooter(TablePrinter *printer);
+void closeTablePrinter(TablePrinter *printer);
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "parallel.h"
+#include "output.h"
+
+static int configuredThreads = 0;
+
+// A runParallel call. helpers counts the pool workers working on it, up to
+// helperLimit; errors collects the errors they reported for it.
+typedef struct ParallelJob {
+    void (*task)(void *context, int index);
+    void *context;
+    int taskCount;
+    int nextTask;
+    FILE *output;
+    int helpers;
+    int helperLimit;
+    unsigned long errors;
+    struct ParallelJob *next;
+} ParallelJob;
+
+// The workers are started on first use and kept for the life of the process.
+// Jobs whose tasks are not all taken yet wait in jobs for them.
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t helperLeft = PTHREAD_COND_INITIALIZER;
+static ParallelJob *jobs = NULL;
+static int poolSize = 0;
+
+void setWorkerThreadCount(int count) {
+    configuredThreads = count;
+}
+
+int workerThreadCount(void) {
+    if (configuredThreads > 0) {
+        return configuredThreads;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+static void runTasks(ParallelJob *job) {
+    int index;
+    while ((index = __atomic_fetch_add(&job->nextTask, 1, __ATOMIC_RELAXED)) < job->taskCount) {
+        job->task(job->context, index);
+    }
+}
+
+// A queued job that can take another helper. Called with poolLock held.
+static ParallelJob *jobNeedingHelp(void) {
+    for (ParallelJob *job = jobs; job; job = job->next) {
+        if (job->helpers < job->helperLimit &&
+            __atomic_load_n(&job->nextTask, __ATOMIC_RELAXED) < job->taskCount) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+// Pool workers help with queued jobs. Errors from a job's tasks go where the
+// caller's output goes and are handed back to the caller's count.
+static void *poolWorker(void *argument) {
+    (void)argument;
+    pthread_mutex_lock(&poolLock);
+    while (1) {
+        ParallelJob *job = jobNeedingHelp();
+        if (!job) {
+            pthread_cond_wait(&jobQueued, &poolLock);
+            continue;
+        }
+        job->helpers++;
+        pthread_mutex_unlock(&poolLock);
+
+        setCommandOutput(job->output);
+        unsigned long errorsBefore = threadReportedErrors();
+        runTasks(job);
+        unsigned long errors = threadReportedErrors() - errorsBefore;
+        setCommandOutput(NULL);
+
+        pthread_mutex_lock(&poolLock);
+        job->errors += errors;
+        if (--job->helpers == 0) {
+            pthread_cond_broadcast(&helperLeft);
+        }
+    }
+    return NULL;
+}
+
+// Starts workers until the pool has count of them. Called with poolLock held.
+static void growPool(int count) {
+    while (poolSize < count) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, poolWorker, NULL) != 0) {
+            break;
+        }
+        pthread_detach(thread);
+        poolSize++;
+    }
+}
+
+void runParallel(int taskCount, void (*task)(void *context, int index), void *context) {
+    ParallelJob job = {task, context, taskCount, 0, commandOutput(), 0, 0, 0, NULL};
+    int threadCount = workerThreadCount();
+    if (threadCount > taskCount) {
+        threadCount = taskCount;
+    }
+    if (threadCount <= 1) {
+        runTasks(&job);
+        return;
+    }
+
+    job.helperLimit = threadCount - 1;
+    pthread_mutex_lock(&poolLock);
+    growPool(workerThreadCount() - 1);
+    job.next = jobs;
+    jobs = &job;
+    pthread_cond_broadcast(&jobQueued);
+    pthread_mutex_unlock(&poolLock);
+
+    runTasks(&job);
+
+    // Every task has been taken, so no worker joins the job any more; wait
+    // for those still running one.
+    pthread_mutex_lock(&poolLock);
+    ParallelJob **link = &jobs;
+    while (*link != &job) {
+        link = &(*link)->next;
+    }
+    *link = job.next;
+    while (job.helpers > 0) {
+        pthread_cond_wait(&helperLeft, &poolLock);
+    }
+    pthread_mutex_unlock(&poolLock);
+    countThreadErrors(job.errors);
+}
@@ -0,0 +1,17 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Runs task(context, index) once for every index in [0, taskCount) on a pool
+// of worker threads, started on first use and kept for the life of the
+// process. Workers take the next index from a shared counter, so uneven tasks
+// balance themselves. The calling thread works too and the call returns once
+// every task has finished, with the errors the tasks reported on workers
+// added to the caller's threadReportedErrors. Calls may run at once from
+// several threads, and from inside a task.
+void runParallel(int taskCount, void (*task)(void *context, int index), void *context);
+
+// Number of threads runParallel uses. Zero or less selects one per online CPU.
+void setWorkerThreadCount(int count);
+int workerThreadCount(void);
+
+#endif
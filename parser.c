@@ -0,0 +1,818 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "parser.h"
+#include "dbfile.h"
+#include "output.h"
+
+typedef struct {
+    Statement *statement;
+    Token *token;
+} Parser;
+
+static Token *peek(Parser *parser) {
+    return parser->token;
+}
+
+static Token *next(Parser *parser) {
+    Token *token = parser->token;
+    if (token->type != TOKEN_END) {
+        parser->token++;
+    }
+    return token;
+}
+
+static bool accept(Parser *parser, TokenType type, const char *text) {
+    if (tokenIs(parser->token, type, text)) {
+        next(parser);
+        return true;
+    }
+    return false;
+}
+
+static bool isValueToken(const Token *token) {
+    return token->type == TOKEN_WORD || token->type == TOKEN_STRING || token->type == TOKEN_PARAM;
+}
+
+static void setOperand(Parser *parser, Operand *operand, Token *token) {
+    operand->text = token->text;
+    operand->parameter = token->type == TOKEN_PARAM ? parser->statement->parameterCount++ : -1;
+}
+
+// Reads one value of a tuple. Unquoted values may span several words, as in
+// (1, John Smith); they are taken verbatim from the source.
+static void parseTupleValue(Parser *parser, Operand *operand) {
+    Token *first = peek(parser);
+    if (!isValueToken(first)) {
+        operand->text = first->text + strlen(first->text);
+        operand->parameter = -1;
+        return;
+    }
+    next(parser);
+    if (first->type != TOKEN_WORD || peek(parser)->type != TOKEN_WORD) {
+        setOperand(parser, operand, first);
+        return;
+    }
+
+    Token *last = first;
+    while (peek(parser)->type == TOKEN_WORD) {
+        last = next(parser);
+    }
+    Statement *statement = parser->statement;
+    int length = last->offset + last->length - first->offset;
+    char *span = statement->spans + statement->spansUsed;
+    memcpy(span, statement->source + first->offset, length);
+    span[length] = '\0';
+    statement->spansUsed += length + 1;
+    operand->text = span;
+    operand->parameter = -1;
+}
+
+static bool parseValues(Parser *parser) {
+    Statement *statement = parser->statement;
+    int capacity = statement->tokens.count;
+    statement->values = malloc(capacity * sizeof(Operand));
+    statement->tupleSizes = malloc(capacity * sizeof(int));
+    statement->spans = malloc(strlen(statement->source) + 1);
+    if (!statement->values || !statement->tupleSizes || !statement->spans) {
+        reportError("Error: Memory allocation failed while parsing command.\n");
+        return false;
+    }
+
+    while (1) {
+        while (accept(parser, TOKEN_SYMBOL, ",")) {
+        }
+        if (peek(parser)->type == TOKEN_END) {
+            break;
+        }
+        if (!accept(parser, TOKEN_SYMBOL, "(")) {
+            reportError("Error: Values not defined correctly.\n");
+            return false;
+        }
+        int size = 0;
+        while (1) {
+            parseTupleValue(parser, &statement->values[statement->valueCount++]);
+            size++;
+            if (accept(parser, TOKEN_SYMBOL, ")")) {
+                break;
+            }
+            if (!accept(parser, TOKEN_SYMBOL, ",")) {
+                reportError("Error: Values not defined correctly.\n");
+                return false;
+            }
+        }
+        statement->tupleSizes[statement->tupleCount++] = size;
+    }
+
+    if (statement->tupleCount == 0) {
+        reportError("Error: Values not defined correctly.\n");
+        return false;
+    }
+    return true;
+}
+
+// 'ColumnName <op> Value' or 'ColumnName between Low and High', following
+// the keyword of the clause ('if' or 'where').
+static bool parseConditionClause(Parser *parser, const char *keyword) {
+    Statement *statement = parser->statement;
+    Token *column = next(parser);
+    Token *operator = next(parser);
+    Token *value = next(parser);
+    if (column->type != TOKEN_WORD || !isValueToken(value) || !parseOperator(operator->text, &statement->op) ||
+        (operator->type != TOKEN_SYMBOL && operator->type != TOKEN_WORD)) {
+        reportError("Error: Invalid syntax in '%s' clause. Expected '%s ColumnName ==|<|<=|>|>= Value' or '%s ColumnName between Low and High'.\n", keyword, keyword, keyword);
+        return false;
+    }
+    statement->hasCondition = true;
+    statement->conditionColumn = column->text;
+    setOperand(parser, &statement->low, value);
+
+    if (statement->op == CMP_BETWEEN) {
+        Token *andKeyword = next(parser);
+        Token *upper = next(parser);
+        if (!tokenIs(andKeyword, TOKEN_WORD, "and") || !isValueToken(upper)) {
+            reportError("Error: Invalid syntax in '%s' clause. Expected '%s ColumnName between Low and High'.\n", keyword, keyword);
+            return false;
+        }
+        setOperand(parser, &statement->high, upper);
+    }
+    return true;
+}
+
+static bool expectEnd(Parser *parser) {
+    if (peek(parser)->type != TOKEN_END) {
+        reportError("Error: Unexpected '%s' at position %d.\n", peek(parser)->text, peek(parser)->offset + 1);
+        return false;
+    }
+    return true;
+}
+
+// A row count or ? placeholder following keyword ('limit' or 'offset').
+static bool parseRowsClause(Parser *parser, const char *keyword, bool *present, Operand *operand) {
+    Token *rows = next(parser);
+    if (rows->type != TOKEN_WORD && rows->type != TOKEN_PARAM) {
+        reportError("Error: Invalid syntax. Expected a number of rows after '%s'.\n", keyword);
+        return false;
+    }
+    *present = true;
+    setOperand(parser, operand, rows);
+    return true;
+}
+
+// Column, or Aggregate(Column) with count(*) also allowed. expected names
+// what the clause wants in the syntax error.
+static bool parseSelectItem(Parser *parser, SelectItem *item, const char *expected) {
+    Token *name = next(parser);
+    if (name->type != TOKEN_WORD || tokenIs(name, TOKEN_WORD, "from")) {
+        reportError("Error: Invalid syntax. Expected %s.\n", expected);
+        return false;
+    }
+    item->aggregate = AGG_NONE;
+    item->columnName = name->text;
+    if (!accept(parser, TOKEN_SYMBOL, "(")) {
+        return true;
+    }
+
+    if (!parseAggregateName(name->text, &item->aggregate)) {
+        reportError("Error: Unknown aggregate '%s'. Use count, sum, min, max or avg.\n", name->text);
+        return false;
+    }
+    Token *argument = next(parser);
+    bool star = tokenIs(argument, TOKEN_WORD, "*");
+    if (argument->type != TOKEN_WORD || (star && item->aggregate != AGG_COUNT) || !accept(parser, TOKEN_SYMBOL, ")")) {
+        reportError("Error: Invalid syntax. Expected '%s(ColumnName)'.\n", name->text);
+        return false;
+    }
+    item->columnName = star ? NULL : argument->text;
+    return true;
+}
+
+// select * | Item, ... from TableName [join TableName on Column = Column]
+// [where Condition] [group by Column, ...] [order by Item [asc|desc], ...]
+// [limit Rows]
+static bool parseSelect(Parser *parser) {
+    Statement *statement = parser->statement;
+    statement->kind = STMT_SELECT;
+    statement->items = malloc(statement->tokens.count * sizeof(SelectItem));
+    statement->groupBy = malloc(statement->tokens.count * sizeof(char *));
+    statement->orderBy = malloc(statement->tokens.count * sizeof(OrderItem));
+    if (!statement->items || !statement->groupBy || !statement->orderBy) {
+        reportError("Error: Memory allocation failed while parsing command.\n");
+        return false;
+    }
+
+    if (!accept(parser, TOKEN_WORD, "*")) {
+        do {
+            SelectItem *item = &statement->items[statement->itemCount++];
+            if (!parseSelectItem(parser, item, "column names or '*' after 'select'")) {
+                return false;
+            }
+            statement->isAggregate |= item->aggregate != AGG_NONE;
+        } while (accept(parser, TOKEN_SYMBOL, ","));
+    }
+
+    Token *from = next(parser);
+    Token *table = next(parser);
+    if (!tokenIs(from, TOKEN_WORD, "from") || table->type != TOKEN_WORD) {
+        reportError("Error: Invalid syntax. Usage: select Column, ... from TableName [join TableName on Column = Column] [where Condition] [group by Column, ...] [order by Column [asc|desc], ...] [limit Rows]\n");
+        return false;
+    }
+    statement->tableName = table->text;
+
+    if (accept(parser, TOKEN_WORD, "join")) {
+        Token *joined = next(parser);
+        Token *on = next(parser);
+        Token *leftKey = next(parser);
+        Token *equals = next(parser);
+        Token *rightKey = next(parser);
+        if (joined->type != TOKEN_WORD || !tokenIs(on, TOKEN_WORD, "on") || leftKey->type != TOKEN_WORD ||
+            (!tokenIs(equals, TOKEN_SYMBOL, "=") && !tokenIs(equals, TOKEN_SYMBOL, "==")) || rightKey->type != TOKEN_WORD) {
+            reportError("Error: Invalid syntax. Expected 'join TableName on Table.Column = Table.Column'.\n");
+            return false;
+        }
+        statement->joinTableName = joined->text;
+        statement->joinLeftName = leftKey->text;
+        statement->joinRightName = rightKey->text;
+    }
+    if (accept(parser, TOKEN_WORD, "where") && !parseConditionClause(parser, "where")) {
+        return false;
+    }
+    if (accept(parser, TOKEN_WORD, "group")) {
+        if (!accept(parser, TOKEN_WORD, "by")) {
+            reportError("Error: Invalid syntax. Expected 'by' after 'group'.\n");
+            return false;
+        }
+        do {
+            Token *column = next(parser);
+            if (column->type != TOKEN_WORD) {
+                reportError("Error: Invalid syntax. Expected column names after 'group by'.\n");
+                return false;
+            }
+            statement->groupBy[statement->groupByCount++] = column->text;
+        } while (accept(parser, TOKEN_SYMBOL, ","));
+        statement->isAggregate = true;
+    }
+    if (accept(parser, TOKEN_WORD, "order")) {
+        if (!accept(parser, TOKEN_WORD, "by")) {
+            reportError("Error: Invalid syntax. Expected 'by' after 'order'.\n");
+            return false;
+        }
+        do {
+            OrderItem *order = &statement->orderBy[statement->orderByCount++];
+            if (!parseSelectItem(parser, &order->item, "column names after 'order by'")) {
+                return false;
+            }
+            order->descending = accept(parser, TOKEN_WORD, "desc");
+            if (!order->descending) {
+                accept(parser, TOKEN_WORD, "asc");
+            }
+        } while (accept(parser, TOKEN_SYMBOL, ","));
+    }
+    if (accept(parser, TOKEN_WORD, "limit") && !parseRowsClause(parser, "limit", &statement->hasLimit, &statement->limit)) {
+        return false;
+    }
+    return expectEnd(parser);
+}
+
+// displayTable TableName [limit Rows] [offset Rows] [stream]
+static bool parseDisplay(Parser *parser) {
+    Statement *statement = parser->statement;
+    if (accept(parser, TOKEN_WORD, "limit") && !parseRowsClause(parser, "limit", &statement->hasLimit, &statement->limit)) {
+        return false;
+    }
+    if (accept(parser, TOKEN_WORD, "offset") && !parseRowsClause(parser, "offset", &statement->hasOffset, &statement->offset)) {
+        return false;
+    }
+    statement->stream = accept(parser, TOKEN_WORD, "stream");
+    return expectEnd(parser);
+}
+
+static bool parseTokens(Parser *parser) {
+    Statement *statement = parser->statement;
+    Token *keyword = next(parser);
+    if (tokenIs(keyword, TOKEN_WORD, "select")) {
+        return parseSelect(parser);
+    }
+    Token *table = next(parser);
+
+    if (tokenIs(keyword, TOKEN_WORD, "insertValues")) {
+        statement->kind = STMT_INSERT;
+        if (table->type != TOKEN_WORD || !tokenIs(peek(parser), TOKEN_SYMBOL, "(")) {
+            reportError("Error: Invalid syntax.\n");
+            return false;
+        }
+        statement->tableName = table->text;
+        return parseValues(parser);
+    }
+
+    if (tokenIs(keyword, TOKEN_WORD, "displayTable")) {
+        statement->kind = STMT_DISPLAY;
+        if (table->type != TOKEN_WORD) {
+            reportError("Error: Invalid syntax. Usage: displayTable TableName [limit Rows] [offset Rows] [stream]\n");
+            return false;
+        }
+        statement->tableName = table->text;
+        return parseDisplay(parser);
+    }
+
+    if (tokenIs(keyword, TOKEN_WORD, "deleteValue")) {
+        statement->kind = STMT_DELETE;
+        if (table->type != TOKEN_WORD) {
+            reportError("Error: Invalid syntax. Usage: deleteValue TableName if ColumnName == Value\n");
+            return false;
+        }
+        statement->tableName = table->text;
+        if (!accept(parser, TOKEN_WORD, "if")) {
+            reportError("Error: Invalid syntax. Missing 'if' keyword.\n");
+            return false;
+        }
+        return parseConditionClause(parser, "if") && expectEnd(parser);
+    }
+
+    if (tokenIs(keyword, TOKEN_WORD, "editValue")) {
+        statement->kind = STMT_UPDATE;
+        if (table->type != TOKEN_WORD) {
+            reportError("Error: Invalid syntax. Expected 'set' after table name.\n");
+            return false;
+        }
+        statement->tableName = table->text;
+        if (!accept(parser, TOKEN_WORD, "set")) {
+            reportError("Error: Invalid syntax. Expected 'set' after table name.\n");
+            return false;
+        }
+        Token *column = next(parser);
+        Token *equalsSign = next(parser);
+        Token *value = next(parser);
+        if (column->type != TOKEN_WORD || !tokenIs(equalsSign, TOKEN_SYMBOL, "=") || !isValueToken(value)) {
+            reportError("Error: Invalid syntax. Expected 'ColumnName = \"NewValue\"'.\n");
+            return false;
+        }
+        statement->columnName = column->text;
+        setOperand(parser, &statement->newValue, value);
+        if (accept(parser, TOKEN_WORD, "if") && !parseConditionClause(parser, "if")) {
+            return false;
+        }
+        return expectEnd(parser);
+    }
+
+    reportError("Invalid command.\n");
+    return false;
+}
+
+bool parseStatement(const char *text, Statement *statement) {
+    memset(statement, 0, sizeof(Statement));
+    statement->newValue.parameter = statement->low.parameter = statement->high.parameter = -1;
+    statement->limit.parameter = statement->offset.parameter = -1;
+    statement->source = strdup(text);
+    if (!statement->source || !tokenize(text, &statement->tokens)) {
+        free(statement->source);
+        statement->source = NULL;
+        return false;
+    }
+
+    Parser parser = {statement, statement->tokens.tokens};
+    if (!parseTokens(&parser)) {
+        freeStatement(statement);
+        return false;
+    }
+    return true;
+}
+
+static void typeOperand(const Column *column, Operand *operand) {
+    if (operand->parameter < 0) {
+        parseValue(column, operand->text, &operand->value);
+    }
+}
+
+static bool parseRows(const char *text, const char *clause, int *rows) {
+    char *end;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end || value < 0 || value > INT_MAX) {
+        reportError("Error: Invalid %s '%s'. Expected a non-negative number of rows.\n", clause, text);
+        return false;
+    }
+    *rows = value;
+    return true;
+}
+
+// Finds the column called name, which may be qualified as Table.Column, in
+// the table of statement or the joined table, and sets side to 0 or 1 for
+// which one it is in. Unqualified names must be in only one of them.
+static Column *resolveColumn(Statement *statement, const char *name, int *side) {
+    Table *tables[2] = {statement->table, statement->joinTable};
+    const char *dot = strchr(name, '.');
+    if (dot) {
+        for (int t = 0; t < 2; t++) {
+            if (tables[t] && strlen(tables[t]->tableName) == (size_t)(dot - name) && strncmp(tables[t]->tableName, name, dot - name) == 0) {
+                Column *column = findColumn(tables[t], dot + 1);
+                if (!column) {
+                    reportError("Error: Column '%s' not found in table '%s'.\n", dot + 1, tables[t]->tableName);
+                }
+                *side = t;
+                return column;
+            }
+        }
+        reportError("Error: Table '%.*s' is not part of this query.\n", (int)(dot - name), name);
+        return NULL;
+    }
+
+    Column *column = findColumn(tables[0], name);
+    *side = 0;
+    if (tables[1]) {
+        Column *joinColumn = findColumn(tables[1], name);
+        if (column && joinColumn) {
+            reportError("Error: Column '%s' is in both '%s' and '%s'. Write it as Table.%s.\n", name, tables[0]->tableName, tables[1]->tableName, name);
+            return NULL;
+        }
+        if (joinColumn) {
+            *side = 1;
+            return joinColumn;
+        }
+    }
+    if (!column) {
+        reportError("Error: Column '%s' not found in table '%s'%s%s.\n", name, tables[0]->tableName, tables[1] ? " or " : "", tables[1] ? tables[1]->tableName : "");
+    }
+    return column;
+}
+
+// '*' stands for every column of the table, then of the joined table.
+static bool resolveProjection(Statement *statement) {
+    Table *table = statement->table;
+    Table *joinTable = statement->joinTable;
+    int tableColumns = table->columnCount + (joinTable ? joinTable->columnCount : 0);
+    int count = statement->itemCount > 0 ? statement->itemCount : tableColumns;
+    free(statement->projected);
+    free(statement->projectedSides);
+    statement->projected = malloc((count > 0 ? count : 1) * sizeof(Column *));
+    statement->projectedSides = malloc((count > 0 ? count : 1) * sizeof(int));
+    if (!statement->projected || !statement->projectedSides) {
+        reportError("Error: Memory allocation failed while resolving command.\n");
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        if (statement->itemCount > 0) {
+            if (!(statement->projected[i] = resolveColumn(statement, statement->items[i].columnName, &statement->projectedSides[i]))) {
+                return false;
+            }
+        } else if (i < table->columnCount) {
+            statement->projected[i] = &table->columns[i];
+            statement->projectedSides[i] = 0;
+        } else {
+            statement->projected[i] = &joinTable->columns[i - table->columnCount];
+            statement->projectedSides[i] = 1;
+        }
+    }
+    statement->projectedCount = count;
+    return true;
+}
+
+static const char *typeName(DataType type) {
+    return type == INT ? "int" : type == FLOAT ? "float" : "string";
+}
+
+// Looks up the joined table and the key on each side of 'on'.
+static bool resolveJoin(Statement *statement, Database *db) {
+    statement->joinTable = NULL;
+    if (!statement->joinTableName) {
+        return true;
+    }
+    Table *joinTable = findTable(db, statement->joinTableName);
+    if (!joinTable || !ensureTableLoaded(joinTable)) {
+        reportError("Error: Table '%s' not found in database '%s'.\n", statement->joinTableName, db->name);
+        return false;
+    }
+    if (joinTable == statement->table) {
+        reportError("Error: A table cannot be joined with itself.\n");
+        return false;
+    }
+    if (statement->isAggregate) {
+        reportError("Error: Aggregates and 'group by' cannot be used with 'join'.\n");
+        return false;
+    }
+    statement->joinTable = joinTable;
+
+    int leftSide, rightSide;
+    Column *left = resolveColumn(statement, statement->joinLeftName, &leftSide);
+    Column *right = left ? resolveColumn(statement, statement->joinRightName, &rightSide) : NULL;
+    if (!right) {
+        return false;
+    }
+    if (leftSide == rightSide) {
+        reportError("Error: 'on' must compare a column of '%s' with a column of '%s'.\n", statement->table->tableName, joinTable->tableName);
+        return false;
+    }
+    if (left->type != right->type) {
+        reportError("Error: Cannot join %s column '%s' with %s column '%s'.\n", typeName(left->type), left->name, typeName(right->type), right->name);
+        return false;
+    }
+    statement->leftKey = leftSide == 0 ? left : right;
+    statement->rightKey = leftSide == 0 ? right : left;
+    return true;
+}
+
+// Checks that every plain output column is grouped on and that sum and avg
+// are over numbers.
+static bool resolveAggregates(Statement *statement) {
+    if (statement->itemCount == 0) {
+        reportError("Error: '*' cannot be combined with 'group by'. List the columns instead.\n");
+        return false;
+    }
+    free(statement->grouped);
+    free(statement->outputs);
+    statement->grouped = malloc((statement->groupByCount > 0 ? statement->groupByCount : 1) * sizeof(Column *));
+    statement->outputs = malloc(statement->itemCount * sizeof(AggregateOutput));
+    if (!statement->grouped || !statement->outputs) {
+        reportError("Error: Memory allocation failed while resolving command.\n");
+        return false;
+    }
+    for (int i = 0; i < statement->groupByCount; i++) {
+        int side;
+        if (!(statement->grouped[i] = resolveColumn(statement, statement->groupBy[i], &side))) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < statement->itemCount; i++) {
+        const SelectItem *item = &statement->items[i];
+        AggregateOutput *output = &statement->outputs[i];
+        output->kind = item->aggregate;
+        output->column = NULL;
+        int side;
+        if (item->columnName && !(output->column = resolveColumn(statement, item->columnName, &side))) {
+            return false;
+        }
+
+        if (output->kind == AGG_NONE) {
+            bool grouped = false;
+            for (int g = 0; g < statement->groupByCount; g++) {
+                grouped |= statement->grouped[g] == output->column;
+            }
+            if (!grouped) {
+                reportError("Error: Column '%s' must be in 'group by' or inside an aggregate.\n", output->column->name);
+                return false;
+            }
+        } else if ((output->kind == AGG_SUM || output->kind == AGG_AVG) && output->column->type == STRING) {
+            reportError("Error: %s() needs an int or float column, but '%s' is a string.\n", aggregateName(output->kind), output->column->name);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sort keys of a plain select may be any column of the table.
+static bool resolveOrderColumns(Statement *statement) {
+    free(statement->orderColumns);
+    statement->orderColumns = malloc((statement->orderByCount > 0 ? statement->orderByCount : 1) * sizeof(OrderColumn));
+    if (!statement->orderColumns) {
+        reportError("Error: Memory allocation failed while resolving command.\n");
+        return false;
+    }
+    for (int i = 0; i < statement->orderByCount; i++) {
+        const OrderItem *order = &statement->orderBy[i];
+        if (order->item.aggregate != AGG_NONE) {
+            reportError("Error: Cannot order by %s() without aggregates in 'select' or a 'group by'.\n", aggregateName(order->item.aggregate));
+            return false;
+        }
+        statement->orderColumns[i].descending = order->descending;
+        if (!(statement->orderColumns[i].column = resolveColumn(statement, order->item.columnName, &statement->orderColumns[i].side))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sort keys of an aggregate query must be among its outputs.
+static bool resolveOutputOrder(Statement *statement) {
+    free(statement->outputOrder);
+    statement->outputOrder = malloc((statement->orderByCount > 0 ? statement->orderByCount : 1) * sizeof(AggregateOrder));
+    if (!statement->outputOrder) {
+        reportError("Error: Memory allocation failed while resolving command.\n");
+        return false;
+    }
+    for (int i = 0; i < statement->orderByCount; i++) {
+        const SelectItem *item = &statement->orderBy[i].item;
+        Column *column = NULL;
+        int side;
+        if (item->columnName && !(column = resolveColumn(statement, item->columnName, &side))) {
+            return false;
+        }
+        int output = 0;
+        while (output < statement->itemCount &&
+               (statement->outputs[output].kind != item->aggregate || statement->outputs[output].column != column)) {
+            output++;
+        }
+        if (output == statement->itemCount) {
+            if (item->aggregate == AGG_NONE) {
+                reportError("Error: 'order by %s' must name one of the selected columns or aggregates.\n", item->columnName);
+            } else {
+                reportError("Error: 'order by %s(%s)' must name one of the selected columns or aggregates.\n",
+                       aggregateName(item->aggregate), item->columnName ? item->columnName : "*");
+            }
+            return false;
+        }
+        statement->outputOrder[i] = (AggregateOrder){output, statement->orderBy[i].descending};
+    }
+    return true;
+}
+
+static void buildCondition(Statement *statement) {
+    Condition *condition = &statement->condition;
+    condition->op = statement->op;
+    condition->value = statement->low.value;
+    condition->valueText = statement->low.value.strValue ? statement->low.value.strValue : statement->low.text;
+    condition->upper = statement->high.value;
+    condition->upperText = statement->high.text;
+}
+
+// Looks up the table and columns named by statement in db and types every
+// literal for its column. Placeholders are typed by bindParameters.
+bool resolveStatement(Statement *statement, Database *db) {
+    if (!db) {
+        reportError("Error: No database selected. Use 'useDatabase' first.\n");
+        return false;
+    }
+    statement->db = NULL;
+    statement->table = findTable(db, statement->tableName);
+    if (!statement->table || !ensureTableLoaded(statement->table)) {
+        reportError("Error: Table '%s' not found in database '%s'.\n", statement->tableName, db->name);
+        return false;
+    }
+    Table *table = statement->table;
+
+    if (statement->kind == STMT_INSERT) {
+        int index = 0;
+        for (int t = 0; t < statement->tupleCount; t++) {
+            if (statement->tupleSizes[t] != table->columnCount) {
+                reportError("Error: Number of values (%d) does not match the number of columns (%d) in table '%s'.\n", statement->tupleSizes[t], table->columnCount, table->tableName);
+                return false;
+            }
+            for (int i = 0; i < table->columnCount; i++) {
+                typeOperand(&table->columns[i], &statement->values[index++]);
+            }
+        }
+    }
+
+    if (statement->kind == STMT_UPDATE) {
+        statement->column = findColumn(table, statement->columnName);
+        if (!statement->column) {
+            reportError("Error: Column '%s' not found in table '%s'.\n", statement->columnName, table->tableName);
+            return false;
+        }
+        typeOperand(statement->column, &statement->newValue);
+    }
+
+    if (statement->kind == STMT_SELECT) {
+        if (!resolveJoin(statement, db)) {
+            return false;
+        }
+        if (statement->isAggregate ? !resolveAggregates(statement) || !resolveOutputOrder(statement)
+                                   : !resolveProjection(statement) || !resolveOrderColumns(statement)) {
+            return false;
+        }
+    }
+
+    if (statement->kind == STMT_SELECT || statement->kind == STMT_DISPLAY) {
+        statement->limitRows = -1;
+        statement->offsetRows = 0;
+        if (statement->hasLimit && statement->limit.parameter < 0 && !parseRows(statement->limit.text, "limit", &statement->limitRows)) {
+            return false;
+        }
+        if (statement->hasOffset && statement->offset.parameter < 0 && !parseRows(statement->offset.text, "offset", &statement->offsetRows)) {
+            return false;
+        }
+    }
+
+    if (statement->hasCondition) {
+        Column *column = resolveColumn(statement, statement->conditionColumn, &statement->conditionSide);
+        if (!column) {
+            return false;
+        }
+        statement->condition.column = column;
+        typeOperand(column, &statement->low);
+        if (statement->op == CMP_BETWEEN) {
+            typeOperand(column, &statement->high);
+        }
+        buildCondition(statement);
+    }
+
+    statement->db = db;
+    statement->catalogVersion = catalogVersion;
+    return true;
+}
+
+// True while the resolved table and columns are still the ones in db.
+bool isResolved(const Statement *statement, const Database *db) {
+    return statement->db && statement->db == db && statement->catalogVersion == catalogVersion && statement->table->loaded &&
+           (!statement->joinTable || statement->joinTable->loaded);
+}
+
+static Operand *operandForParameter(Statement *statement, int parameter, const Column **column) {
+    for (int i = 0; i < statement->valueCount; i++) {
+        if (statement->values[i].parameter == parameter) {
+            *column = &statement->table->columns[i % statement->table->columnCount];
+            return &statement->values[i];
+        }
+    }
+    if (statement->newValue.parameter == parameter) {
+        *column = statement->column;
+        return &statement->newValue;
+    }
+    *column = statement->condition.column;
+    return statement->low.parameter == parameter ? &statement->low : &statement->high;
+}
+
+// Types each argument for the column its placeholder stands for. Arguments
+// must stay valid until the statement has run.
+bool bindParameters(Statement *statement, char **arguments, int argumentCount) {
+    if (argumentCount != statement->parameterCount) {
+        reportError("Error: Statement takes %d argument(s) but %d were given.\n", statement->parameterCount, argumentCount);
+        return false;
+    }
+    for (int i = 0; i < argumentCount; i++) {
+        if (statement->limit.parameter == i || statement->offset.parameter == i) {
+            bool isLimit = statement->limit.parameter == i;
+            if (!parseRows(arguments[i], isLimit ? "limit" : "offset", isLimit ? &statement->limitRows : &statement->offsetRows)) {
+                return false;
+            }
+            continue;
+        }
+        const Column *column;
+        Operand *operand = operandForParameter(statement, i, &column);
+        operand->text = arguments[i];
+        parseValue(column, operand->text, &operand->value);
+    }
+    if (statement->hasCondition) {
+        buildCondition(statement);
+    }
+    return true;
+}
+
+// Returns the statement's source with every ? replaced by its argument as a
+// quoted string, i.e. a command that does the same thing on its own.
+char *renderStatement(const Statement *statement, char **arguments) {
+    size_t length = strlen(statement->source) + 1;
+    for (int i = 0; i < statement->parameterCount; i++) {
+        length += 2 * strlen(arguments[i]) + 2;
+    }
+    char *text = malloc(length);
+    if (!text) {
+        return NULL;
+    }
+
+    char *out = text;
+    int copied = 0, parameter = 0;
+    for (int i = 0; i < statement->tokens.count; i++) {
+        const Token *token = &statement->tokens.tokens[i];
+        if (token->type != TOKEN_PARAM) {
+            continue;
+        }
+        memcpy(out, statement->source + copied, token->offset - copied);
+        out += token->offset - copied;
+        *out++ = '"';
+        for (const char *c = arguments[parameter++]; *c; c++) {
+            if (*c == '"' || *c == '\\') {
+                *out++ = '\\';
+            }
+            *out++ = *c;
+        }
+        *out++ = '"';
+        copied = token->offset + token->length;
+    }
+    strcpy(out, statement->source + copied);
+    return text;
+}
+
+bool isMutatingStatement(const Statement *statement) {
+    return statement->kind != STMT_DISPLAY && statement->kind != STMT_SELECT;
+}
+
+void freeStatement(Statement *statement) {
+    free(statement->source);
+    free(statement->values);
+    free(statement->tupleSizes);
+    free(statement->spans);
+    free(statement->items);
+    free(statement->groupBy);
+    free(statement->projected);
+    free(statement->outputs);
+    free(statement->grouped);
+    free(statement->orderBy);
+    free(statement->orderColumns);
+    free(statement->outputOrder);
+    free(statement->projectedSides);
+    freeTokenList(&statement->tokens);
+    statement->source = NULL;
+    statement->values = NULL;
+    statement->tupleSizes = NULL;
+    statement->spans = NULL;
+    statement->items = NULL;
+    statement->groupBy = NULL;
+    statement->projected = NULL;
+    statement->outputs = NULL;
+    statement->grouped = NULL;
+    statement->orderBy = NULL;
+    statement->orderColumns = NULL;
+    statement->outputOrder = NULL;
+    statement->projectedSides = NULL;
+}
@@ -0,0 +1,125 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "lexer.h"
+#include "filter.h"
+#include "aggregate.h"
+
+typedef enum { STMT_INSERT, STMT_UPDATE, STMT_DELETE, STMT_DISPLAY, STMT_SELECT } StatementKind;
+
+// A value in a statement: either a literal or a ? placeholder. Literals are
+// typed once when the statement is resolved, placeholders when arguments are
+// bound.
+typedef struct {
+    char *text;
+    int parameter;
+    Value value;
+} Operand;
+
+// A select output: a column, or an aggregate over a column. columnName is
+// NULL for count(*).
+typedef struct {
+    AggregateKind aggregate;
+    const char *columnName;
+} SelectItem;
+
+// One key of an order by clause.
+typedef struct {
+    SelectItem item;
+    bool descending;
+} OrderItem;
+
+// A resolved sort key of a plain select. side is 1 when column belongs to the
+// joined table.
+typedef struct {
+    Column *column;
+    int side;
+    bool descending;
+} OrderColumn;
+
+// Parsed form of insertValues, editValue, deleteValue, displayTable and select.
+// parseStatement fills in the names and operands; resolveStatement looks up
+// the table and columns and types the literals, so a prepared statement only
+// pays for that once.
+typedef struct {
+    StatementKind kind;
+    char *source;
+    TokenList tokens;
+    int parameterCount;
+
+    const char *tableName;
+
+    // insertValues: tupleCount tuples, tupleSizes[t] operands each. Unquoted
+    // values of several words are copied from source into spans.
+    Operand *values;
+    int *tupleSizes;
+    int valueCount;
+    int tupleCount;
+    char *spans;
+    int spansUsed;
+
+    // editValue: columnName = newValue.
+    const char *columnName;
+    Operand newValue;
+
+    // select: output items, none for '*', grouping columns, sort keys and an
+    // optional limit. isAggregate is set by any aggregate or a group by
+    // clause.
+    SelectItem *items;
+    int itemCount;
+    const char **groupBy;
+    int groupByCount;
+    OrderItem *orderBy;
+    int orderByCount;
+    bool isAggregate;
+    bool hasLimit;
+    Operand limit;
+
+    // select with 'join joinTableName on joinLeftName = joinRightName'.
+    // Column names may be qualified as Table.Column.
+    const char *joinTableName;
+    const char *joinLeftName;
+    const char *joinRightName;
+
+    // displayTable: optional limit as above, offset and the stream option.
+    bool hasOffset;
+    Operand offset;
+    bool stream;
+
+    // Optional 'if' clause of editValue and 'where' clause of select,
+    // required for deleteValue.
+    bool hasCondition;
+    const char *conditionColumn;
+    CompareOp op;
+    Operand low;
+    Operand high;
+
+    Database *db;
+    Table *table;
+    Column *column;
+    Condition condition;
+    Column **projected;
+    int projectedCount;
+    Table *joinTable;
+    Column *leftKey;
+    Column *rightKey;
+    int *projectedSides;
+    int conditionSide;
+    AggregateOutput *outputs;
+    Column **grouped;
+    OrderColumn *orderColumns;
+    AggregateOrder *outputOrder;
+    int limitRows;
+    int offsetRows;
+    unsigned long catalogVersion;
+} Statement;
+
+bool parseStatement(const char *text, Statement *statement);
+bool resolveStatement(Statement *statement, Database *db);
+bool isResolved(const Statement *statement, const Database *db);
+bool bindParameters(Statement *statement, char **arguments, int argumentCount);
+char *renderStatement(const Statement *statement, char **arguments);
+bool isMutatingStatement(const Statement *statement);
+void freeStatement(Statement *statement);
+
+#endif
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "pool.h"
+#include "stats.h"
+
+#define CLASS_COUNT (1 + (64 - 4) * 4)
+
+typedef struct FreeBlock {
+    struct FreeBlock *next;
+} FreeBlock;
+
+static FreeBlock *freeLists[CLASS_COUNT];
+static size_t cachedBytes = 0;
+static size_t liveBytes = 0;
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Maps size to its class index and the rounded block size of that class.
+// Steps are at least 8 bytes so blocks carved from a slab stay aligned for
+// the free list pointer and 8-byte values.
+static int sizeClass(size_t size, size_t *classSize) {
+    if (size <= 16) {
+        *classSize = 16;
+        return 0;
+    }
+    int shift = 63 - __builtin_clzll(size - 1);
+    size_t base = (size_t)1 << shift;
+    size_t step = base >= 32 ? base >> 2 : 8;
+    size_t sub = (size - base + step - 1) / step;
+    *classSize = base + sub * step;
+    return 1 + (shift - 4) * 4 + (int)(sub - 1);
+}
+
+static bool refillFromSlab(int index, size_t classSize) {
+    char *slab = malloc(POOL_SLAB_SIZE);
+    if (!slab) {
+        return false;
+    }
+    for (size_t offset = 0; offset + classSize <= POOL_SLAB_SIZE; offset += classSize) {
+        FreeBlock *block = (FreeBlock *)(slab + offset);
+        block->next = freeLists[index];
+        freeLists[index] = block;
+        cachedBytes += classSize;
+    }
+    return true;
+}
+
+void *poolAlloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    size_t classSize;
+    int index = sizeClass(size, &classSize);
+    countStat(STAT_ALLOCATIONS, 1);
+    countStat(STAT_ALLOCATED_BYTES, classSize);
+
+    pthread_mutex_lock(&poolLock);
+    if (!freeLists[index] && classSize <= POOL_SMALL_BLOCK && !refillFromSlab(index, classSize)) {
+        pthread_mutex_unlock(&poolLock);
+        return NULL;
+    }
+    FreeBlock *block = freeLists[index];
+    if (block) {
+        freeLists[index] = block->next;
+        cachedBytes -= classSize;
+    }
+    pthread_mutex_unlock(&poolLock);
+
+    void *allocated = block ? (void *)block : malloc(classSize);
+    if (allocated) {
+        __atomic_fetch_add(&liveBytes, classSize, __ATOMIC_RELAXED);
+    }
+    return allocated;
+}
+
+void poolFree(void *block, size_t size) {
+    if (!block) {
+        return;
+    }
+
+    size_t classSize;
+    int index = sizeClass(size, &classSize);
+    __atomic_fetch_sub(&liveBytes, classSize, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&poolLock);
+    if (classSize <= POOL_SMALL_BLOCK || cachedBytes + classSize <= POOL_CACHE_LIMIT) {
+        FreeBlock *freed = block;
+        freed->next = freeLists[index];
+        freeLists[index] = freed;
+        cachedBytes += classSize;
+        block = NULL;
+    }
+    pthread_mutex_unlock(&poolLock);
+
+    free(block);
+}
+
+// Moves block to a block of newSize bytes, keeping the common prefix. The old
+// block is left untouched when allocation fails. Large blocks grow in place
+// through realloc unless a cached block of the new class is available, so
+// growing a column does not leave its previous vector parked in the cache.
+void *poolResize(void *block, size_t oldSize, size_t newSize) {
+    if (newSize == 0) {
+        poolFree(block, oldSize);
+        return NULL;
+    }
+    if (!block) {
+        return poolAlloc(newSize);
+    }
+
+    size_t oldClass, newClass;
+    int oldIndex = sizeClass(oldSize, &oldClass);
+    int newIndex = sizeClass(newSize, &newClass);
+    if (oldIndex == newIndex) {
+        return block;
+    }
+
+    if (oldClass > POOL_SMALL_BLOCK && newClass > POOL_SMALL_BLOCK) {
+        countStat(STAT_ALLOCATIONS, 1);
+        countStat(STAT_ALLOCATED_BYTES, newClass);
+        pthread_mutex_lock(&poolLock);
+        FreeBlock *cached = freeLists[newIndex];
+        if (cached) {
+            freeLists[newIndex] = cached->next;
+            cachedBytes -= newClass;
+        }
+        pthread_mutex_unlock(&poolLock);
+
+        void *resized = cached;
+        if (cached) {
+            memcpy(cached, block, oldSize < newSize ? oldSize : newSize);
+            free(block);
+        } else {
+            resized = realloc(block, newClass);
+        }
+        if (resized) {
+            __atomic_fetch_add(&liveBytes, newClass - oldClass, __ATOMIC_RELAXED);
+        }
+        return resized;
+    }
+
+    void *resized = poolAlloc(newSize);
+    if (!resized) {
+        return NULL;
+    }
+    memcpy(resized, block, oldSize < newSize ? oldSize : newSize);
+    poolFree(block, oldSize);
+    return resized;
+}
+
+size_t poolLiveBytes(void) {
+    return __atomic_load_n(&liveBytes, __ATOMIC_RELAXED);
+}
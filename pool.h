@@ -0,0 +1,21 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Size-class allocator for table storage. Blocks are rounded up to one of four
+// classes per power of two. Blocks of up to POOL_SMALL_BLOCK bytes are carved
+// from shared slabs; larger freed blocks are kept for reuse up to
+// POOL_CACHE_LIMIT bytes and returned to the system beyond that.
+#define POOL_SMALL_BLOCK 4096
+#define POOL_SLAB_SIZE (256 * 1024)
+#define POOL_CACHE_LIMIT ((size_t)16 << 20)
+
+void *poolAlloc(size_t size);
+void *poolResize(void *block, size_t oldSize, size_t newSize);
+void poolFree(void *block, size_t size);
+
+// Bytes of the blocks handed out and not yet freed, at their class sizes.
+size_t poolLiveBytes(void);
+
+#endif
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scan.h"
+#include "output.h"
+#include "stats.h"
+
+// Starts a scan of table. condition may be NULL to select every row.
+bool openScan(Scan *scan, const Table *table, const Condition *condition) {
+    scan->table = table;
+    scan->condition = condition;
+    scan->indexRows = NULL;
+    scan->indexRowCount = 0;
+    scan->position = 0;
+    scan->count = 0;
+
+    if (condition && (condition->column->primaryIndex || condition->column->orderedIndex)) {
+        scan->indexRows = malloc((table->rowCount > 0 ? table->rowCount : 1) * sizeof(int));
+        if (!scan->indexRows) {
+            reportError("Error: Memory allocation failed while scanning table '%s'.\n", table->tableName);
+            return false;
+        }
+        scan->indexRowCount = findMatchingRows(table, condition, scan->indexRows);
+    }
+    return true;
+}
+
+// Fills the selection vector with the next batch. Returns false once the
+// table is exhausted; a batch may be empty when no row of its block matched.
+bool nextScanBatch(Scan *scan) {
+    if (scan->indexRows) {
+        int remaining = scan->indexRowCount - scan->position;
+        if (remaining <= 0) {
+            return false;
+        }
+        scan->count = remaining < SCAN_BATCH_ROWS ? remaining : SCAN_BATCH_ROWS;
+        memcpy(scan->rows, scan->indexRows + scan->position, scan->count * sizeof(int));
+        scan->position += scan->count;
+        return true;
+    }
+
+    int remaining = scan->table->rowCount - scan->position;
+    if (remaining <= 0) {
+        return false;
+    }
+    int blockRows = remaining < SCAN_BATCH_ROWS ? remaining : SCAN_BATCH_ROWS;
+    if (scan->condition) {
+        scan->count = filterBlock(scan->condition, scan->position, blockRows, scan->rows);
+    } else {
+        for (int i = 0; i < blockRows; i++) {
+            scan->rows[i] = scan->position + i;
+        }
+        scan->count = blockRows;
+        countStat(STAT_ROWS_SCANNED, blockRows);
+    }
+    scan->position += blockRows;
+    return true;
+}
+
+void closeScan(Scan *scan) {
+    free(scan->indexRows);
+    scan->indexRows = NULL;
+}
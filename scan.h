@@ -0,0 +1,27 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "filter.h"
+
+#define SCAN_BATCH_ROWS 1024
+
+// Batch-at-a-time scan of one table. Each nextScanBatch call evaluates the
+// condition over the next block of up to SCAN_BATCH_ROWS rows and leaves the
+// matching row numbers, ascending, in the selection vector rows[0..count).
+// When the condition column is indexed, the index answers the condition up
+// front and the batches walk its result instead.
+typedef struct {
+    const Table *table;
+    const Condition *condition;
+    int *indexRows;
+    int indexRowCount;
+    int position;
+    int rows[SCAN_BATCH_ROWS];
+    int count;
+} Scan;
+
+bool openScan(Scan *scan, const Table *table, const Condition *condition);
+bool nextScanBatch(Scan *scan);
+void closeScan(Scan *scan);
+
+#endif
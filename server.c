@@ -0,0 +1,597 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "server.h"
+#include "output.h"
+
+#define MAX_EVENTS 64
+#define READ_CHUNK (64 * 1024)
+// Largest request accepted; a client sending more is disconnected.
+#define MAX_REQUEST_SIZE (64 * 1024 * 1024)
+#define FRAME_HEADER_SIZE 5
+
+// One connection. Requests accumulate in input until a whole frame is there.
+// While a response is being sent, resultFd holds the command's output and the
+// connection waits for the socket to drain before running its next request.
+typedef struct {
+    int fd;
+    char *input;
+    size_t inputLength;
+    size_t inputCapacity;
+    unsigned char header[FRAME_HEADER_SIZE];
+    int headerSent;
+    int resultFd;
+    off_t resultOffset;
+    off_t resultLength;
+    bool sending;
+    bool busy;
+    bool closing;
+    bool peerClosed;
+} Client;
+
+// A read handed to the reader threads. Its output goes to outputFd, which
+// becomes the client's response once the loop thread collects the task.
+typedef struct ReadTask {
+    Client *client;
+    void *job;
+    int outputFd;
+    bool failed;
+    struct ReadTask *next;
+} ReadTask;
+
+// Reader threads take tasks from pending in order and put them on done,
+// then signal wakeFd so the loop thread collects them.
+typedef struct {
+    const CommandHandlers *handlers;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    ReadTask *pending;
+    ReadTask *pendingTail;
+    ReadTask *done;
+    bool stopping;
+    int wakeFd;
+    pthread_t *threads;
+    int threadCount;
+} ReaderPool;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int signalNumber) {
+    (void)signalNumber;
+    stopRequested = 1;
+}
+
+static bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static int openListener(const char *socketPath, int port) {
+    int fd;
+    if (socketPath) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(socketPath) >= sizeof(address.sun_path)) {
+            reportError("Error: Socket path '%s' is too long.\n", socketPath);
+            return -1;
+        }
+        strcpy(address.sun_path, socketPath);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            perror("Error creating socket");
+            return -1;
+        }
+        unlink(socketPath);
+        if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+            perror("Error binding socket");
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons((uint16_t)port);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            perror("Error creating socket");
+            return -1;
+        }
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+            perror("Error binding socket");
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, SOMAXCONN) != 0 || !setNonBlocking(fd)) {
+        perror("Error listening on socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void *readerThread(void *argument) {
+    ReaderPool *pool = argument;
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->pending && !pool->stopping) {
+            pthread_cond_wait(&pool->ready, &pool->lock);
+        }
+        ReadTask *task = pool->pending;
+        if (!task) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pool->pending = task->next;
+        if (!pool->pending) {
+            pool->pendingTail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        int outputFd = dup(task->outputFd);
+        FILE *stream = outputFd >= 0 ? fdopen(outputFd, "w") : NULL;
+        if (stream) {
+            setvbuf(stream, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+            setCommandOutput(stream);
+            unsigned long errorsBefore = threadReportedErrors();
+            pool->handlers->runRead(task->job);
+            task->failed = threadReportedErrors() != errorsBefore;
+            setCommandOutput(NULL);
+            fclose(stream);
+        } else {
+            if (outputFd >= 0) {
+                close(outputFd);
+            }
+            task->failed = true;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        task->next = pool->done;
+        pool->done = task;
+        pthread_mutex_unlock(&pool->lock);
+        uint64_t one = 1;
+        if (write(pool->wakeFd, &one, sizeof(one)) < 0) {
+            perror("Error waking the server loop");
+        }
+    }
+}
+
+static bool startReaders(ReaderPool *pool, int threadCount, const CommandHandlers *handlers) {
+    memset(pool, 0, sizeof(*pool));
+    pool->handlers = handlers;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->ready, NULL);
+    pool->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pool->wakeFd < 0) {
+        perror("Error creating eventfd");
+        return false;
+    }
+    pool->threads = malloc((threadCount > 0 ? threadCount : 1) * sizeof(pthread_t));
+    for (int i = 0; pool->threads && i < threadCount; i++) {
+        if (pthread_create(&pool->threads[i], NULL, readerThread, pool) != 0) {
+            break;
+        }
+        pool->threadCount++;
+    }
+    return true;
+}
+
+static void submitRead(ReaderPool *pool, ReadTask *task) {
+    task->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->pendingTail) {
+        pool->pendingTail->next = task;
+    } else {
+        pool->pending = task;
+    }
+    pool->pendingTail = task;
+    pthread_cond_signal(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static ReadTask *takeFinishedReads(ReaderPool *pool) {
+    uint64_t count;
+    if (read(pool->wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("Error reading eventfd");
+    }
+    pthread_mutex_lock(&pool->lock);
+    ReadTask *done = pool->done;
+    pool->done = NULL;
+    pthread_mutex_unlock(&pool->lock);
+    return done;
+}
+
+// Waits for the reader threads to finish their current tasks. Tasks that
+// never ran are finished unrun.
+static void stopReaders(ReaderPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    ReadTask *pending = pool->pending;
+    pool->pending = pool->pendingTail = NULL;
+    pthread_cond_broadcast(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->threadCount; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+
+    ReadTask *done = pool->done;
+    for (int pass = 0; pass < 2; pass++) {
+        ReadTask *task = pass == 0 ? pending : done;
+        while (task) {
+            ReadTask *next = task->next;
+            pool->handlers->finishRead(task->job);
+            close(task->outputFd);
+            task->client->busy = false;
+            free(task);
+            task = next;
+        }
+    }
+    close(pool->wakeFd);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->ready);
+}
+
+static void watchClient(int epollFd, Client *client, int operation) {
+    struct epoll_event event;
+    event.events = client->sending ? EPOLLOUT : client->busy ? 0 : EPOLLIN;
+    event.data.ptr = client;
+    epoll_ctl(epollFd, operation, client->fd, &event);
+}
+
+static void closeClient(Client *client) {
+    close(client->fd);
+    if (client->resultFd >= 0) {
+        close(client->resultFd);
+    }
+    free(client->input);
+    client->fd = -1;
+}
+
+static void startResponse(Client *client, int resultFd, off_t length, bool failed) {
+    uint32_t frameLength = (uint32_t)length;
+    client->header[0] = (unsigned char)(frameLength >> 24);
+    client->header[1] = (unsigned char)(frameLength >> 16);
+    client->header[2] = (unsigned char)(frameLength >> 8);
+    client->header[3] = (unsigned char)frameLength;
+    client->header[4] = failed ? 1 : 0;
+    client->headerSent = 0;
+    client->resultFd = resultFd;
+    client->resultOffset = 0;
+    client->resultLength = length;
+    client->sending = true;
+}
+
+// Runs command with its output sent to a memory file, which becomes the
+// response. A read the handler hands back is queued for the reader threads
+// instead, with the same file for its output, and the client waits for it.
+// Returns false if the output could not be captured.
+static bool captureCommand(Client *client, ReaderPool *pool, char *command) {
+    int resultFd = memfd_create("result", MFD_CLOEXEC);
+    if (resultFd < 0) {
+        perror("Error creating result buffer");
+        return false;
+    }
+    int outputFd = dup(resultFd);
+    FILE *stream = outputFd >= 0 ? fdopen(outputFd, "w") : NULL;
+    if (!stream) {
+        perror("Error opening result buffer");
+        if (outputFd >= 0) {
+            close(outputFd);
+        }
+        close(resultFd);
+        return false;
+    }
+
+    setvbuf(stream, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    setCommandOutput(stream);
+    unsigned long errorsBefore = threadReportedErrors();
+    void *job = NULL;
+    if (!pool->handlers->run(command, pool->threadCount > 0 ? &job : NULL)) {
+        client->closing = true;
+    }
+    bool failed = threadReportedErrors() != errorsBefore;
+    setCommandOutput(NULL);
+    fclose(stream);
+
+    if (job) {
+        ReadTask *task = malloc(sizeof(ReadTask));
+        if (!task) {
+            pool->handlers->finishRead(job);
+            close(resultFd);
+            return false;
+        }
+        task->client = client;
+        task->job = job;
+        task->outputFd = resultFd;
+        task->failed = false;
+        client->busy = true;
+        submitRead(pool, task);
+        return true;
+    }
+
+    off_t length = lseek(resultFd, 0, SEEK_END);
+    if (length < 0 || length > UINT32_MAX) {
+        close(resultFd);
+        return false;
+    }
+    startResponse(client, resultFd, length, failed);
+    return true;
+}
+
+// Sends as much of the pending response as the socket takes. Returns false
+// when the connection failed.
+static bool sendResult(Client *client) {
+    while (client->headerSent < FRAME_HEADER_SIZE) {
+        ssize_t sent = send(client->fd, client->header + client->headerSent,
+                            FRAME_HEADER_SIZE - client->headerSent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        client->headerSent += (int)sent;
+    }
+    while (client->resultOffset < client->resultLength) {
+        ssize_t sent = sendfile(client->fd, client->resultFd, &client->resultOffset,
+                                client->resultLength - client->resultOffset);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        if (sent == 0) {
+            return false;
+        }
+    }
+    close(client->resultFd);
+    client->resultFd = -1;
+    client->sending = false;
+    return true;
+}
+
+// Runs the complete requests waiting in the client's input, one at a time,
+// until one has to wait for the socket or a reader thread. Returns false when
+// the connection should be closed: the client disconnected or asked to, and
+// every response has been sent.
+static bool serveRequests(Client *client, ReaderPool *pool) {
+    size_t start = 0;
+    bool open = true;
+    while (!client->sending && !client->busy && !client->closing && client->inputLength - start >= 4) {
+        const unsigned char *bytes = (const unsigned char *)client->input + start;
+        size_t length = ((size_t)bytes[0] << 24) | ((size_t)bytes[1] << 16) |
+                        ((size_t)bytes[2] << 8) | (size_t)bytes[3];
+        if (length > MAX_REQUEST_SIZE) {
+            return false;
+        }
+        if (client->inputLength - start < 4 + length) {
+            break;
+        }
+
+        // The command is run in place, with a terminator standing in for the
+        // first byte after it. readRequests always leaves room for one.
+        char *command = client->input + start + 4;
+        start += 4 + length;
+        char saved = start < client->inputLength ? client->input[start] : '\0';
+        client->input[start] = '\0';
+        bool captured = captureCommand(client, pool, command);
+        client->input[start] = saved;
+        if (!captured || (client->sending && !sendResult(client))) {
+            open = false;
+            break;
+        }
+    }
+    if (start > 0) {
+        client->inputLength -= start;
+        memmove(client->input, client->input + start, client->inputLength);
+    }
+    if (!open) {
+        return false;
+    }
+    if (client->closing || client->peerClosed) {
+        return client->sending || client->busy;
+    }
+    return true;
+}
+
+// Reads what the socket has. Returns false when the connection failed.
+static bool readRequests(Client *client) {
+    while (1) {
+        if (client->inputCapacity - client->inputLength < READ_CHUNK) {
+            size_t capacity = client->inputCapacity ? client->inputCapacity * 2 : READ_CHUNK * 2;
+            char *input = realloc(client->input, capacity);
+            if (!input) {
+                return false;
+            }
+            client->input = input;
+            client->inputCapacity = capacity;
+        }
+        ssize_t received = recv(client->fd, client->input + client->inputLength,
+                                client->inputCapacity - client->inputLength - 1, 0);
+        if (received > 0) {
+            client->inputLength += received;
+            if (client->inputLength > MAX_REQUEST_SIZE + 4) {
+                // Serve what is complete before reading more.
+                return true;
+            }
+            continue;
+        }
+        if (received == 0) {
+            client->peerClosed = true;
+            return true;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+}
+
+// Hands finished reads back to their clients, or drops them when the client
+// has gone.
+static void finishReads(ReaderPool *pool, int epollFd) {
+    ReadTask *task = takeFinishedReads(pool);
+    while (task) {
+        ReadTask *next = task->next;
+        Client *client = task->client;
+        pool->handlers->finishRead(task->job);
+        client->busy = false;
+        if (client->fd < 0) {
+            close(task->outputFd);
+        } else {
+            off_t length = lseek(task->outputFd, 0, SEEK_END);
+            bool open = length >= 0 && length <= UINT32_MAX;
+            if (open) {
+                startResponse(client, task->outputFd, length, task->failed);
+                open = sendResult(client) && serveRequests(client, pool);
+            } else {
+                close(task->outputFd);
+            }
+            if (open) {
+                watchClient(epollFd, client, EPOLL_CTL_MOD);
+            } else {
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, client->fd, NULL);
+                closeClient(client);
+            }
+        }
+        free(task);
+        task = next;
+    }
+}
+
+int runServer(const char *socketPath, int port, int readerThreads, const CommandHandlers *handlers) {
+    int listenFd = openListener(socketPath, port);
+    if (listenFd < 0) {
+        return 1;
+    }
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        perror("Error creating epoll instance");
+        close(listenFd);
+        return 1;
+    }
+    ReaderPool pool;
+    if (!startReaders(&pool, readerThreads, handlers)) {
+        close(epollFd);
+        close(listenFd);
+        return 1;
+    }
+    // The listener is tagged with a NULL pointer and the reader pool's
+    // eventfd with the pool itself; every other event is a client.
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+    event.data.ptr = &pool;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, pool.wakeFd, &event);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (socketPath) {
+        printf("Listening on %s.\n", socketPath);
+    } else {
+        printf("Listening on 127.0.0.1:%d.\n", port);
+    }
+    fflush(stdout);
+
+    Client **clients = NULL;
+    int clientCount = 0;
+    int clientCapacity = 0;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (!stopRequested) {
+        int ready = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("Error waiting for clients");
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            if (events[i].data.ptr == &pool) {
+                finishReads(&pool, epollFd);
+                continue;
+            }
+            Client *client = events[i].data.ptr;
+            if (!client) {
+                int fd;
+                while ((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    if (clientCount == clientCapacity) {
+                        clientCapacity = clientCapacity ? clientCapacity * 2 : 16;
+                        clients = realloc(clients, clientCapacity * sizeof(Client *));
+                    }
+                    Client *newClient = calloc(1, sizeof(Client));
+                    newClient->fd = fd;
+                    newClient->resultFd = -1;
+                    if (!socketPath) {
+                        int noDelay = 1;
+                        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+                    }
+                    clients[clientCount++] = newClient;
+                    watchClient(epollFd, newClient, EPOLL_CTL_ADD);
+                }
+                continue;
+            }
+
+            if (client->fd < 0) {
+                continue;
+            }
+            bool open = true;
+            if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN)) {
+                open = false;
+            } else if (client->sending) {
+                open = sendResult(client) && serveRequests(client, &pool);
+            } else if (!client->busy) {
+                open = readRequests(client) && serveRequests(client, &pool);
+            }
+            if (!open) {
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, client->fd, NULL);
+                closeClient(client);
+            } else {
+                watchClient(epollFd, client, EPOLL_CTL_MOD);
+            }
+        }
+
+        // Drop closed connections, once no reader thread is working for them.
+        for (int i = 0; i < clientCount; i++) {
+            if (clients[i]->fd < 0 && !clients[i]->busy) {
+                free(clients[i]);
+                clients[i--] = clients[--clientCount];
+            }
+        }
+    }
+
+    stopReaders(&pool);
+    for (int i = 0; i < clientCount; i++) {
+        if (clients[i]->fd >= 0) {
+            closeClient(clients[i]);
+        }
+        free(clients[i]);
+    }
+    free(clients);
+    close(epollFd);
+    close(listenFd);
+    if (socketPath) {
+        unlink(socketPath);
+    }
+    printf("Server stopped.\n");
+    return 0;
+}
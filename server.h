@@ -0,0 +1,34 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+
+// How the server runs commands. run is called on the loop thread and returns
+// false when the client asked to disconnect. When readJob is not NULL, run
+// may leave a query in it instead of running it; runRead then runs it on a
+// reader thread, with its output going to commandOutput, and finishRead is
+// called on the loop thread once it is done.
+typedef struct {
+    bool (*run)(char *command, void **readJob);
+    void (*runRead)(void *readJob);
+    void (*finishRead)(void *readJob);
+} CommandHandlers;
+
+// Serves clients on a Unix domain socket at socketPath, or on port of the
+// loopback interface when socketPath is NULL, until SIGINT or SIGTERM.
+// One thread runs an epoll loop over every connection and runs the commands
+// from all clients one at a time against the same loaded databases, apart
+// from the queries it hands to readerThreads reader threads.
+//
+// A request is one frame, a response is one frame with the command's output:
+//
+//   request:  uint32 length, length bytes of command text
+//   response: uint32 length, uint8 status, length bytes of output
+//
+// Lengths are big-endian. status is 0, or 1 when the command reported an
+// error. A client may send several requests without waiting; they are
+// answered in order. Returns 0 after a clean shutdown, 1 if the socket could
+// not be opened.
+int runServer(const char *socketPath, int port, int readerThreads, const CommandHandlers *handlers);
+
+#endif
@@ -0,0 +1,231 @@
+#include <string.h>
+#include <limits.h>
+#include "simdfilter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+typedef struct {
+    void (*intRange)(const int *values, int count, int low, int high, uint64_t *mask);
+    void (*floatCompare)(const float *values, int count, FloatTest test, float value, float upper, uint64_t *mask);
+    void (*stringEqual)(const char *slots, int width, int count, const char *value, uint64_t *mask);
+} FilterKernels;
+
+static bool floatPasses(float x, FloatTest test, float value, float upper) {
+    switch (test) {
+        case FLOAT_EQ: return x == value;
+        case FLOAT_LT: return x < value;
+        case FLOAT_LE: return x <= value;
+        case FLOAT_GT: return x > value;
+        case FLOAT_GE: return x >= value;
+        case FLOAT_BETWEEN: return x >= value && x <= upper;
+    }
+    return false;
+}
+
+// The scalar kernels also finish the rows after the last full 64-row word
+// of the vector kernels.
+
+static void intRangeMaskScalar(const int *values, int count, int low, int high, uint64_t *mask) {
+    uint32_t span = (uint32_t)high - (uint32_t)low;
+    for (int base = 0; base < count; base += 64) {
+        int n = count - base < 64 ? count - base : 64;
+        uint64_t bits = 0;
+        for (int i = 0; i < n; i++) {
+            bits |= (uint64_t)((uint32_t)values[base + i] - (uint32_t)low <= span) << i;
+        }
+        mask[base >> 6] = bits;
+    }
+}
+
+static void floatCompareMaskScalar(const float *values, int count, FloatTest test, float value, float upper, uint64_t *mask) {
+    for (int base = 0; base < count; base += 64) {
+        int n = count - base < 64 ? count - base : 64;
+        uint64_t bits = 0;
+        for (int i = 0; i < n; i++) {
+            bits |= (uint64_t)floatPasses(values[base + i], test, value, upper) << i;
+        }
+        mask[base >> 6] = bits;
+    }
+}
+
+static void stringEqualMaskScalar(const char *slots, int width, int count, const char *value, uint64_t *mask) {
+    size_t length = strlen(value) + 1;
+    memset(mask, 0, ((count + 63) / 64) * sizeof(uint64_t));
+    for (int row = 0; row < count; row++) {
+        if (memcmp(slots + (size_t)row * width, value, length) == 0) {
+            mask[row >> 6] |= (uint64_t)1 << (row & 63);
+        }
+    }
+}
+
+static const FilterKernels scalarKernels = {intRangeMaskScalar, floatCompareMaskScalar, stringEqualMaskScalar};
+
+#ifdef HAVE_X86_KERNELS
+
+// x - low, compared unsigned against high - low, tests both ends of the range
+// at once. SSE2 and AVX2 only compare signed, so both sides are offset by
+// INT_MIN first.
+
+static void intRangeMaskSse2(const int *values, int count, int low, int high, uint64_t *mask) {
+    __m128i lowVector = _mm_set1_epi32(low);
+    __m128i signBit = _mm_set1_epi32(INT_MIN);
+    __m128i span = _mm_set1_epi32((int)(((uint32_t)high - (uint32_t)low) ^ 0x80000000u));
+    int words = count / 64;
+    for (int word = 0; word < words; word++) {
+        const int *block = values + word * 64;
+        uint64_t bits = 0;
+        for (int i = 0; i < 16; i++) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(block + i * 4));
+            __m128i offset = _mm_xor_si128(_mm_sub_epi32(x, lowVector), signBit);
+            int outside = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(offset, span)));
+            bits |= (uint64_t)(~outside & 0xf) << (i * 4);
+        }
+        mask[word] = bits;
+    }
+    intRangeMaskScalar(values + words * 64, count - words * 64, low, high, mask + words);
+}
+
+__attribute__((target("avx2")))
+static void intRangeMaskAvx2(const int *values, int count, int low, int high, uint64_t *mask) {
+    __m256i lowVector = _mm256_set1_epi32(low);
+    __m256i signBit = _mm256_set1_epi32(INT_MIN);
+    __m256i span = _mm256_set1_epi32((int)(((uint32_t)high - (uint32_t)low) ^ 0x80000000u));
+    int words = count / 64;
+    for (int word = 0; word < words; word++) {
+        const int *block = values + word * 64;
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; i++) {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(block + i * 8));
+            __m256i offset = _mm256_xor_si256(_mm256_sub_epi32(x, lowVector), signBit);
+            int outside = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(offset, span)));
+            bits |= (uint64_t)(~outside & 0xff) << (i * 8);
+        }
+        mask[word] = bits;
+    }
+    intRangeMaskScalar(values + words * 64, count - words * 64, low, high, mask + words);
+}
+
+// Expands to the loop over full 64-row words, with compare(x) giving the lane
+// mask of one vector of LANES floats.
+#define FLOAT_WORDS(LANES, LOAD, MOVEMASK, compare)                       \
+    for (int word = 0; word < words; word++) {                            \
+        const float *block = values + word * 64;                          \
+        uint64_t bits = 0;                                                \
+        for (int i = 0; i < 64 / LANES; i++) {                            \
+            __typeof__(LOAD(block)) x = LOAD(block + i * LANES);          \
+            bits |= (uint64_t)MOVEMASK(compare) << (i * LANES);           \
+        }                                                                 \
+        mask[word] = bits;                                                \
+    }
+
+static void floatCompareMaskSse2(const float *values, int count, FloatTest test, float value, float upper, uint64_t *mask) {
+    __m128 v = _mm_set1_ps(value);
+    __m128 u = _mm_set1_ps(upper);
+    int words = count / 64;
+    switch (test) {
+        case FLOAT_EQ: FLOAT_WORDS(4, _mm_loadu_ps, _mm_movemask_ps, _mm_cmpeq_ps(x, v)); break;
+        case FLOAT_LT: FLOAT_WORDS(4, _mm_loadu_ps, _mm_movemask_ps, _mm_cmplt_ps(x, v)); break;
+        case FLOAT_LE: FLOAT_WORDS(4, _mm_loadu_ps, _mm_movemask_ps, _mm_cmple_ps(x, v)); break;
+        case FLOAT_GT: FLOAT_WORDS(4, _mm_loadu_ps, _mm_movemask_ps, _mm_cmpgt_ps(x, v)); break;
+        case FLOAT_GE: FLOAT_WORDS(4, _mm_loadu_ps, _mm_movemask_ps, _mm_cmpge_ps(x, v)); break;
+        case FLOAT_BETWEEN: FLOAT_WORDS(4, _mm_loadu_ps, _mm_movemask_ps, _mm_and_ps(_mm_cmpge_ps(x, v), _mm_cmple_ps(x, u))); break;
+    }
+    floatCompareMaskScalar(values + words * 64, count - words * 64, test, value, upper, mask + words);
+}
+
+__attribute__((target("avx2")))
+static void floatCompareMaskAvx2(const float *values, int count, FloatTest test, float value, float upper, uint64_t *mask) {
+    __m256 v = _mm256_set1_ps(value);
+    __m256 u = _mm256_set1_ps(upper);
+    int words = count / 64;
+    switch (test) {
+        case FLOAT_EQ: FLOAT_WORDS(8, _mm256_loadu_ps, _mm256_movemask_ps, _mm256_cmp_ps(x, v, _CMP_EQ_OQ)); break;
+        case FLOAT_LT: FLOAT_WORDS(8, _mm256_loadu_ps, _mm256_movemask_ps, _mm256_cmp_ps(x, v, _CMP_LT_OQ)); break;
+        case FLOAT_LE: FLOAT_WORDS(8, _mm256_loadu_ps, _mm256_movemask_ps, _mm256_cmp_ps(x, v, _CMP_LE_OQ)); break;
+        case FLOAT_GT: FLOAT_WORDS(8, _mm256_loadu_ps, _mm256_movemask_ps, _mm256_cmp_ps(x, v, _CMP_GT_OQ)); break;
+        case FLOAT_GE: FLOAT_WORDS(8, _mm256_loadu_ps, _mm256_movemask_ps, _mm256_cmp_ps(x, v, _CMP_GE_OQ)); break;
+        case FLOAT_BETWEEN: FLOAT_WORDS(8, _mm256_loadu_ps, _mm256_movemask_ps, _mm256_and_ps(_mm256_cmp_ps(x, v, _CMP_GE_OQ), _mm256_cmp_ps(x, u, _CMP_LE_OQ))); break;
+    }
+    floatCompareMaskScalar(values + words * 64, count - words * 64, test, value, upper, mask + words);
+}
+
+// Compares the first strlen(value) + 1 bytes of each slot, terminator
+// included, with one unaligned load per VECTOR bytes. Loads may run past the
+// slot into the following ones, so the last rows, whose loads could leave the
+// block, are compared with memcmp.
+#define STRING_EQUAL_MASK(VECTOR, LOAD, CMPEQ, MOVEMASK)                                  \
+    size_t length = strlen(value) + 1;                                                    \
+    memset(mask, 0, ((count + 63) / 64) * sizeof(uint64_t));                              \
+    if (length > VECTOR) {                                                                \
+        stringEqualMaskScalar(slots, width, count, value, mask);                          \
+        return;                                                                           \
+    }                                                                                     \
+    char padded[VECTOR] = {0};                                                            \
+    memcpy(padded, value, length);                                                        \
+    __typeof__(LOAD(padded)) needle = LOAD(padded);                                       \
+    uint32_t need = length == 32 ? 0xffffffffu : (1u << length) - 1;                      \
+    int vectorRows = count - (VECTOR + width - 1) / width + 1;                            \
+    int row = 0;                                                                          \
+    for (; row < vectorRows; row++) {                                                     \
+        uint32_t equal = (uint32_t)MOVEMASK(CMPEQ(LOAD(slots + (size_t)row * width), needle)); \
+        mask[row >> 6] |= (uint64_t)((equal & need) == need) << (row & 63);               \
+    }                                                                                     \
+    for (; row < count; row++) {                                                          \
+        if (memcmp(slots + (size_t)row * width, value, length) == 0) {                    \
+            mask[row >> 6] |= (uint64_t)1 << (row & 63);                                  \
+        }                                                                                 \
+    }
+
+#define LOAD128(p) _mm_loadu_si128((const __m128i *)(p))
+#define LOAD256(p) _mm256_loadu_si256((const __m256i *)(p))
+
+static void stringEqualMaskSse2(const char *slots, int width, int count, const char *value, uint64_t *mask) {
+    STRING_EQUAL_MASK(16, LOAD128, _mm_cmpeq_epi8, _mm_movemask_epi8)
+}
+
+__attribute__((target("avx2")))
+static void stringEqualMaskAvx2(const char *slots, int width, int count, const char *value, uint64_t *mask) {
+    STRING_EQUAL_MASK(32, LOAD256, _mm256_cmpeq_epi8, _mm256_movemask_epi8)
+}
+
+static const FilterKernels sse2Kernels = {intRangeMaskSse2, floatCompareMaskSse2, stringEqualMaskSse2};
+static const FilterKernels avx2Kernels = {intRangeMaskAvx2, floatCompareMaskAvx2, stringEqualMaskAvx2};
+
+#endif
+
+static const FilterKernels *kernels;
+
+// Picks the widest kernels the CPU runs on first use. Racing threads all pick
+// the same ones.
+static const FilterKernels *filterKernels(void) {
+    const FilterKernels *selected = __atomic_load_n(&kernels, __ATOMIC_RELAXED);
+    if (selected) {
+        return selected;
+    }
+    selected = &scalarKernels;
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        selected = &avx2Kernels;
+    } else if (__builtin_cpu_supports("sse2")) {
+        selected = &sse2Kernels;
+    }
+#endif
+    __atomic_store_n(&kernels, selected, __ATOMIC_RELAXED);
+    return selected;
+}
+
+void intRangeMask(const int *values, int count, int low, int high, uint64_t *mask) {
+    filterKernels()->intRange(values, count, low, high, mask);
+}
+
+void floatCompareMask(const float *values, int count, FloatTest test, float value, float upper, uint64_t *mask) {
+    filterKernels()->floatCompare(values, count, test, value, upper, mask);
+}
+
+void stringEqualMask(const char *slots, int width, int count, const char *value, uint64_t *mask) {
+    filterKernels()->stringEqual(slots, width, count, value, mask);
+}
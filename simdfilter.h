@@ -0,0 +1,24 @@
+#ifndef SIMDFILTER_H
+#define SIMDFILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Comparison kernels over one column vector. Each sets bit i of mask, in
+// 64-bit words, when values[i] passes, for i in [0, count); the unused bits
+// of the last word are cleared. The SSE2 or AVX2 versions are chosen at
+// runtime from what the CPU supports, with a scalar fallback elsewhere.
+
+// low <= values[i] <= high.
+void intRangeMask(const int *values, int count, int low, int high, uint64_t *mask);
+
+typedef enum { FLOAT_EQ, FLOAT_LT, FLOAT_LE, FLOAT_GT, FLOAT_GE, FLOAT_BETWEEN } FloatTest;
+
+// values[i] <test> value, or value <= values[i] <= upper for FLOAT_BETWEEN.
+void floatCompareMask(const float *values, int count, FloatTest test, float value, float upper, uint64_t *mask);
+
+// The string in slot i, slots being width bytes apart, equals value. value
+// must be shorter than width.
+void stringEqualMask(const char *slots, int width, int count, const char *value, uint64_t *mask);
+
+#endif
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+#include "pool.h"
+#include "output.h"
+
+typedef struct RetiredStorage {
+    void *values;
+    size_t bytes;
+    unsigned long epoch;
+    struct RetiredStorage *next;
+} RetiredStorage;
+
+// Snapshots opened now get currentEpoch; each retirement moves it on, so a
+// vector retired at epoch e is still visible exactly to the open snapshots
+// whose epoch is at most e.
+static unsigned long currentEpoch = 1;
+static unsigned long *openEpochs = NULL;
+static int openCount = 0;
+static int openCapacity = 0;
+static RetiredStorage *retired = NULL;
+
+static unsigned long oldestOpenEpoch(void) {
+    unsigned long oldest = (unsigned long)-1;
+    for (int i = 0; i < openCount; i++) {
+        if (openEpochs[i] < oldest) {
+            oldest = openEpochs[i];
+        }
+    }
+    return oldest;
+}
+
+// Frees the retired vectors no open snapshot can reach.
+static void collectRetiredStorage(void) {
+    unsigned long oldest = oldestOpenEpoch();
+    RetiredStorage **link = &retired;
+    while (*link) {
+        RetiredStorage *block = *link;
+        if (block->epoch < oldest) {
+            *link = block->next;
+            poolFree(block->values, block->bytes);
+            free(block);
+        } else {
+            link = &block->next;
+        }
+    }
+}
+
+bool columnIsShared(const Column *column) {
+    return column->sharedEpoch != 0 && openCount > 0 && oldestOpenEpoch() <= column->sharedEpoch;
+}
+
+void retireStorage(void *values, size_t bytes) {
+    if (!values) {
+        return;
+    }
+    RetiredStorage *block = openCount > 0 ? malloc(sizeof(RetiredStorage)) : NULL;
+    if (!block) {
+        poolFree(values, bytes);
+        return;
+    }
+    block->values = values;
+    block->bytes = bytes;
+    block->epoch = currentEpoch++;
+    block->next = retired;
+    retired = block;
+}
+
+static bool copyTable(Table *copy, Table *table, unsigned long epoch) {
+    *copy = *table;
+    memset(&copy->columnMap, 0, sizeof(copy->columnMap));
+    copy->storedColumns = NULL;
+    copy->mappedBase = NULL;
+    copy->columns = malloc((table->columnCount > 0 ? table->columnCount : 1) * sizeof(Column));
+    if (!copy->columns) {
+        return false;
+    }
+    for (int i = 0; i < table->columnCount; i++) {
+        copy->columns[i] = table->columns[i];
+        copy->columns[i].primaryIndex = NULL;
+        copy->columns[i].orderedIndex = NULL;
+        table->columns[i].sharedEpoch = epoch;
+        if (!nameMapInsert(&copy->columnMap, copy->columns[i].name, &copy->columns[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void freeSnapshotTables(Snapshot *snapshot) {
+    for (int i = 0; i < snapshot->db.tableCount; i++) {
+        Table *table = snapshot->db.tables[i];
+        nameMapClear(&table->columnMap);
+        free(table->columns);
+        free(table);
+    }
+    free(snapshot->db.tables);
+    nameMapClear(&snapshot->db.tableMap);
+    memset(&snapshot->db, 0, sizeof(snapshot->db));
+}
+
+// Opens a snapshot of the given loaded tables of db. The tables are found by
+// name in snapshot->db, which statements can be resolved against.
+bool openSnapshot(Snapshot *snapshot, const Database *db, Table *const *tables, int tableCount) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    memcpy(snapshot->db.name, db->name, MAX_NAME_LEN);
+    snapshot->epoch = currentEpoch;
+    snapshot->db.tables = calloc(tableCount > 0 ? tableCount : 1, sizeof(Table *));
+    if (!snapshot->db.tables) {
+        reportError("Error: Memory allocation failed for a snapshot of database '%s'.\n", db->name);
+        return false;
+    }
+    snapshot->db.maxTables = tableCount;
+
+    if (openCount == openCapacity) {
+        int capacity = openCapacity > 0 ? openCapacity * 2 : 16;
+        unsigned long *epochs = realloc(openEpochs, capacity * sizeof(unsigned long));
+        if (!epochs) {
+            reportError("Error: Memory allocation failed for a snapshot of database '%s'.\n", db->name);
+            freeSnapshotTables(snapshot);
+            return false;
+        }
+        openEpochs = epochs;
+        openCapacity = capacity;
+    }
+    openEpochs[openCount++] = snapshot->epoch;
+
+    for (int i = 0; i < tableCount; i++) {
+        Table *copy = calloc(1, sizeof(Table));
+        if (!copy || !copyTable(copy, tables[i], snapshot->epoch)) {
+            if (copy) {
+                nameMapClear(&copy->columnMap);
+                free(copy->columns);
+                free(copy);
+            }
+            reportError("Error: Memory allocation failed for a snapshot of table '%s'.\n", tables[i]->tableName);
+            closeSnapshot(snapshot);
+            return false;
+        }
+        snapshot->db.tables[snapshot->db.tableCount++] = copy;
+        if (!nameMapInsert(&snapshot->db.tableMap, copy->tableName, copy)) {
+            closeSnapshot(snapshot);
+            return false;
+        }
+    }
+    return true;
+}
+
+void closeSnapshot(Snapshot *snapshot) {
+    freeSnapshotTables(snapshot);
+    for (int i = 0; i < openCount; i++) {
+        if (openEpochs[i] == snapshot->epoch) {
+            openEpochs[i] = openEpochs[--openCount];
+            break;
+        }
+    }
+    collectRetiredStorage();
+}
@@ -0,0 +1,36 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "storage.h"
+
+// A read-only view of some tables of a database as they were when the
+// snapshot was opened, so a query can run on another thread while commands
+// keep changing the tables.
+//
+// Opening a snapshot copies the table and column structs but not the column
+// vectors: the copies keep the row count of that moment and point at the same
+// vectors, which are marked shared. Appends write past every snapshot's row
+// count and go ahead in place. A command that would change or move a row a
+// snapshot can see copies the column vector first (unshareColumn), and the
+// old vector is retired rather than freed. Retired vectors are freed once
+// every snapshot that was open when they were retired has been closed.
+//
+// Snapshot tables have no indexes, so queries on them scan. Snapshots are
+// opened and closed on the thread that runs commands; only the queries
+// using them run elsewhere.
+typedef struct {
+    Database db;
+    unsigned long epoch;
+} Snapshot;
+
+bool openSnapshot(Snapshot *snapshot, const Database *db, Table *const *tables, int tableCount);
+void closeSnapshot(Snapshot *snapshot);
+
+// True while a snapshot may still read column's current vector.
+bool columnIsShared(const Column *column);
+
+// Hands a column vector that a snapshot may still read over to be freed
+// once no snapshot can.
+void retireStorage(void *values, size_t bytes);
+
+#endif
@@ -0,0 +1,365 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "sort.h"
+#include "parallel.h"
+#include "output.h"
+#include "fileio.h"
+
+#define SORT_SCRATCH_DIRECTORY "data/sort"
+#define SORT_RUN_BUFFER_ITEMS 16384
+#define PARALLEL_SORT_MIN_ITEMS 65536
+
+static size_t sortMemoryBudget = (size_t)256 * 1024 * 1024;
+
+// Bytes a Sorter may hold in memory. Half goes to the items and half to the
+// scratch space of the parallel sort.
+void setSortMemoryBudget(size_t bytes) {
+    sortMemoryBudget = bytes;
+}
+
+typedef struct {
+    SortCompare compare;
+    void *context;
+} SortOrder;
+
+static int compareItems(const SortOrder *order, int a, int b) {
+    int cmp = order->compare(order->context, a, b);
+    return cmp ? cmp : (a > b) - (a < b);
+}
+
+static int compareForQsort(const void *a, const void *b, void *order) {
+    return compareItems(order, *(const int *)a, *(const int *)b);
+}
+
+typedef struct {
+    SortOrder order;
+    int *from;
+    int *to;
+    int count;
+    int width;
+} ParallelSort;
+
+static void sortChunk(void *context, int index) {
+    ParallelSort *sort = context;
+    int first = index * sort->width;
+    int count = sort->count - first < sort->width ? sort->count - first : sort->width;
+    qsort_r(sort->from + first, count, sizeof(int), compareForQsort, &sort->order);
+}
+
+// Merges the index-th pair of neighbouring sorted runs of from into to.
+static void mergePair(void *context, int index) {
+    ParallelSort *sort = context;
+    int first = 2 * index * sort->width;
+    int middle = first + sort->width < sort->count ? first + sort->width : sort->count;
+    int end = middle + sort->width < sort->count ? middle + sort->width : sort->count;
+    int left = first, right = middle, out = first;
+    while (left < middle && right < end) {
+        if (compareItems(&sort->order, sort->from[right], sort->from[left]) < 0) {
+            sort->to[out++] = sort->from[right++];
+        } else {
+            sort->to[out++] = sort->from[left++];
+        }
+    }
+    memcpy(sort->to + out, sort->from + left, (middle - left) * sizeof(int));
+    out += middle - left;
+    memcpy(sort->to + out, sort->from + right, (end - right) * sizeof(int));
+}
+
+// Sorts items in place. Large arrays are cut into one chunk per worker
+// thread, the chunks are sorted in parallel and then merged pairwise, each
+// round of merges running in parallel too.
+void sortItems(int *items, int count, SortCompare compare, void *context) {
+    ParallelSort sort = {{compare, context}, items, NULL, count, 0};
+    int threads = workerThreadCount();
+    int *scratch = NULL;
+    if (count >= PARALLEL_SORT_MIN_ITEMS && threads > 1) {
+        scratch = malloc((size_t)count * sizeof(int));
+    }
+    if (!scratch) {
+        qsort_r(items, count, sizeof(int), compareForQsort, &sort.order);
+        return;
+    }
+
+    sort.width = (count + threads - 1) / threads;
+    runParallel(threads, sortChunk, &sort);
+    sort.to = scratch;
+    for (; sort.width < count; sort.width *= 2) {
+        int pairs = (count + 2 * sort.width - 1) / (2 * sort.width);
+        runParallel(pairs, mergePair, &sort);
+        int *merged = sort.to;
+        sort.to = sort.from;
+        sort.from = merged;
+    }
+    if (sort.from != items) {
+        memcpy(items, sort.from, (size_t)count * sizeof(int));
+    }
+    free(scratch);
+}
+
+bool openSorter(Sorter *sorter, SortCompare compare, void *context, int limit) {
+    memset(sorter, 0, sizeof(Sorter));
+    sorter->compare = compare;
+    sorter->context = context;
+    sorter->limit = limit;
+    sorter->scratchFd = -1;
+    size_t maxItems = sortMemoryBudget / (2 * sizeof(int));
+    sorter->maxItems = maxItems < 1024 ? 1024 : maxItems > 0x40000000 ? 0x40000000 : (int)maxItems;
+    sorter->useHeap = limit >= 0 && limit <= sorter->maxItems;
+
+    sorter->capacity = sorter->useHeap ? limit : 1024;
+    sorter->items = malloc((sorter->capacity > 0 ? sorter->capacity : 1) * sizeof(int));
+    if (!sorter->items) {
+        reportError("Error: Memory allocation failed while sorting.\n");
+        return false;
+    }
+    return true;
+}
+
+// The top-k heap keeps the worst of the kept items at its root, so a new item
+// only has to beat the root to get in.
+static void heapSiftUp(const SortOrder *order, int *heap, int index) {
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (compareItems(order, heap[index], heap[parent]) <= 0) {
+            break;
+        }
+        int swap = heap[index];
+        heap[index] = heap[parent];
+        heap[parent] = swap;
+        index = parent;
+    }
+}
+
+static void heapSiftDown(const SortOrder *order, int *heap, int count, int index) {
+    while (1) {
+        int largest = index;
+        int left = 2 * index + 1, right = left + 1;
+        if (left < count && compareItems(order, heap[left], heap[largest]) > 0) {
+            largest = left;
+        }
+        if (right < count && compareItems(order, heap[right], heap[largest]) > 0) {
+            largest = right;
+        }
+        if (largest == index) {
+            return;
+        }
+        int swap = heap[index];
+        heap[index] = heap[largest];
+        heap[largest] = swap;
+        index = largest;
+    }
+}
+
+// Sorts the collected items and appends them to the scratch file as a run.
+static bool writeRun(Sorter *sorter) {
+    if (sorter->scratchFd < 0) {
+        sorter->scratchFd = openScratchFile(SORT_SCRATCH_DIRECTORY, "run");
+        if (sorter->scratchFd < 0) {
+            reportError("Error: Could not create a sort file in '%s': %s\n", SORT_SCRATCH_DIRECTORY, strerror(errno));
+            return false;
+        }
+    }
+    SortRun *runs = realloc(sorter->runs, (sorter->runCount + 1) * sizeof(SortRun));
+    if (!runs) {
+        reportError("Error: Memory allocation failed while sorting.\n");
+        return false;
+    }
+    sorter->runs = runs;
+
+    sortItems(sorter->items, sorter->count, sorter->compare, sorter->context);
+    size_t size = (size_t)sorter->count * sizeof(int);
+    if (!writeFully(sorter->scratchFd, sorter->items, size, sorter->scratchSize)) {
+        reportError("Error: Could not write sort run: %s\n", strerror(errno));
+        return false;
+    }
+
+    memset(&runs[sorter->runCount], 0, sizeof(SortRun));
+    runs[sorter->runCount].offset = sorter->scratchSize;
+    runs[sorter->runCount].count = sorter->count;
+    sorter->runCount++;
+    sorter->scratchSize += size;
+    sorter->count = 0;
+    return true;
+}
+
+bool addToSorter(Sorter *sorter, const int *items, int count) {
+    SortOrder order = {sorter->compare, sorter->context};
+    for (int i = 0; i < count; i++) {
+        if (sorter->useHeap) {
+            if (sorter->count < sorter->limit) {
+                sorter->items[sorter->count++] = items[i];
+                heapSiftUp(&order, sorter->items, sorter->count - 1);
+            } else if (sorter->limit > 0 && compareItems(&order, items[i], sorter->items[0]) < 0) {
+                sorter->items[0] = items[i];
+                heapSiftDown(&order, sorter->items, sorter->count, 0);
+            }
+            continue;
+        }
+
+        if (sorter->count == sorter->maxItems && !writeRun(sorter)) {
+            return false;
+        }
+        if (sorter->count == sorter->capacity) {
+            int capacity = sorter->capacity * 2 < sorter->maxItems ? sorter->capacity * 2 : sorter->maxItems;
+            int *grown = realloc(sorter->items, (size_t)capacity * sizeof(int));
+            if (!grown) {
+                reportError("Error: Memory allocation failed while sorting.\n");
+                return false;
+            }
+            sorter->items = grown;
+            sorter->capacity = capacity;
+        }
+        sorter->items[sorter->count++] = items[i];
+    }
+    return true;
+}
+
+// Refills the buffer of run from the scratch file. Returns false once the run
+// is exhausted.
+static bool fillRun(Sorter *sorter, SortRun *run) {
+    int count = run->count - run->read < SORT_RUN_BUFFER_ITEMS ? run->count - run->read : SORT_RUN_BUFFER_ITEMS;
+    if (count <= 0) {
+        return false;
+    }
+    long long offset = run->offset + (long long)run->read * sizeof(int);
+    if (!readFully(sorter->scratchFd, run->buffer, (size_t)count * sizeof(int), offset)) {
+        reportError("Error: Could not read sort run: %s\n", strerror(errno));
+        return false;
+    }
+    run->read += count;
+    run->bufferCount = count;
+    run->bufferPosition = 0;
+    return true;
+}
+
+static int currentItem(const Sorter *sorter, int run) {
+    const SortRun *r = &sorter->runs[run];
+    return r->buffer[r->bufferPosition];
+}
+
+// The merge heap holds run indexes, the run with the smallest current item at
+// the root.
+static void mergeSiftDown(Sorter *sorter, int index) {
+    SortOrder order = {sorter->compare, sorter->context};
+    int *heap = sorter->mergeHeap;
+    while (1) {
+        int smallest = index;
+        int left = 2 * index + 1, right = left + 1;
+        if (left < sorter->mergeCount &&
+            compareItems(&order, currentItem(sorter, heap[left]), currentItem(sorter, heap[smallest])) < 0) {
+            smallest = left;
+        }
+        if (right < sorter->mergeCount &&
+            compareItems(&order, currentItem(sorter, heap[right]), currentItem(sorter, heap[smallest])) < 0) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            return;
+        }
+        int swap = heap[index];
+        heap[index] = heap[smallest];
+        heap[smallest] = swap;
+        index = smallest;
+    }
+}
+
+static void startMerge(Sorter *sorter) {
+    sorter->mergeCount = 0;
+    for (int run = 0; run < sorter->runCount; run++) {
+        sorter->runs[run].read = 0;
+        if (fillRun(sorter, &sorter->runs[run])) {
+            sorter->mergeHeap[sorter->mergeCount++] = run;
+        }
+    }
+    for (int i = sorter->mergeCount / 2 - 1; i >= 0; i--) {
+        mergeSiftDown(sorter, i);
+    }
+}
+
+// Called once every item has been added. Sorts what is held in memory, or
+// writes it as the last run and prepares the merge of all runs.
+bool finishSorter(Sorter *sorter) {
+    if (sorter->runCount == 0) {
+        sortItems(sorter->items, sorter->count, sorter->compare, sorter->context);
+        return true;
+    }
+    if (sorter->count > 0 && !writeRun(sorter)) {
+        return false;
+    }
+    free(sorter->items);
+    sorter->items = NULL;
+    sorter->capacity = 0;
+
+    sorter->mergeHeap = malloc(sorter->runCount * sizeof(int));
+    if (!sorter->mergeHeap) {
+        reportError("Error: Memory allocation failed while sorting.\n");
+        return false;
+    }
+    for (int run = 0; run < sorter->runCount; run++) {
+        sorter->runs[run].buffer = malloc(SORT_RUN_BUFFER_ITEMS * sizeof(int));
+        if (!sorter->runs[run].buffer) {
+            reportError("Error: Memory allocation failed while sorting.\n");
+            return false;
+        }
+    }
+    startMerge(sorter);
+    return true;
+}
+
+bool nextSortedItem(Sorter *sorter, int *item) {
+    if (sorter->limit >= 0 && sorter->returned >= sorter->limit) {
+        return false;
+    }
+    if (sorter->runCount == 0) {
+        if (sorter->position >= sorter->count) {
+            return false;
+        }
+        *item = sorter->items[sorter->position++];
+    } else {
+        if (sorter->mergeCount == 0) {
+            return false;
+        }
+        int run = sorter->mergeHeap[0];
+        SortRun *r = &sorter->runs[run];
+        *item = r->buffer[r->bufferPosition++];
+        if (r->bufferPosition == r->bufferCount && !fillRun(sorter, r)) {
+            sorter->mergeHeap[0] = sorter->mergeHeap[--sorter->mergeCount];
+        }
+        mergeSiftDown(sorter, 0);
+    }
+    sorter->returned++;
+    return true;
+}
+
+// Starts handing the items back from the first one again.
+bool rewindSorter(Sorter *sorter) {
+    sorter->position = 0;
+    sorter->returned = 0;
+    if (sorter->runCount > 0) {
+        startMerge(sorter);
+    }
+    return true;
+}
+
+bool sorterSpilled(const Sorter *sorter) {
+    return sorter->runCount > 0;
+}
+
+void closeSorter(Sorter *sorter) {
+    free(sorter->items);
+    for (int run = 0; run < sorter->runCount; run++) {
+        free(sorter->runs[run].buffer);
+    }
+    free(sorter->runs);
+    free(sorter->mergeHeap);
+    if (sorter->scratchFd >= 0) {
+        close(sorter->scratchFd);
+    }
+    memset(sorter, 0, sizeof(Sorter));
+    sorter->scratchFd = -1;
+}
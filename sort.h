@@ -0,0 +1,57 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Orders two items, such as row numbers, for a Sorter. Items comparing equal
+// are kept in ascending item order, so results do not depend on the sort.
+typedef int (*SortCompare)(void *context, int a, int b);
+
+typedef struct {
+    long long offset;
+    int count;
+    int *buffer;
+    int bufferCount;
+    int bufferPosition;
+    int read;
+} SortRun;
+
+// Sorts a stream of items added in batches and hands them back in order.
+// With a limit only the first limit items are wanted, and when those fit the
+// memory budget they are kept in a bounded heap. Otherwise items are
+// collected up to the budget; each time it fills, the items are sorted and
+// written as a run to an unlinked scratch file under data/sort, and the runs
+// are merged while the items are read back.
+typedef struct {
+    SortCompare compare;
+    void *context;
+    int limit;
+    bool useHeap;
+    int *items;
+    int count;
+    int capacity;
+    int maxItems;
+    int scratchFd;
+    long long scratchSize;
+    SortRun *runs;
+    int runCount;
+    int *mergeHeap;
+    int mergeCount;
+    int position;
+    int returned;
+} Sorter;
+
+void setSortMemoryBudget(size_t bytes);
+
+void sortItems(int *items, int count, SortCompare compare, void *context);
+
+bool openSorter(Sorter *sorter, SortCompare compare, void *context, int limit);
+bool addToSorter(Sorter *sorter, const int *items, int count);
+bool finishSorter(Sorter *sorter);
+bool nextSortedItem(Sorter *sorter, int *item);
+bool rewindSorter(Sorter *sorter);
+bool sorterSpilled(const Sorter *sorter);
+void closeSorter(Sorter *sorter);
+
+#endif
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "stats.h"
+#include "hashindex.h"
+#include "btree.h"
+#include "budget.h"
+#include "pool.h"
+#include "output.h"
+
+// Log-linear latency histogram in microseconds, in the manner of HDR
+// histograms: values below 32 us get a bucket each, and every power of two
+// above is split into 16 buckets, so a bucket is within 1/16 of its values.
+// 544 buckets reach 2^37 us, about 38 hours; longer times go in the last.
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS 544
+
+typedef struct {
+    unsigned long long buckets[HISTOGRAM_BUCKETS];
+    unsigned long long count;
+    unsigned long long totalMicros;
+    unsigned long long maxMicros;
+} Histogram;
+
+// Histograms are kept per command name; anything else counts as "other".
+static const char *const commandNames[] = {
+    "createDatabase", "useDatabase", "createTable", "insertValues", "editValue", "deleteValue",
+    "editTable", "deleteTable", "createIndex", "dropIndex", "displayTable", "select",
+    "prepare", "execute", "deallocate", "deleteDatabase", "unloadDatabase", "loadDatabase",
+    "loadAllDatabases", "toggleLoadDatabase", "commitAll", "listDatabases", "listTables",
+    "history", "stats", "help", "exit", "other",
+};
+#define COMMAND_KINDS ((int)(sizeof(commandNames) / sizeof(commandNames[0])))
+
+static Histogram histograms[COMMAND_KINDS];
+unsigned long long statCounters[STAT_COUNTER_COUNT];
+
+static const char *const counterNames[STAT_COUNTER_COUNT] = {
+    [STAT_ROWS_SCANNED] = "Rows scanned",
+    [STAT_ROWS_MODIFIED] = "Rows modified",
+    [STAT_BYTES_READ] = "Bytes loaded",
+    [STAT_BYTES_WRITTEN] = "Bytes saved",
+    [STAT_ALLOCATIONS] = "Allocations",
+    [STAT_ALLOCATED_BYTES] = "Bytes allocated",
+    [STAT_SLOW_COMMANDS] = "Slow commands",
+    [STAT_TABLES_EVICTED] = "Tables evicted",
+};
+
+static pthread_mutex_t slowLogLock = PTHREAD_MUTEX_INITIALIZER;
+static char slowLogPath[256];
+static FILE *slowLog = NULL;
+static unsigned long long slowThresholdMicros = 0;
+
+static uint64_t clockMicros(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int bucketFor(uint64_t micros) {
+    if (micros < 2 * HISTOGRAM_SUB_BUCKETS) {
+        return (int)micros;
+    }
+    int shift = 63 - __builtin_clzll(micros) - HISTOGRAM_SUB_BITS;
+    int bucket = shift * HISTOGRAM_SUB_BUCKETS + (int)(micros >> shift);
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+// Largest value that falls in bucket.
+static uint64_t bucketHighest(int bucket) {
+    if (bucket < 2 * HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t sub = bucket - shift * HISTOGRAM_SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+static int commandKind(const char *command) {
+    if (strcmp(command, "TLD") == 0) {
+        command = "toggleLoadDatabase";
+    }
+    size_t length = strcspn(command, " ");
+    for (int i = 0; i < COMMAND_KINDS - 1; i++) {
+        if (strlen(commandNames[i]) == length && strncmp(command, commandNames[i], length) == 0) {
+            return i;
+        }
+    }
+    return COMMAND_KINDS - 1;
+}
+
+void startCommandTimer(CommandTimer *timer, const char *command) {
+    timer->kind = commandKind(command);
+    timer->text[0] = '\0';
+    if (__atomic_load_n(&slowThresholdMicros, __ATOMIC_RELAXED) > 0) {
+        snprintf(timer->text, sizeof(timer->text), "%s", command);
+    }
+    timer->started = clockMicros();
+}
+
+static void logSlowCommand(const CommandTimer *timer, uint64_t micros) {
+    countStat(STAT_SLOW_COMMANDS, 1);
+    time_t now = time(NULL);
+    struct tm local;
+    char stamp[32];
+    localtime_r(&now, &local);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+
+    pthread_mutex_lock(&slowLogLock);
+    if (!slowLog && slowLogPath[0]) {
+        slowLog = fopen(slowLogPath, "a");
+        if (!slowLog) {
+            // Not worth failing a command over; stop trying.
+            slowLogPath[0] = '\0';
+        }
+    }
+    if (slowLog) {
+        fprintf(slowLog, "%s  %10.3f ms  %s\n", stamp, micros / 1000.0, timer->text);
+        fflush(slowLog);
+    }
+    pthread_mutex_unlock(&slowLogLock);
+}
+
+void stopCommandTimer(const CommandTimer *timer) {
+    uint64_t micros = clockMicros() - timer->started;
+    Histogram *histogram = &histograms[timer->kind];
+    __atomic_fetch_add(&histogram->buckets[bucketFor(micros)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->totalMicros, micros, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n(&histogram->maxMicros, __ATOMIC_RELAXED);
+    while (micros > max &&
+           !__atomic_compare_exchange_n(&histogram->maxMicros, &max, micros, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+
+    unsigned long long threshold = __atomic_load_n(&slowThresholdMicros, __ATOMIC_RELAXED);
+    if (threshold > 0 && micros >= threshold && timer->text[0]) {
+        logSlowCommand(timer, micros);
+    }
+}
+
+void setSlowCommandLog(const char *path, int milliseconds) {
+    pthread_mutex_lock(&slowLogLock);
+    snprintf(slowLogPath, sizeof(slowLogPath), "%s", path);
+    if (slowLog) {
+        fclose(slowLog);
+        slowLog = NULL;
+    }
+    pthread_mutex_unlock(&slowLogLock);
+    __atomic_store_n(&slowThresholdMicros, milliseconds > 0 ? (unsigned long long)milliseconds * 1000 : 0, __ATOMIC_RELAXED);
+}
+
+size_t tableFootprint(const Table *table) {
+    if (!table->loaded) {
+        return 0;
+    }
+    size_t bytes = 0;
+    for (int i = 0; i < table->columnCount; i++) {
+        const Column *column = &table->columns[i];
+        bytes += (size_t)table->maxRows * columnValueWidth(column);
+        if (column->primaryIndex) {
+            bytes += sizeof(HashIndex) + (size_t)column->primaryIndex->capacity * (sizeof(int) + sizeof(unsigned));
+        }
+        bytes += btreeBytes(column->orderedIndex);
+    }
+    return bytes;
+}
+
+static void formatBytes(char *text, size_t size, unsigned long long bytes) {
+    if (bytes < 1024) {
+        snprintf(text, size, "%llu B", bytes);
+    } else if (bytes < 1024 * 1024) {
+        snprintf(text, size, "%.1f KB", bytes / 1024.0);
+    } else if (bytes < 1024ULL * 1024 * 1024) {
+        snprintf(text, size, "%.1f MB", bytes / (1024.0 * 1024));
+    } else {
+        snprintf(text, size, "%.2f GB", bytes / (1024.0 * 1024 * 1024));
+    }
+}
+
+// Upper bound of the bucket holding the value at fraction of the way up,
+// but no more than the largest value seen.
+static double percentileMillis(const Histogram *histogram, unsigned long long count, double fraction) {
+    unsigned long long rank = (unsigned long long)(fraction * count + 0.999999);
+    unsigned long long seen = 0;
+    uint64_t max = __atomic_load_n(&histogram->maxMicros, __ATOMIC_RELAXED);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= rank) {
+            uint64_t highest = bucketHighest(i);
+            return (highest < max ? highest : max) / 1000.0;
+        }
+    }
+    return max / 1000.0;
+}
+
+// Reads a "Key:   123 kB" line of /proc/self/status, in bytes.
+static unsigned long long processMemory(const char *key) {
+    FILE *file = fopen("/proc/self/status", "r");
+    char line[256];
+    unsigned long long kb = 0;
+    size_t keyLength = strlen(key);
+    if (!file) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, key, keyLength) == 0 && line[keyLength] == ':') {
+            kb = strtoull(line + keyLength + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(file);
+    return kb * 1024;
+}
+
+void printStats(Database **databases, int databaseCount) {
+    char text[32];
+    fprintf(commandOutput(), "%-20s %10s %10s %10s %10s %10s %12s\n", "Command", "Count", "p50 ms", "p90 ms", "p99 ms", "Max ms", "Total s");
+    for (int i = 0; i < COMMAND_KINDS; i++) {
+        const Histogram *histogram = &histograms[i];
+        unsigned long long count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+        if (count == 0) {
+            continue;
+        }
+        fprintf(commandOutput(), "%-20s %10llu %10.3f %10.3f %10.3f %10.3f %12.3f\n", commandNames[i], count,
+               percentileMillis(histogram, count, 0.50), percentileMillis(histogram, count, 0.90),
+               percentileMillis(histogram, count, 0.99),
+               __atomic_load_n(&histogram->maxMicros, __ATOMIC_RELAXED) / 1000.0,
+               __atomic_load_n(&histogram->totalMicros, __ATOMIC_RELAXED) / 1e6);
+    }
+
+    fprintf(commandOutput(), "\n");
+    for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+        unsigned long long value = __atomic_load_n(&statCounters[i], __ATOMIC_RELAXED);
+        if (i == STAT_BYTES_READ || i == STAT_BYTES_WRITTEN || i == STAT_ALLOCATED_BYTES) {
+            formatBytes(text, sizeof(text), value);
+            fprintf(commandOutput(), "%-20s %s\n", counterNames[i], text);
+        } else {
+            fprintf(commandOutput(), "%-20s %llu\n", counterNames[i], value);
+        }
+    }
+    formatBytes(text, sizeof(text), poolLiveBytes());
+    fprintf(commandOutput(), "%-20s %s", "Table storage", text);
+    if (memoryBudget() > 0) {
+        formatBytes(text, sizeof(text), memoryBudget());
+        fprintf(commandOutput(), " (budget %s)", text);
+    }
+    fprintf(commandOutput(), "\n");
+    formatBytes(text, sizeof(text), processMemory("VmRSS"));
+    fprintf(commandOutput(), "%-20s %s", "Resident memory", text);
+    formatBytes(text, sizeof(text), processMemory("VmHWM"));
+    fprintf(commandOutput(), " (peak %s)\n", text);
+
+    fprintf(commandOutput(), "\n%-40s %12s %12s\n", "Table", "Rows", "Memory");
+    size_t total = 0;
+    for (int i = 0; i < databaseCount; i++) {
+        for (int j = 0; j < databases[i]->tableCount; j++) {
+            const Table *table = databases[i]->tables[j];
+            char name[2 * MAX_NAME_LEN + 1];
+            snprintf(name, sizeof(name), "%s.%s", databases[i]->name, table->tableName);
+            if (table->loaded) {
+                size_t bytes = tableFootprint(table);
+                total += bytes;
+                formatBytes(text, sizeof(text), bytes);
+                fprintf(commandOutput(), "%-40s %12d %12s\n", name, table->rowCount, text);
+            } else {
+                fprintf(commandOutput(), "%-40s %12d %12s\n", name, table->rowCount, "not loaded");
+            }
+        }
+    }
+    formatBytes(text, sizeof(text), total);
+    fprintf(commandOutput(), "%-40s %12s %12s\n", "Total", "", text);
+}
+
+void resetStats(void) {
+    for (int i = 0; i < COMMAND_KINDS; i++) {
+        Histogram *histogram = &histograms[i];
+        for (int j = 0; j < HISTOGRAM_BUCKETS; j++) {
+            __atomic_store_n(&histogram->buckets[j], 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&histogram->count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&histogram->totalMicros, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&histogram->maxMicros, 0, __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+        __atomic_store_n(&statCounters[i], 0, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include "storage.h"
+
+// Process-wide instrumentation, cheap enough to leave on: every command is
+// timed into a latency histogram for its command name, and the counters
+// below are bumped once per block of work rather than per row. Both are
+// updated with relaxed atomics, so worker and reader threads can count too.
+
+typedef enum {
+    STAT_ROWS_SCANNED,
+    STAT_ROWS_MODIFIED,
+    STAT_BYTES_READ,
+    STAT_BYTES_WRITTEN,
+    STAT_ALLOCATIONS,
+    STAT_ALLOCATED_BYTES,
+    STAT_SLOW_COMMANDS,
+    STAT_TABLES_EVICTED,
+    STAT_COUNTER_COUNT
+} StatCounter;
+
+extern unsigned long long statCounters[STAT_COUNTER_COUNT];
+
+static inline void countStat(StatCounter counter, unsigned long long amount) {
+    __atomic_fetch_add(&statCounters[counter], amount, __ATOMIC_RELAXED);
+}
+
+// Characters of a command kept for the slow command log.
+#define SLOW_LOG_TEXT 256
+
+// Started before a command runs, since running it may cut up its text, and
+// stopped once it has finished, on whichever thread that is.
+typedef struct {
+    int kind;
+    uint64_t started;
+    char text[SLOW_LOG_TEXT];
+} CommandTimer;
+
+void startCommandTimer(CommandTimer *timer, const char *command);
+void stopCommandTimer(const CommandTimer *timer);
+
+// Commands taking at least milliseconds are appended to path with their
+// time and duration. 0 turns the log off.
+void setSlowCommandLog(const char *path, int milliseconds);
+
+// Bytes held by the table's column vectors and indexes; 0 until it is loaded.
+size_t tableFootprint(const Table *table);
+
+// Prints the latency of each command run so far, the counters and the memory
+// of each loaded table, or with reset, clears the histograms and counters.
+void printStats(Database **databases, int databaseCount);
+void resetStats(void);
+
+#endif
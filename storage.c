@@ -0,0 +1,429 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "storage.h"
+#include "hashindex.h"
+#include "btree.h"
+#include "pool.h"
+#include "snapshot.h"
+#include "output.h"
+
+int stringSlotWidth(const Column *column) {
+    return (column->stringSize > 0 ? column->stringSize : 0) + 1;
+}
+
+int columnValueWidth(const Column *column) {
+    if (column->type == INT) {
+        return sizeof(int);
+    } else if (column->type == FLOAT) {
+        return sizeof(float);
+    }
+    return stringSlotWidth(column);
+}
+
+char *getStringValue(const Column *column, int row) {
+    return column->strValues + (size_t)row * stringSlotWidth(column);
+}
+
+// Resizes the column vector. A vector a snapshot may read is copied into a
+// new one and retired instead of being resized in place.
+bool resizeColumnStorage(Column *column, int oldCapacity, int newCapacity) {
+    size_t width = columnValueWidth(column);
+    if (newCapacity == 0) {
+        freeColumnStorage(column, oldCapacity);
+        return true;
+    }
+
+    void *values;
+    if (columnIsShared(column)) {
+        values = poolAlloc((size_t)newCapacity * width);
+        if (values) {
+            int kept = oldCapacity < newCapacity ? oldCapacity : newCapacity;
+            memcpy(values, column->values, (size_t)kept * width);
+            retireStorage(column->values, (size_t)oldCapacity * width);
+            column->sharedEpoch = 0;
+        }
+    } else {
+        values = poolResize(column->values, (size_t)oldCapacity * width, (size_t)newCapacity * width);
+    }
+    if (!values) {
+        reportError("Error: Memory allocation failed for column '%s'.\n", column->name);
+        return false;
+    }
+    if (newCapacity > oldCapacity) {
+        memset((char *)values + (size_t)oldCapacity * width, 0, (size_t)(newCapacity - oldCapacity) * width);
+    }
+    column->values = values;
+    return true;
+}
+
+// Gives the column a vector of its own before rows a snapshot can see are
+// changed in place.
+bool unshareColumn(Column *column, int capacity) {
+    if (!columnIsShared(column)) {
+        return true;
+    }
+    size_t bytes = (size_t)capacity * columnValueWidth(column);
+    void *values = bytes > 0 ? poolAlloc(bytes) : NULL;
+    if (bytes > 0 && !values) {
+        reportError("Error: Memory allocation failed for column '%s'.\n", column->name);
+        return false;
+    }
+    if (bytes > 0) {
+        memcpy(values, column->values, bytes);
+    }
+    retireStorage(column->values, bytes);
+    column->values = values;
+    column->sharedEpoch = 0;
+    return true;
+}
+
+bool reserveRows(Table *table, int capacity) {
+    if (capacity <= table->maxRows) {
+        return true;
+    }
+
+    int newCapacity = table->maxRows > 0 ? table->maxRows : 4;
+    while (newCapacity < capacity) {
+        newCapacity *= 2;
+    }
+
+    for (int i = 0; i < table->columnCount; i++) {
+        if (!resizeColumnStorage(&table->columns[i], table->maxRows, newCapacity)) {
+            return false;
+        }
+    }
+    table->maxRows = newCapacity;
+    return true;
+}
+
+void setValueFromString(Column *column, int row, const char *value) {
+    if (column->type == INT) {
+        column->intValues[row] = atoi(value);
+    } else if (column->type == FLOAT) {
+        column->floatValues[row] = atof(value);
+    } else if (column->type == STRING) {
+        int width = stringSlotWidth(column);
+        char *slot = getStringValue(column, row);
+        strncpy(slot, value, width - 1);
+        slot[width - 1] = '\0';
+    }
+}
+
+void parseValue(const Column *column, char *text, Value *value) {
+    value->type = column->type;
+    value->intValue = 0;
+    value->floatValue = 0;
+    value->strValue = text;
+    if (column->type == INT) {
+        value->intValue = atoi(text);
+    } else if (column->type == FLOAT) {
+        value->floatValue = atof(text);
+    } else if ((int)strlen(text) > stringSlotWidth(column) - 1) {
+        text[stringSlotWidth(column) - 1] = '\0';
+    }
+}
+
+bool valueEquals(const Column *column, int row, const Value *value) {
+    if (column->type == INT) {
+        return column->intValues[row] == value->intValue;
+    } else if (column->type == FLOAT) {
+        return column->floatValues[row] == value->floatValue;
+    }
+    return strcmp(getStringValue(column, row), value->strValue) == 0;
+}
+
+int compareToValue(const Column *column, int row, const Value *value) {
+    if (column->type == INT) {
+        return (column->intValues[row] > value->intValue) - (column->intValues[row] < value->intValue);
+    } else if (column->type == FLOAT) {
+        return (column->floatValues[row] > value->floatValue) - (column->floatValues[row] < value->floatValue);
+    }
+    return strcmp(getStringValue(column, row), value->strValue);
+}
+
+int compareRowValues(const Column *column, int a, int b) {
+    if (column->type == INT) {
+        return (column->intValues[a] > column->intValues[b]) - (column->intValues[a] < column->intValues[b]);
+    } else if (column->type == FLOAT) {
+        return (column->floatValues[a] > column->floatValues[b]) - (column->floatValues[a] < column->floatValues[b]);
+    }
+    return strcmp(getStringValue(column, a), getStringValue(column, b));
+}
+
+void setValue(Column *column, int row, const Value *value) {
+    if (column->type == INT) {
+        column->intValues[row] = value->intValue;
+    } else if (column->type == FLOAT) {
+        column->floatValues[row] = value->floatValue;
+    } else {
+        setValueFromString(column, row, value->strValue);
+    }
+}
+
+unsigned long catalogVersion = 0;
+
+// Invalidates every resolved statement. Tables are added from the loader
+// threads, hence the atomic increment.
+void bumpCatalogVersion(void) {
+    __atomic_add_fetch(&catalogVersion, 1, __ATOMIC_RELAXED);
+}
+
+Column *findColumn(const Table *table, const char *name) {
+    return nameMapFind(&table->columnMap, name);
+}
+
+// Maps every column name of table to its Column. Must be called again
+// whenever the columns array is reallocated or reordered.
+bool rebuildColumnMap(Table *table) {
+    bumpCatalogVersion();
+    nameMapClear(&table->columnMap);
+    for (int i = 0; i < table->columnCount; i++) {
+        if (!nameMapInsert(&table->columnMap, table->columns[i].name, &table->columns[i])) {
+            reportError("Error: Duplicate column '%s' in table '%s'.\n", table->columns[i].name, table->tableName);
+            return false;
+        }
+    }
+    return true;
+}
+
+Table *findTable(const Database *db, const char *name) {
+    return nameMapFind(&db->tableMap, name);
+}
+
+// Takes ownership of table and adds it to db. Fails if the name is taken.
+bool addTable(Database *db, Table *table) {
+    if (findTable(db, table->tableName)) {
+        reportError("Error: Table '%s' already exists in database '%s'.\n", table->tableName, db->name);
+        return false;
+    }
+    if (db->tableCount >= db->maxTables) {
+        int maxTables = db->maxTables > 0 ? db->maxTables * 2 : 2;
+        Table **tables = realloc(db->tables, maxTables * sizeof(Table *));
+        if (!tables) {
+            reportError("Error: Memory allocation failed for tables in database %s.\n", db->name);
+            return false;
+        }
+        db->tables = tables;
+        db->maxTables = maxTables;
+    }
+    if (!nameMapInsert(&db->tableMap, table->tableName, table)) {
+        return false;
+    }
+    db->tables[db->tableCount++] = table;
+    bumpCatalogVersion();
+    return true;
+}
+
+// Removes table from db and frees it.
+void removeTable(Database *db, Table *table) {
+    bumpCatalogVersion();
+    nameMapRemove(&db->tableMap, table->tableName);
+    for (int i = 0; i < db->tableCount; i++) {
+        if (db->tables[i] == table) {
+            memmove(&db->tables[i], &db->tables[i + 1], (db->tableCount - i - 1) * sizeof(Table *));
+            db->tableCount--;
+            break;
+        }
+    }
+    freeTableStorage(table);
+    free(table);
+}
+
+// Creates the hash index of every PRIMARY column from the rows already stored.
+bool buildPrimaryIndexes(Table *table) {
+    for (int i = 0; i < table->columnCount; i++) {
+        Column *column = &table->columns[i];
+        if (!column->isPrimaryKey) {
+            continue;
+        }
+        freeHashIndex(column->primaryIndex);
+        column->primaryIndex = createHashIndex(0);
+        if (!column->primaryIndex || !rebuildHashIndex(column->primaryIndex, column, table->rowCount)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns the first row at or after row whose selection bit equals wanted.
+static int findNextRow(const uint64_t *selection, int row, int rowCount, bool wanted) {
+    while (row < rowCount) {
+        uint64_t word = selection[row >> 6];
+        if (!wanted) {
+            word = ~word;
+        }
+        word >>= (row & 63);
+        if (word != 0) {
+            row += __builtin_ctzll(word);
+            return row < rowCount ? row : rowCount;
+        }
+        row = (row | 63) + 1;
+    }
+    return rowCount;
+}
+
+// Moves every column into a vector of newCapacity rows. The new vectors are
+// all allocated before any old one is released, so on failure the table keeps
+// its current capacity and every column still matches maxRows.
+static void shrinkRows(Table *table, int newCapacity) {
+    void **vectors = calloc(table->columnCount > 0 ? table->columnCount : 1, sizeof(void *));
+    if (!vectors) {
+        return;
+    }
+    int allocated = 0;
+    while (allocated < table->columnCount) {
+        vectors[allocated] = poolAlloc((size_t)newCapacity * columnValueWidth(&table->columns[allocated]));
+        if (!vectors[allocated]) {
+            break;
+        }
+        allocated++;
+    }
+    if (allocated < table->columnCount) {
+        for (int i = 0; i < allocated; i++) {
+            poolFree(vectors[i], (size_t)newCapacity * columnValueWidth(&table->columns[i]));
+        }
+        free(vectors);
+        return;
+    }
+
+    for (int i = 0; i < table->columnCount; i++) {
+        Column *column = &table->columns[i];
+        memcpy(vectors[i], column->values, (size_t)table->rowCount * columnValueWidth(column));
+        freeColumnStorage(column, table->maxRows);
+        column->values = vectors[i];
+    }
+    table->maxRows = newCapacity;
+    free(vectors);
+}
+
+// Removes every selected row in one stable pass. Surviving rows are moved
+// down run by run, indexes are renumbered rather than rebuilt, and the column
+// vectors are shrunk once the table is mostly empty.
+bool deleteSelectedRows(Table *table, const uint64_t *selection) {
+    for (int i = 0; i < table->columnCount; i++) {
+        if (!unshareColumn(&table->columns[i], table->maxRows)) {
+            return false;
+        }
+    }
+
+    int oldRowCount = table->rowCount;
+    int *newRows = malloc((oldRowCount > 0 ? oldRowCount : 1) * sizeof(int));
+    if (!newRows) {
+        reportError("Error: Memory allocation failed while deleting rows.\n");
+        return false;
+    }
+
+    for (int i = 0; i < table->columnCount; i++) {
+        Column *column = &table->columns[i];
+        if (!column->primaryIndex) {
+            continue;
+        }
+        for (int row = findNextRow(selection, 0, oldRowCount, true); row < oldRowCount; row = findNextRow(selection, row + 1, oldRowCount, true)) {
+            hashIndexRemove(column->primaryIndex, column, row);
+        }
+    }
+
+    int kept = 0;
+    for (int row = 0; row < oldRowCount; row++) {
+        newRows[row] = SELECTION_TEST(selection, row) ? -1 : kept++;
+    }
+
+    for (int i = 0; i < table->columnCount; i++) {
+        Column *column = &table->columns[i];
+        size_t width = columnValueWidth(column);
+        char *base = column->values;
+        int next = 0;
+        int start = findNextRow(selection, 0, oldRowCount, false);
+        while (start < oldRowCount) {
+            int end = findNextRow(selection, start, oldRowCount, true);
+            if (next != start) {
+                memmove(base + (size_t)next * width, base + (size_t)start * width, (size_t)(end - start) * width);
+            }
+            next += end - start;
+            start = findNextRow(selection, end, oldRowCount, false);
+        }
+    }
+    table->rowCount = kept;
+
+    bool ok = true;
+    for (int i = 0; i < table->columnCount; i++) {
+        Column *column = &table->columns[i];
+        if (column->primaryIndex) {
+            ok = hashIndexRemapRows(column->primaryIndex, newRows) && ok;
+        }
+        if (column->orderedIndex) {
+            ok = btreeRemapRows(column->orderedIndex, column, newRows) && ok;
+        }
+    }
+    free(newRows);
+
+    if (table->maxRows > 16 && table->rowCount < table->maxRows / 4) {
+        shrinkRows(table, table->rowCount * 2 > 4 ? table->rowCount * 2 : 4);
+    }
+    return ok;
+}
+
+void freeColumnStorage(Column *column, int capacity) {
+    if (columnIsShared(column)) {
+        retireStorage(column->values, (size_t)capacity * columnValueWidth(column));
+    } else {
+        poolFree(column->values, (size_t)capacity * columnValueWidth(column));
+    }
+    column->sharedEpoch = 0;
+    column->values = NULL;
+}
+
+// Closes the spill file of an evicted table once its rows are in memory or
+// in the database file again.
+void dropSpill(Table *table) {
+    if (table->spilled) {
+        close(table->spillFd);
+    }
+    free(table->spillIndexed);
+    table->spillIndexed = NULL;
+    table->spilled = false;
+}
+
+void freeTableStorage(Table *table) {
+    dropSpill(table);
+    for (int i = 0; i < table->columnCount; i++) {
+        freeColumnStorage(&table->columns[i], table->maxRows);
+        freeHashIndex(table->columns[i].primaryIndex);
+        table->columns[i].primaryIndex = NULL;
+        freeBTree(table->columns[i].orderedIndex);
+        table->columns[i].orderedIndex = NULL;
+    }
+    free(table->columns);
+    table->columns = NULL;
+    nameMapClear(&table->columnMap);
+    table->rowCount = 0;
+    table->maxRows = 0;
+}
+
+void unmapDatabaseFile(MappedFile *mapping) {
+    if (mapping) {
+        munmap(mapping->base, mapping->size);
+        if (mapping->fd >= 0) {
+            close(mapping->fd);
+        }
+        free(mapping);
+    }
+}
+
+void freeDatabase(Database *db) {
+    bumpCatalogVersion();
+    for (int i = 0; i < db->tableCount; i++) {
+        freeTableStorage(db->tables[i]);
+        free(db->tables[i]);
+    }
+    free(db->tables);
+    db->tables = NULL;
+    db->tableCount = 0;
+    db->maxTables = 0;
+    nameMapClear(&db->tableMap);
+    unmapDatabaseFile(db->mapping);
+    db->mapping = NULL;
+}
@@ -0,0 +1,137 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "namemap.h"
+
+#define MAX_NAME_LEN 100
+
+// Row selections are bitmaps with one bit per row.
+#define SELECTION_WORDS(rows) (((rows) + 63) / 64)
+#define SELECTION_TEST(selection, row) (((selection)[(row) >> 6] >> ((row) & 63)) & 1)
+#define SELECTION_SET(selection, row) ((selection)[(row) >> 6] |= (uint64_t)1 << ((row) & 63))
+
+typedef enum { INT, STRING, FLOAT } DataType;
+
+struct HashIndex;
+struct BTree;
+struct ColumnEntry;
+struct WriteAheadLog;
+
+// Each column owns one contiguous vector holding the values of every row.
+// String columns store fixed-width slots of stringSize + 1 bytes so that
+// row r starts at strValues + r * stringSlotWidth(column).
+typedef struct {
+    char name[MAX_NAME_LEN];
+    DataType type;
+    int stringSize;
+    bool isPrimaryKey;
+    bool isRequired;
+    union {
+        void *values;
+        int *intValues;
+        float *floatValues;
+        char *strValues;
+    };
+    struct HashIndex *primaryIndex;
+    struct BTree *orderedIndex;
+    // Epoch of the last snapshot opened on this column's vector, 0 if none.
+    unsigned long sharedEpoch;
+} Column;
+
+// A constant from a command, parsed for comparison against one column.
+// String constants point into the command text, cut to the column width.
+typedef struct {
+    DataType type;
+    int intValue;
+    float floatValue;
+    const char *strValue;
+} Value;
+
+typedef struct {
+    char tableName[MAX_NAME_LEN];
+    char databaseName[MAX_NAME_LEN];
+    Column *columns;
+    int columnCount;
+    NameMap columnMap;
+    int rowCount;
+    int maxRows;
+    // Tables read from a mapped database file start unloaded: only the schema
+    // and rowCount are filled in, and the column blocks are copied out of the
+    // mapping by ensureTableLoaded the first time a command uses the table.
+    // storedColumns points at the table's entries in the mapped file and
+    // stays valid while the table is clean, so saving can copy those blocks.
+    bool loaded;
+    bool dirty;
+    const struct ColumnEntry *storedColumns;
+    const char *mappedBase;
+    // tableUseClock when a command last used the table, for eviction.
+    unsigned long lastUsed;
+    // An evicted table with rows that are not in its database file has its
+    // column blocks, back to back, in the unlinked file spillFd until
+    // ensureTableLoaded reads them in or a save makes them clean.
+    // spillIndexed records which columns had an ordered index.
+    bool spilled;
+    int spillFd;
+    bool *spillIndexed;
+} Table;
+
+// Read-only mapping of the file a database was last loaded from or saved to.
+typedef struct {
+    char *base;
+    size_t size;
+    int fd;
+} MappedFile;
+
+// Tables are allocated one by one so a Table pointer stays valid while the
+// table exists, whatever happens to the tables array.
+typedef struct {
+    char name[MAX_NAME_LEN];
+    Table **tables;
+    int tableCount;
+    int maxTables;
+    NameMap tableMap;
+    bool dirty;
+    MappedFile *mapping;
+    struct WriteAheadLog *wal;
+    uint64_t walSequence;
+} Database;
+
+int stringSlotWidth(const Column *column);
+char *getStringValue(const Column *column, int row);
+
+int columnValueWidth(const Column *column);
+bool resizeColumnStorage(Column *column, int oldCapacity, int newCapacity);
+bool unshareColumn(Column *column, int capacity);
+bool reserveRows(Table *table, int capacity);
+void setValueFromString(Column *column, int row, const char *value);
+
+void parseValue(const Column *column, char *text, Value *value);
+bool valueEquals(const Column *column, int row, const Value *value);
+int compareToValue(const Column *column, int row, const Value *value);
+int compareRowValues(const Column *column, int a, int b);
+void setValue(Column *column, int row, const Value *value);
+
+// Changes whenever a table or column may have moved, been removed or been
+// replaced, so pointers cached across commands can be checked before use.
+extern unsigned long catalogVersion;
+void bumpCatalogVersion(void);
+
+Column *findColumn(const Table *table, const char *name);
+bool rebuildColumnMap(Table *table);
+Table *findTable(const Database *db, const char *name);
+bool addTable(Database *db, Table *table);
+void removeTable(Database *db, Table *table);
+
+bool buildPrimaryIndexes(Table *table);
+bool deleteSelectedRows(Table *table, const uint64_t *selection);
+
+void dropSpill(Table *table);
+void freeColumnStorage(Column *column, int capacity);
+void freeTableStorage(Table *table);
+void unmapDatabaseFile(MappedFile *mapping);
+void freeDatabase(Database *db);
+
+#endif
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "wal.h"
+#include "output.h"
+
+#define WAL_MAX_RECORD (64u << 20)
+
+typedef struct {
+    uint32_t length;
+    uint32_t checksum;
+    uint64_t sequence;
+} WalRecordHeader;
+
+static uint32_t fnvUpdate(uint32_t hash, const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// FNV-1a over the sequence number and text, enough to tell a torn or
+// overwritten record from a complete one.
+static uint32_t walChecksum(uint64_t sequence, const char *data, size_t length) {
+    return fnvUpdate(fnvUpdate(2166136261u, &sequence, sizeof(sequence)), data, length);
+}
+
+static void walPath(const char *dbName, char *path, size_t size) {
+    snprintf(path, size, "data/%s.wal", dbName);
+}
+
+WriteAheadLog *openWal(const char *dbName) {
+    WriteAheadLog *wal = malloc(sizeof(WriteAheadLog));
+    if (!wal) {
+        reportError("Error: Memory allocation failed for write-ahead log.\n");
+        return NULL;
+    }
+    walPath(dbName, wal->path, sizeof(wal->path));
+    wal->fd = open(wal->path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (wal->fd < 0) {
+        printSystemError("Error opening write-ahead log");
+        free(wal);
+        return NULL;
+    }
+    return wal;
+}
+
+void closeWal(WriteAheadLog *wal) {
+    if (wal) {
+        close(wal->fd);
+        free(wal);
+    }
+}
+
+static bool writeFully(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+// Appends one record and waits for it to reach the disk. The header and text
+// go out in a single write so a crash leaves at most one torn record.
+bool walAppend(WriteAheadLog *wal, uint64_t sequence, const char *command) {
+    size_t length = strlen(command);
+    if (length > WAL_MAX_RECORD) {
+        reportError("Error: Command too long for the write-ahead log.\n");
+        return false;
+    }
+
+    char stackBuffer[512];
+    size_t recordSize = sizeof(WalRecordHeader) + length;
+    char *record = recordSize <= sizeof(stackBuffer) ? stackBuffer : malloc(recordSize);
+    if (!record) {
+        reportError("Error: Memory allocation failed for write-ahead log.\n");
+        return false;
+    }
+
+    WalRecordHeader header = {(uint32_t)length, walChecksum(sequence, command, length), sequence};
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), command, length);
+
+    bool ok = writeFully(wal->fd, record, recordSize) && fdatasync(wal->fd) == 0;
+    if (record != stackBuffer) {
+        free(record);
+    }
+    if (!ok) {
+        printSystemError("Error writing write-ahead log");
+    }
+    return ok;
+}
+
+// Empties the log once everything it records has been saved.
+bool walReset(WriteAheadLog *wal) {
+    if (ftruncate(wal->fd, 0) != 0 || fdatasync(wal->fd) != 0) {
+        printSystemError("Error truncating write-ahead log");
+        return false;
+    }
+    return true;
+}
+
+bool walExists(const char *dbName) {
+    char path[128];
+    struct stat info;
+    walPath(dbName, path, sizeof(path));
+    return stat(path, &info) == 0 && info.st_size > 0;
+}
+
+void removeWal(const char *dbName) {
+    char path[128];
+    walPath(dbName, path, sizeof(path));
+    unlink(path);
+}
+
+// Passes every intact record after *sequence to apply in order, leaves
+// *sequence at the last of them and returns how many were replayed. Records
+// at or before *sequence are already in the saved file. A torn tail left by
+// a crash is cut off so later appends follow the last good record. Returns -1,
+// leaving the log as it is, if it could not be read or replayed.
+int walReplay(const char *dbName, uint64_t *sequence, void (*apply)(char *command)) {
+    char path[128];
+    walPath(dbName, path, sizeof(path));
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t size = info.st_size;
+    char *log = malloc(size + 1);
+    if (!log || pread(fd, log, size, 0) != (ssize_t)size) {
+        reportError("Error: Could not read write-ahead log '%s'.\n", path);
+        free(log);
+        close(fd);
+        return -1;
+    }
+
+    size_t offset = 0;
+    int replayed = 0;
+    while (size - offset >= sizeof(WalRecordHeader)) {
+        WalRecordHeader header;
+        memcpy(&header, log + offset, sizeof(header));
+        char *text = log + offset + sizeof(header);
+        if (header.length > size - offset - sizeof(header) ||
+            walChecksum(header.sequence, text, header.length) != header.checksum) {
+            break;
+        }
+        if (header.sequence <= *sequence) {
+            offset += sizeof(header) + header.length;
+            continue;
+        }
+
+        // Commands are parsed in place, so hand each one its own copy.
+        // Running out of memory is not a torn tail, so the log is left whole
+        // for the next load.
+        char *command = malloc(header.length + 1);
+        if (!command) {
+            reportError("Error: Memory allocation failed while replaying write-ahead log '%s'.\n", path);
+            free(log);
+            close(fd);
+            return -1;
+        }
+        memcpy(command, text, header.length);
+        command[header.length] = '\0';
+        apply(command);
+        free(command);
+
+        offset += sizeof(header) + header.length;
+        *sequence = header.sequence;
+        replayed++;
+    }
+
+    if (offset < size) {
+        fprintf(commandOutput(), "Warning: Discarding %zu bytes of incomplete write-ahead log in '%s'.\n", size - offset, path);
+        if (ftruncate(fd, offset) != 0) {
+            printSystemError("Error truncating write-ahead log");
+        }
+    }
+    free(log);
+    close(fd);
+    return replayed;
+}
@@ -0,0 +1,30 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Write-ahead log of one database, kept in data/<name>.wal. Every mutating
+// command that succeeds is appended as a record:
+//
+//   uint32 length, uint32 checksum, uint64 sequence, length bytes of command text
+//
+// Sequence numbers increase by one per record for the life of the database.
+// A saved file records the last sequence it contains, so loading a database
+// replays only the later records on top of it, and a crash between writing
+// the file and truncating the log does not apply anything twice. A torn or
+// corrupt record ends the log.
+typedef struct WriteAheadLog {
+    int fd;
+    char path[128];
+} WriteAheadLog;
+
+WriteAheadLog *openWal(const char *dbName);
+void closeWal(WriteAheadLog *wal);
+bool walAppend(WriteAheadLog *wal, uint64_t sequence, const char *command);
+bool walReset(WriteAheadLog *wal);
+bool walExists(const char *dbName);
+void removeWal(const char *dbName);
+int walReplay(const char *dbName, uint64_t *sequence, void (*apply)(char *command));
+
+#endif